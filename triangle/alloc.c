@@ -0,0 +1,237 @@
+#include "alloc.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+const VkAllocationCallbacks *vk_allocator = NULL;
+static struct host_alloc *host_installed; /* for host_realloc() */
+
+void arena_init(struct arena *a, const char *name, size_t cap) {
+    a->name = name;
+    a->base = malloc(cap);
+    if (!a->base)
+        die("out of memory for %zu byte %s arena", cap, name);
+    a->cap = cap;
+    a->used = a->peak = 0;
+}
+
+void arena_destroy(struct arena *a) {
+    free(a->base);
+    a->base = NULL;
+}
+
+void *arena_alloc(struct arena *a, size_t size) {
+    size_t offset = (a->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size > a->cap - offset || offset > a->cap)
+        die("%s arena of %zu bytes cannot fit %zu more", a->name, a->cap,
+            size);
+    a->used = offset + size;
+    if (a->used > a->peak)
+        a->peak = a->used;
+    return a->base + offset;
+}
+
+size_t arena_mark(struct arena *a) {
+    return a->used;
+}
+
+void arena_reset(struct arena *a, size_t mark) {
+    a->used = mark;
+}
+
+void arena_stats_print(struct arena *a) {
+    printf("  %s arena: %zu/%zu bytes at most\n", a->name, a->peak, a->cap);
+}
+
+/* Precedes every block handed to the driver, which only gives the
+ * pointer back on free. Blocks are over-allocated so the header and the
+ * alignment asked for both fit. */
+struct host_header {
+    void *raw; /* from malloc */
+    size_t size;
+    uint32_t scope;
+} __attribute__((aligned(16)));
+
+static struct host_header *host_header(void *p) {
+    return (struct host_header*)p - 1;
+}
+
+static void *host_malloc(struct host_alloc *h, size_t size, size_t align,
+                         VkSystemAllocationScope scope) {
+    if (align < sizeof(struct host_header))
+        align = sizeof(struct host_header);
+    char *raw = malloc(size + align + sizeof(struct host_header));
+    if (!raw)
+        return NULL;
+    uintptr_t start = (uintptr_t)raw + sizeof(struct host_header);
+    uintptr_t aligned = (start + align - 1) & ~(uintptr_t)(align - 1);
+    char *p = raw + (aligned - (uintptr_t)raw);
+    struct host_header *hdr = host_header(p);
+    hdr->raw = raw;
+    hdr->size = size;
+    hdr->scope = scope < HOST_SCOPES ? scope : 0;
+
+    pthread_mutex_lock(&h->lock);
+    struct host_stats *s = &h->scopes[hdr->scope];
+    s->live += size;
+    if (s->live > s->peak)
+        s->peak = s->live;
+    pthread_mutex_unlock(&h->lock);
+    return p;
+}
+
+/* a reallocated block is not counted as freed, its copy replaces it */
+static void host_release(struct host_alloc *h, void *p, bool freed) {
+    struct host_header *hdr = host_header(p);
+    pthread_mutex_lock(&h->lock);
+    if (freed)
+        h->scopes[hdr->scope].frees++;
+    h->scopes[hdr->scope].live -= hdr->size;
+    pthread_mutex_unlock(&h->lock);
+    free(hdr->raw);
+}
+
+static void *VKAPI_PTR host_allocation(void *user, size_t size,
+                                       size_t align,
+                                       VkSystemAllocationScope scope) {
+    struct host_alloc *h = user;
+    void *p = host_malloc(h, size, align, scope);
+    if (p) {
+        pthread_mutex_lock(&h->lock);
+        h->scopes[host_header(p)->scope].allocs++;
+        pthread_mutex_unlock(&h->lock);
+    }
+    return p;
+}
+
+static void *VKAPI_PTR host_reallocation(void *user, void *original,
+                                         size_t size, size_t align,
+                                         VkSystemAllocationScope scope) {
+    struct host_alloc *h = user;
+    if (!original)
+        return host_allocation(user, size, align, scope);
+    if (size == 0) {
+        host_release(h, original, true);
+        return NULL;
+    }
+
+    void *p = host_malloc(h, size, align, scope);
+    if (!p)
+        return NULL; /* the original stays valid */
+    size_t old = host_header(original)->size;
+    memcpy(p, original, old < size ? old : size);
+    pthread_mutex_lock(&h->lock);
+    h->scopes[host_header(p)->scope].reallocs++;
+    pthread_mutex_unlock(&h->lock);
+    host_release(h, original, false);
+    return p;
+}
+
+static void VKAPI_PTR host_deallocation(void *user, void *p) {
+    if (p)
+        host_release(user, p, true);
+}
+
+static void VKAPI_PTR host_internal_alloc(void *user, size_t size,
+                                          VkInternalAllocationType type,
+                                          VkSystemAllocationScope scope) {
+    struct host_alloc *h = user;
+    pthread_mutex_lock(&h->lock);
+    h->internal_allocs++;
+    h->internal_live += size;
+    pthread_mutex_unlock(&h->lock);
+}
+
+static void VKAPI_PTR host_internal_free(void *user, size_t size,
+                                         VkInternalAllocationType type,
+                                         VkSystemAllocationScope scope) {
+    struct host_alloc *h = user;
+    pthread_mutex_lock(&h->lock);
+    h->internal_live -= size;
+    pthread_mutex_unlock(&h->lock);
+}
+
+void host_alloc_init(struct host_alloc *h) {
+    memset(h, 0, sizeof(*h));
+    pthread_mutex_init(&h->lock, NULL);
+    h->callbacks = (VkAllocationCallbacks){
+        .pUserData = h,
+        .pfnAllocation = host_allocation,
+        .pfnReallocation = host_reallocation,
+        .pfnFree = host_deallocation,
+        .pfnInternalAllocation = host_internal_alloc,
+        .pfnInternalFree = host_internal_free,
+    };
+    vk_allocator = &h->callbacks;
+    host_installed = h;
+}
+
+void host_alloc_destroy(struct host_alloc *h) {
+    vk_allocator = NULL;
+    host_installed = NULL;
+    pthread_mutex_destroy(&h->lock);
+}
+
+void *host_realloc(void *p, size_t size) {
+    if (!host_installed)
+        die("host memory used without a host allocator");
+    if (size == 0)
+        size = 1; /* not a free, as for realloc() */
+    void *q = host_reallocation(host_installed, p, size, ARENA_ALIGN,
+                                (VkSystemAllocationScope)HOST_SCOPE_APP);
+    if (!q)
+        die("out of memory for %zu bytes", size);
+    return q;
+}
+
+void host_free(void *p) {
+    if (p)
+        host_deallocation(host_installed, p);
+}
+
+static uint64_t host_count(struct host_alloc *h, uint32_t begin,
+                           uint32_t end) {
+    pthread_mutex_lock(&h->lock);
+    uint64_t count = 0;
+    for (uint32_t i = begin; i < end; i++) {
+        count += h->scopes[i].allocs + h->scopes[i].reallocs;
+    }
+    pthread_mutex_unlock(&h->lock);
+    return count;
+}
+
+uint64_t host_alloc_count(struct host_alloc *h) {
+    return host_count(h, 0, HOST_SCOPE_APP);
+}
+
+uint64_t host_app_count(struct host_alloc *h) {
+    return host_count(h, HOST_SCOPE_APP, HOST_SCOPES);
+}
+
+void host_alloc_stats_print(struct host_alloc *h) {
+    static const char *names[HOST_SCOPES] = {
+        "command", "object", "cache", "device", "instance", "ours",
+    };
+    pthread_mutex_lock(&h->lock);
+    printf("host memory:\n");
+    for (uint32_t i = 0; i < HOST_SCOPES; i++) {
+        struct host_stats *s = &h->scopes[i];
+        if (s->allocs == 0)
+            continue;
+        printf("  %s: %llu allocation(s), %llu reallocation(s), "
+               "%llu free(s), %.2f KiB live, %.2f KiB at most\n", names[i],
+               (unsigned long long)s->allocs,
+               (unsigned long long)s->reallocs,
+               (unsigned long long)s->frees, s->live/1024.0,
+               s->peak/1024.0);
+    }
+    if (h->internal_allocs > 0)
+        printf("  internal: %llu allocation(s), %.2f KiB live\n",
+               (unsigned long long)h->internal_allocs,
+               h->internal_live/1024.0);
+    pthread_mutex_unlock(&h->lock);
+}
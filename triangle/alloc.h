@@ -0,0 +1,76 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+
+/* Host memory. Arenas hand out memory from one block by bumping an
+ * offset and are reset as a whole, or back to a mark, so paths that run
+ * again and again such as swapchain recreation never reach malloc once
+ * the block is there. Driver allocations go through host_alloc, which
+ * counts them per allocation scope, and so do ours that have to grow at
+ * run time, in a scope of their own. */
+
+#define ARENA_ALIGN 16
+
+struct arena {
+    const char *name;
+    char *base;
+    size_t cap, used;
+    size_t peak; /* most ever used, to size cap by */
+};
+
+void arena_init(struct arena *a, const char *name, size_t cap);
+void arena_destroy(struct arena *a);
+
+/* ARENA_ALIGN aligned, dies when the arena is full */
+void *arena_alloc(struct arena *a, size_t size);
+/* release everything allocated since the mark was taken */
+size_t arena_mark(struct arena *a);
+void arena_reset(struct arena *a, size_t mark);
+
+void arena_stats_print(struct arena *a);
+
+/* VK_SYSTEM_ALLOCATION_SCOPE_COMMAND to _INSTANCE, then ours */
+#define HOST_SCOPE_APP 5
+#define HOST_SCOPES 6
+
+struct host_stats {
+    uint64_t allocs, reallocs, frees;
+    size_t live, peak; /* bytes */
+};
+
+struct host_alloc {
+    VkAllocationCallbacks callbacks;
+    pthread_mutex_t lock; /* drivers allocate from any thread */
+    struct host_stats scopes[HOST_SCOPES];
+    uint64_t internal_allocs; /* reported by the driver, not made by us */
+    size_t internal_live;
+};
+
+/* given to every vkCreate, vkAllocate, vkDestroy and vkFree call so that
+ * objects are always freed by the callbacks they were allocated with,
+ * NULL for the driver's own allocator */
+extern const VkAllocationCallbacks *vk_allocator;
+
+/* install h as vk_allocator, before anything is created */
+void host_alloc_init(struct host_alloc *h);
+/* after everything is destroyed */
+void host_alloc_destroy(struct host_alloc *h);
+
+/* realloc() and free() for our own memory, counted by the host_alloc
+ * installed, which must outlive the memory; dies when out of memory */
+void *host_realloc(void *p, size_t size);
+void host_free(void *p);
+
+/* allocations and reallocations made so far, in the driver's scopes and
+ * in ours */
+uint64_t host_alloc_count(struct host_alloc *h);
+uint64_t host_app_count(struct host_alloc *h);
+void host_alloc_stats_print(struct host_alloc *h);
+
+#endif
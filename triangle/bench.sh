@@ -0,0 +1,189 @@
+#!/bin/sh
+# Headless benchmark sweep: run tri once per case, collect the metrics
+# each run writes with -B into one file and compare them with a baseline.
+#
+#     bench.sh [-u] [-t percent] [-n frames] [-b baseline] [-o results]
+#              [mesh.obj ...]
+#
+# Cases vary one setting at a time from the defaults: instance count,
+# resolution, the depth pre-pass, mesh size over generated spheres of
+# about 1k, 16k and 256k triangles, and every mesh given. Frames in
+# flight and the present mode only matter with a swapchain and so are
+# not swept headless. Averages and 99th percentiles of frame times, host
+# allocations after init by the driver and by tri, and device memory
+# fail when above the baseline by more than the tolerance, times only
+# when also more than SLACK_MS above it so that sub-millisecond noise
+# does not, and so does any of them the baseline has that a run did not
+# report. -u records
+# the results as the new baseline instead. Run from the top directory,
+# tri finds its shaders relative to it.
+
+set -u
+
+tri=./tri
+update=0
+tolerance=10
+frames=600
+baseline=bench.baseline
+results=bench.out
+SLACK_MS=0.05
+
+while getopts ut:n:b:o: opt; do
+    case $opt in
+    u) update=1 ;;
+    t) tolerance=$OPTARG ;;
+    n) frames=$OPTARG ;;
+    b) baseline=$OPTARG ;;
+    o) results=$OPTARG ;;
+    *) echo "usage: $0 [-u] [-t percent] [-n frames] [-b baseline]" \
+            "[-o results] [mesh.obj ...]" >&2
+       exit 2 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+tmp=${TMPDIR:-/tmp}/bench.$$
+trap 'rm -rf "$tmp" "$tmp.log" "$tmp.all" "$tmp.metrics" "$tmp.meshes"' EXIT
+trap 'exit 130' INT TERM
+
+# a uv sphere of rings by segs quads with smooth normals, the poles
+# fanned with triangles
+sphere() {
+    awk -v rings="$2" -v segs="$3" 'BEGIN {
+        pi = atan2(0, -1)
+        for (r = 0; r <= rings; r++) {
+            for (s = 0; s <= segs; s++) {
+                t = pi*r/rings
+                p = 2*pi*s/segs
+                x = sin(t)*cos(p); y = sin(t)*sin(p); z = cos(t)
+                printf "v %.6f %.6f %.6f\nvn %.6f %.6f %.6f\n",
+                       x, y, z, x, y, z
+            }
+        }
+        for (r = 0; r < rings; r++) {
+            for (s = 0; s < segs; s++) {
+                a = r*(segs + 1) + s + 1
+                b = a + segs + 1
+                if (r > 0)
+                    printf "f %d//%d %d//%d %d//%d\n", a, a, b, b, a+1, a+1
+                if (r < rings - 1)
+                    printf "f %d//%d %d//%d %d//%d\n", a+1, a+1, b, b,
+                           b+1, b+1
+            }
+        }
+    }' > "$1"
+}
+
+mkdir -p "$tmp.meshes"
+sphere "$tmp.meshes/sphere_1k.obj" 16 32
+sphere "$tmp.meshes/sphere_16k.obj" 64 128
+sphere "$tmp.meshes/sphere_256k.obj" 256 512
+
+# one case per line, its name, the options of tri and a mesh to draw
+# instead of the default one, split by |; the mesh goes last and as is so
+# that its path may hold anything but a newline
+cases() {
+    echo "default||"
+    for i in 1024 16384 65536; do
+        echo "instances_$i|-i $i|"
+    done
+    for r in 1920x1080 3840x2160; do
+        echo "resolution_$r|-r $r|"
+    done
+    echo "prepass|-z|"
+    echo "heavy|-i 65536 -r 1920x1080 -z|"
+    for m in "$tmp.meshes"/*.obj; do
+        echo "$(basename "$m" .obj)||$m"
+    done
+    for m in "$@"; do
+        # names are a column of the results, keep them one word
+        echo "mesh_$(basename "$m" .obj | tr ' \t|' '___')||$m"
+    done
+}
+
+: > "$tmp.all"
+failed=0
+
+cases "$@" > "$tmp"
+while IFS='|' read -r name args mesh; do
+    printf '%-24s' "$name"
+    # the options are plain words, split them without globbing
+    set -f
+    set -- $args
+    set +f
+    if [ -n "$mesh" ]; then
+        set -- "$@" -o "$mesh"
+    fi
+    if ! "$tri" -H -n "$frames" "$@" -B "$tmp.metrics" \
+            < /dev/null > "$tmp.log" 2>&1; then
+        echo "run failed:"
+        sed 's/^/    /' "$tmp.log"
+        failed=1
+        continue
+    fi
+    awk -v name="$name" '{ print name, $1, $2 }' "$tmp.metrics" \
+        >> "$tmp.all"
+    awk '$1 == "frame_avg_ms" { a = $2 } $1 == "gpu_frame_avg_ms" { g = $2 }
+         END { printf "frame %s ms, gpu %s ms\n", a, g == "" ? "-" : g }' \
+        "$tmp.metrics"
+    rm -f "$tmp.metrics"
+done < "$tmp"
+mv "$tmp.all" "$results"
+echo "results in $results"
+
+if [ "$failed" -ne 0 ]; then
+    echo "verdict: fail, not every case ran"
+    exit 1
+fi
+if [ "$update" -eq 1 ]; then
+    cp "$results" "$baseline"
+    echo "baseline $baseline updated"
+    exit 0
+fi
+if [ ! -f "$baseline" ]; then
+    echo "no baseline $baseline, record one with -u"
+    exit 0
+fi
+
+awk -v tol="$tolerance" -v slack="$SLACK_MS" '
+function judged(metric) {
+    return metric ~ /_(avg|p99)_ms$/ || metric ~ /^(driver|app)_allocs$/ ||
+           metric ~ /^device_.*_mib$/
+}
+NR == FNR { base[$1 " " $2] = $3; next }
+judged($2) {
+    key = $1 " " $2
+    seen[key] = 1
+    if (!(key in base)) {
+        printf "  %-24s %-22s %10s %10.3f  new\n", $1, $2, "-", $3
+        next
+    }
+    b = base[key]
+    limit = b*(1 + tol/100)
+    if ($2 ~ /_ms$/ && limit < b + slack)
+        limit = b + slack
+    worse = $3 > limit
+    fails += worse
+    change = b != 0 ? sprintf("%+.1f%%", ($3 - b)*100/b) : \
+                      ($3 != 0 ? "+inf" : "0")
+    printf "  %-24s %-22s %10.3f %10.3f  %s%s\n", $1, $2, b, $3, change,
+           worse ? "  REGRESSION" : ""
+}
+END {
+    # a case that ran too few frames or lost its gpu timings must not
+    # pass by measuring nothing
+    for (key in base) {
+        split(key, f, " ")
+        if (!judged(f[2]) || key in seen)
+            continue
+        printf "  %-24s %-22s %10.3f %10s  MISSING\n", f[1], f[2],
+               base[key], "-"
+        fails++
+    }
+    if (fails > 0) {
+        printf "verdict: fail, %d metric(s) missing or over %s%% " \
+               "tolerance\n", fails, tol
+        exit 1
+    }
+    printf "verdict: pass within %s%%\n", tol
+}' "$baseline" "$results"
@@ -0,0 +1,123 @@
+#include "bindless.h"
+
+#include "alloc.h"
+#include "util.h"
+
+void bindless_init(struct bindless *b, VkDevice device) {
+    b->device = device;
+    b->imagec = b->bufferc = 0;
+
+    VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT |
+                                VK_SHADER_STAGE_FRAGMENT_BIT |
+                                VK_SHADER_STAGE_COMPUTE_BIT;
+    VkDescriptorSetLayoutBinding bindings[] = {
+        [BINDLESS_IMAGE_BINDING] = {
+            .binding = BINDLESS_IMAGE_BINDING,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .descriptorCount = BINDLESS_IMAGES,
+            .stageFlags = stages,
+        },
+        [BINDLESS_BUFFER_BINDING] = {
+            .binding = BINDLESS_BUFFER_BINDING,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = BINDLESS_BUFFERS,
+            .stageFlags = stages,
+        },
+    };
+    VkDescriptorBindingFlags flags =
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+        VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+        VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+    VkDescriptorBindingFlags binding_flags[] = {flags, flags};
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {
+        .sType =
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .bindingCount = 2,
+        .pBindingFlags = binding_flags,
+    };
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &flags_info,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = 2,
+        .pBindings = bindings,
+    };
+    if (vkCreateDescriptorSetLayout(device, &layout_info, vk_allocator,
+                                    &b->layout) != VK_SUCCESS)
+        die("failed to create bindless descriptor set layout");
+
+    VkDescriptorPoolSize sizes[] = {
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, BINDLESS_IMAGES},
+        {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, BINDLESS_BUFFERS},
+    };
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = 2,
+        .pPoolSizes = sizes,
+    };
+    if (vkCreateDescriptorPool(device, &pool_info, vk_allocator, &b->pool)
+            != VK_SUCCESS)
+        die("failed to create bindless descriptor pool");
+
+    VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = b->pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &b->layout,
+    };
+    if (vkAllocateDescriptorSets(device, &alloc_info, &b->set) != VK_SUCCESS)
+        die("failed to allocate bindless descriptor set");
+}
+
+void bindless_destroy(struct bindless *b) {
+    vkDestroyDescriptorPool(b->device, b->pool, vk_allocator);
+    vkDestroyDescriptorSetLayout(b->device, b->layout, vk_allocator);
+}
+
+uint32_t bindless_image(struct bindless *b, VkImageView view,
+                        VkSampler sampler) {
+    if (b->imagec == BINDLESS_IMAGES)
+        die("out of bindless image slots");
+
+    VkDescriptorImageInfo image_info = {
+        .sampler = sampler,
+        .imageView = view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = b->set,
+        .dstBinding = BINDLESS_IMAGE_BINDING,
+        .dstArrayElement = b->imagec,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .pImageInfo = &image_info,
+    };
+    vkUpdateDescriptorSets(b->device, 1, &write, 0, NULL);
+    return b->imagec++;
+}
+
+uint32_t bindless_buffer(struct bindless *b, VkBuffer buffer,
+                         VkDeviceSize offset, VkDeviceSize range) {
+    if (b->bufferc == BINDLESS_BUFFERS)
+        die("out of bindless buffer slots");
+
+    VkDescriptorBufferInfo buffer_info = {
+        .buffer = buffer,
+        .offset = offset,
+        .range = range,
+    };
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = b->set,
+        .dstBinding = BINDLESS_BUFFER_BINDING,
+        .dstArrayElement = b->bufferc,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = 1,
+        .pBufferInfo = &buffer_info,
+    };
+    vkUpdateDescriptorSets(b->device, 1, &write, 0, NULL);
+    return b->bufferc++;
+}
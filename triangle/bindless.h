@@ -0,0 +1,44 @@
+#ifndef BINDLESS_H
+#define BINDLESS_H
+
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+/* One descriptor set holding every sampled image and storage buffer in
+ * large arrays, bound once per command buffer as set BINDLESS_SET and
+ * indexed from push constants or instance data, so draws switching
+ * materials never rebind descriptors. The bindings are update after bind
+ * and partially bound, only slots handed out are written. Slots are never
+ * reused, so an update never touches a descriptor a frame in flight may
+ * read. Needs descriptor indexing, core but optional in 1.2. */
+
+#define BINDLESS_SET 1
+/* far below the 500000 update after bind descriptors devices with
+ * descriptor indexing must support per stage */
+#define BINDLESS_IMAGES 4096
+#define BINDLESS_BUFFERS 1024
+
+enum bindless_binding {
+    BINDLESS_IMAGE_BINDING, /* combined image samplers */
+    BINDLESS_BUFFER_BINDING, /* storage buffers */
+};
+
+struct bindless {
+    VkDevice device;
+    VkDescriptorSetLayout layout;
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+    uint32_t imagec, bufferc;
+};
+
+void bindless_init(struct bindless *b, VkDevice device);
+void bindless_destroy(struct bindless *b);
+
+/* write a descriptor to the next free slot and return its index */
+uint32_t bindless_image(struct bindless *b, VkImageView view,
+                        VkSampler sampler);
+uint32_t bindless_buffer(struct bindless *b, VkBuffer buffer,
+                         VkDeviceSize offset, VkDeviceSize range);
+
+#endif
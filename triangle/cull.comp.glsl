@@ -0,0 +1,81 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/* one workgroup per batch, must match CULL_BATCH */
+layout(local_size_x = 256) in;
+
+const uint CULL_COMPACT = 1;
+const uint CULL_FIRST_INSTANCE = 2;
+
+struct instance {
+    mat4 model;
+    vec4 col;
+};
+
+struct draw_cmd {
+    uint index_count;
+    uint instance_count;
+    uint first_index;
+    int vertex_offset;
+    uint first_instance;
+};
+
+layout(binding = 0) uniform buffer_object {
+    mat4 view;
+    mat4 proj;
+    vec4 planes[6];
+    uint instance_count;
+    uint index_count;
+    float radius;
+    uint flags;
+} ubo;
+
+layout(std430, binding = 1) readonly buffer instances_in {
+    instance insts[];
+};
+layout(std430, binding = 2) writeonly buffer instances_out {
+    instance visible[];
+};
+layout(std430, binding = 3) buffer draws {
+    uint draw_count;
+    draw_cmd cmds[];
+};
+
+shared uint batch_count;
+
+void main() {
+    uint i = gl_GlobalInvocationID.x;
+    uint base = gl_WorkGroupID.x * gl_WorkGroupSize.x;
+
+    if (gl_LocalInvocationIndex == 0)
+        batch_count = 0;
+    memoryBarrierShared();
+    barrier();
+
+    /* bounding sphere of the mesh, scaled by the instance's x axis */
+    if (i < ubo.instance_count) {
+        mat4 m = insts[i].model;
+        vec3 center = m[3].xyz;
+        float radius = ubo.radius * length(m[0].xyz);
+        bool inside = true;
+        for (int p = 0; p < 6; p++) {
+            if (dot(ubo.planes[p].xyz, center) + ubo.planes[p].w < -radius)
+                inside = false;
+        }
+        if (inside)
+            visible[base + atomicAdd(batch_count, 1)] = insts[i];
+    }
+    memoryBarrierShared();
+    barrier();
+
+    /* compacted commands are only drawn up to draw_count, otherwise every
+     * batch owns its command and empty ones draw nothing */
+    if (gl_LocalInvocationIndex != 0)
+        return;
+    bool compact = (ubo.flags & CULL_COMPACT) != 0;
+    if (compact && batch_count == 0)
+        return;
+    uint slot = compact ? atomicAdd(draw_count, 1) : gl_WorkGroupID.x;
+    uint first = (ubo.flags & CULL_FIRST_INSTANCE) != 0 ? base : 0;
+    cmds[slot] = draw_cmd(ubo.index_count, batch_count, 0, 0, first);
+}
@@ -0,0 +1,122 @@
+#include "defer.h"
+
+#include <string.h>
+
+#include "alloc.h"
+
+void defer_init(struct defer_queue *dq, VkDevice device,
+                struct mem_allocator *ma, struct timeline *timeline) {
+    dq->device = device;
+    dq->ma = ma;
+    dq->timeline = timeline;
+    dq->entries = NULL;
+    dq->count = dq->cap = 0;
+}
+
+static void defer_run(struct defer_queue *dq, struct defer_entry *e) {
+    VkDevice device = dq->device;
+    switch (e->type) {
+    case DEFER_SWAPCHAIN:
+        vkDestroySwapchainKHR(device, e->handle.swapchain, vk_allocator);
+        break;
+    case DEFER_FRAMEBUFFER:
+        vkDestroyFramebuffer(device, e->handle.framebuffer, vk_allocator);
+        break;
+    case DEFER_IMAGE_VIEW:
+        vkDestroyImageView(device, e->handle.image_view, vk_allocator);
+        break;
+    case DEFER_IMAGE:
+        vkDestroyImage(device, e->handle.image, vk_allocator);
+        mem_free(dq->ma, &e->mem);
+        break;
+    case DEFER_BUFFER:
+        mem_buffer_destroy(dq->ma, e->handle.buffer, &e->mem);
+        break;
+    case DEFER_SEMAPHORE:
+        vkDestroySemaphore(device, e->handle.semaphore, vk_allocator);
+        break;
+    case DEFER_PIPELINE:
+        vkDestroyPipeline(device, e->handle.pipeline, vk_allocator);
+        break;
+    case DEFER_RENDER_PASS:
+        vkDestroyRenderPass(device, e->handle.render_pass, vk_allocator);
+        break;
+    }
+}
+
+void defer_destroy(struct defer_queue *dq) {
+    for (size_t i = 0; i < dq->count; i++) {
+        defer_run(dq, &dq->entries[i]);
+    }
+    host_free(dq->entries);
+    dq->entries = NULL;
+    dq->count = dq->cap = 0;
+}
+
+static struct defer_entry *defer_push(struct defer_queue *dq,
+                                      enum defer_type type) {
+    if (dq->count == dq->cap) {
+        size_t cap = dq->cap ? dq->cap*2 : 64;
+        dq->entries = host_realloc(dq->entries,
+                                   cap*sizeof(*dq->entries));
+        dq->cap = cap;
+    }
+    struct defer_entry *e = &dq->entries[dq->count++];
+    memset(e, 0, sizeof(*e));
+    e->value = dq->timeline->last + 1;
+    e->type = type;
+    return e;
+}
+
+void defer_swapchain(struct defer_queue *dq, VkSwapchainKHR swapchain) {
+    defer_push(dq, DEFER_SWAPCHAIN)->handle.swapchain = swapchain;
+}
+
+void defer_framebuffer(struct defer_queue *dq, VkFramebuffer framebuffer) {
+    defer_push(dq, DEFER_FRAMEBUFFER)->handle.framebuffer = framebuffer;
+}
+
+void defer_image_view(struct defer_queue *dq, VkImageView image_view) {
+    defer_push(dq, DEFER_IMAGE_VIEW)->handle.image_view = image_view;
+}
+
+void defer_image(struct defer_queue *dq, VkImage image,
+                 struct mem_alloc *mem) {
+    struct defer_entry *e = defer_push(dq, DEFER_IMAGE);
+    e->handle.image = image;
+    e->mem = *mem;
+}
+
+void defer_buffer(struct defer_queue *dq, VkBuffer buffer,
+                  struct mem_alloc *mem) {
+    struct defer_entry *e = defer_push(dq, DEFER_BUFFER);
+    e->handle.buffer = buffer;
+    e->mem = *mem;
+}
+
+void defer_semaphore(struct defer_queue *dq, VkSemaphore semaphore) {
+    defer_push(dq, DEFER_SEMAPHORE)->handle.semaphore = semaphore;
+}
+
+void defer_pipeline(struct defer_queue *dq, VkPipeline pipeline) {
+    defer_push(dq, DEFER_PIPELINE)->handle.pipeline = pipeline;
+}
+
+void defer_render_pass(struct defer_queue *dq, VkRenderPass render_pass) {
+    defer_push(dq, DEFER_RENDER_PASS)->handle.render_pass = render_pass;
+}
+
+void defer_collect(struct defer_queue *dq) {
+    if (dq->count == 0)
+        return;
+
+    uint64_t completed = timeline_completed(dq->timeline);
+    size_t done = 0;
+    while (done < dq->count && dq->entries[done].value <= completed) {
+        defer_run(dq, &dq->entries[done]);
+        done++;
+    }
+    memmove(dq->entries, dq->entries + done,
+            (dq->count - done)*sizeof(*dq->entries));
+    dq->count -= done;
+}
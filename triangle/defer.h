@@ -0,0 +1,74 @@
+#ifndef DEFER_H
+#define DEFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+#include "mem.h"
+#include "timeline.h"
+
+/* Deferred destruction. Retired objects are tagged with the timeline value
+ * of the next submission and destroyed once it has completed, so whatever
+ * was in flight when they were retired is done with them without waiting
+ * for the device to idle. The extra submission also covers presentation,
+ * whose semaphore waits are not on the timeline but are queued before any
+ * later submission. */
+
+enum defer_type {
+    DEFER_SWAPCHAIN,
+    DEFER_FRAMEBUFFER,
+    DEFER_IMAGE_VIEW,
+    DEFER_IMAGE, /* with its memory */
+    DEFER_BUFFER, /* with its memory */
+    DEFER_SEMAPHORE,
+    DEFER_PIPELINE,
+    DEFER_RENDER_PASS,
+};
+
+struct defer_entry {
+    uint64_t value;
+    enum defer_type type;
+    union {
+        VkSwapchainKHR swapchain;
+        VkFramebuffer framebuffer;
+        VkImageView image_view;
+        VkImage image;
+        VkBuffer buffer;
+        VkSemaphore semaphore;
+        VkPipeline pipeline;
+        VkRenderPass render_pass;
+    } handle;
+    struct mem_alloc mem;
+};
+
+/* entries are kept in retirement order, so by increasing value */
+struct defer_queue {
+    VkDevice device;
+    struct mem_allocator *ma;
+    struct timeline *timeline;
+    struct defer_entry *entries;
+    size_t count, cap;
+};
+
+void defer_init(struct defer_queue *dq, VkDevice device,
+                struct mem_allocator *ma, struct timeline *timeline);
+/* destroys everything left, the device must be idle */
+void defer_destroy(struct defer_queue *dq);
+
+void defer_swapchain(struct defer_queue *dq, VkSwapchainKHR swapchain);
+void defer_framebuffer(struct defer_queue *dq, VkFramebuffer framebuffer);
+void defer_image_view(struct defer_queue *dq, VkImageView image_view);
+void defer_image(struct defer_queue *dq, VkImage image,
+                 struct mem_alloc *mem);
+void defer_buffer(struct defer_queue *dq, VkBuffer buffer,
+                  struct mem_alloc *mem);
+void defer_semaphore(struct defer_queue *dq, VkSemaphore semaphore);
+void defer_pipeline(struct defer_queue *dq, VkPipeline pipeline);
+void defer_render_pass(struct defer_queue *dq, VkRenderPass render_pass);
+
+/* destroy everything whose value the timeline has reached, never blocks */
+void defer_collect(struct defer_queue *dq);
+
+#endif
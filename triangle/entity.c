@@ -0,0 +1,173 @@
+#include "entity.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+#define ENTITY_ALIGN 64 /* every array starts on a cache line */
+
+/* one level of the hierarchy, split in chunks of ENTITY_CHUNK */
+struct entity_level {
+    struct entity_store *es;
+    struct instance *insts;
+    uint32_t begin, end;
+};
+
+static void *entity_carve(char **p, size_t size) {
+    void *array = *p;
+    *p += (size + ENTITY_ALIGN - 1) & ~(size_t)(ENTITY_ALIGN - 1);
+    return array;
+}
+
+void entity_store_init(struct entity_store *es, uint32_t cap) {
+    size_t sizes[] = {
+        cap*sizeof(float), cap*sizeof(vec4), cap*sizeof(uint32_t),
+        cap*sizeof(mat4),
+    };
+    size_t counts[] = {10, 1, 2, 1};
+    size_t size = ENTITY_ALIGN;
+    for (uint32_t i = 0; i < 4; i++)
+        size += counts[i]*(sizes[i] + ENTITY_ALIGN);
+    es->block = malloc(size);
+    if (!es->block)
+        die("out of memory for %u entities", cap);
+
+    uintptr_t base = (uintptr_t)es->block;
+    char *p = (char*)es->block +
+              (ENTITY_ALIGN - base % ENTITY_ALIGN) % ENTITY_ALIGN;
+    float **floats[] = {
+        &es->px, &es->py, &es->pz,
+        &es->qx, &es->qy, &es->qz, &es->qw,
+        &es->sx, &es->sy, &es->sz,
+    };
+    for (uint32_t i = 0; i < 10; i++)
+        *floats[i] = entity_carve(&p, sizes[0]);
+    es->col = entity_carve(&p, sizes[1]);
+    es->parent = entity_carve(&p, sizes[2]);
+    es->world = entity_carve(&p, sizes[2]);
+    es->worlds = entity_carve(&p, sizes[3]);
+
+    es->cap = cap;
+    entity_store_clear(es);
+}
+
+void entity_store_destroy(struct entity_store *es) {
+    free(es->block);
+}
+
+void entity_store_clear(struct entity_store *es) {
+    es->count = 0;
+    es->worldc = 0;
+    es->depthc = 0;
+}
+
+static uint32_t entity_depth(struct entity_store *es, uint32_t index) {
+    uint32_t depth = 0;
+    while (es->depth_end[depth] <= index)
+        depth++;
+    return depth;
+}
+
+uint32_t entity_add(struct entity_store *es, uint32_t parent,
+                    const vec3 pos, const vec4 rot, const vec3 scale,
+                    const vec4 col) {
+    if (es->count == es->cap)
+        die("more than %u entities", es->cap);
+    if (parent != ENTITY_NONE && parent >= es->count)
+        die("entity %u has no parent %u", es->count, parent);
+
+    uint32_t depth = parent == ENTITY_NONE ? 0
+                                           : entity_depth(es, parent) + 1;
+    if (depth >= ENTITY_MAX_DEPTH)
+        die("entity %u deeper than %d", es->count, ENTITY_MAX_DEPTH);
+    if (es->depthc > depth + 1)
+        die("entity %u at depth %u after depth %u, add breadth first",
+            es->count, depth, es->depthc - 1);
+
+    uint32_t i = es->count++;
+    if (es->depthc == depth)
+        es->depthc++;
+    es->depth_end[depth] = es->count;
+
+    es->px[i] = pos[0];
+    es->py[i] = pos[1];
+    es->pz[i] = pos[2];
+    es->qx[i] = rot[0];
+    es->qy[i] = rot[1];
+    es->qz[i] = rot[2];
+    es->qw[i] = rot[3];
+    es->sx[i] = scale[0];
+    es->sy[i] = scale[1];
+    es->sz[i] = scale[2];
+    memcpy(es->col[i], col, sizeof(vec4));
+    es->parent[i] = parent;
+    es->world[i] = ENTITY_NONE;
+    if (parent != ENTITY_NONE && es->world[parent] == ENTITY_NONE)
+        es->world[parent] = es->worldc++;
+
+    return i;
+}
+
+/* the local transform, scale then rotation then translation */
+static void entity_local(struct entity_store *es, uint32_t i, mat4 m) {
+    float x = es->qx[i], y = es->qy[i], z = es->qz[i], w = es->qw[i];
+    float sx = es->sx[i], sy = es->sy[i], sz = es->sz[i];
+
+    m[0][0] = (1 - 2*(y*y + z*z))*sx;
+    m[0][1] = 2*(x*y + z*w)*sx;
+    m[0][2] = 2*(x*z - y*w)*sx;
+    m[0][3] = 0;
+    m[1][0] = 2*(x*y - z*w)*sy;
+    m[1][1] = (1 - 2*(x*x + z*z))*sy;
+    m[1][2] = 2*(y*z + x*w)*sy;
+    m[1][3] = 0;
+    m[2][0] = 2*(x*z + y*w)*sz;
+    m[2][1] = 2*(y*z - x*w)*sz;
+    m[2][2] = (1 - 2*(x*x + y*y))*sz;
+    m[2][3] = 0;
+    m[3][0] = es->px[i];
+    m[3][1] = es->py[i];
+    m[3][2] = es->pz[i];
+    m[3][3] = 1;
+}
+
+static void entity_update_chunk(void *arg, uint32_t index) {
+    struct entity_level *level = arg;
+    struct entity_store *es = level->es;
+    uint32_t begin = level->begin + index*ENTITY_CHUNK;
+    uint32_t end = begin + ENTITY_CHUNK < level->end ? begin + ENTITY_CHUNK
+                                                     : level->end;
+
+    for (uint32_t i = begin; i < end; i++) {
+        mat4 local, world;
+        entity_local(es, i, local);
+        float (*m)[4] = local;
+        if (es->parent[i] != ENTITY_NONE) {
+            mat4_mul(world, es->worlds[es->world[es->parent[i]]], local);
+            m = world;
+        }
+        /* whole matrices at once, the instances are write only */
+        memcpy(level->insts[i].model, m, sizeof(mat4));
+        memcpy(level->insts[i].col, es->col[i], sizeof(vec4));
+        if (es->world[i] != ENTITY_NONE)
+            memcpy(es->worlds[es->world[i]], m, sizeof(mat4));
+    }
+}
+
+void entity_store_update(struct entity_store *es, struct jobs *jobs,
+                         struct instance *insts) {
+    uint32_t begin = 0;
+    for (uint32_t d = 0; d < es->depthc; d++) {
+        struct entity_level level = {
+            .es = es,
+            .insts = insts,
+            .begin = begin,
+            .end = es->depth_end[d],
+        };
+        uint32_t chunkc = (level.end - begin + ENTITY_CHUNK - 1)
+                        / ENTITY_CHUNK;
+        jobs_run(jobs, chunkc, entity_update_chunk, &level);
+        begin = level.end;
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef ENTITY_H
+#define ENTITY_H
+
+#include <stdint.h>
+
+#include "jobs.h"
+#include "linear.h"
+
+/* Scene objects as a structure of arrays: every field of every entity is
+ * one contiguous array, so the transform update streams through exactly
+ * the fields it reads and a loop over them vectorizes. Entities are kept
+ * sorted by depth in the hierarchy, which entity_add() enforces, so each
+ * level only depends on the one above and is updated in parallel chunks
+ * with nothing but a barrier between levels.
+ *
+ * World matrices are written straight into the instance stream, which is
+ * mapped and may well be uncached, so it is never read back: entities
+ * with children also keep their world matrix in the store to be read by
+ * the next level. */
+
+#define ENTITY_NONE UINT32_MAX
+#define ENTITY_MAX_DEPTH 16
+#define ENTITY_CHUNK 4096 /* entities per update task */
+
+/* per instance vertex stream, binding 1 */
+struct instance {
+    mat4 model;
+    vec4 col;
+};
+
+struct entity_store {
+    uint32_t count, cap;
+
+    /* local transforms, translated, rotated by a unit quaternion and
+     * scaled per axis */
+    float *px, *py, *pz;
+    float *qx, *qy, *qz, *qw;
+    float *sx, *sy, *sz;
+    vec4 *col;
+    uint32_t *parent; /* or ENTITY_NONE */
+    uint32_t *world; /* index into worlds, ENTITY_NONE without children */
+
+    uint32_t worldc;
+    mat4 *worlds;
+
+    uint32_t depthc;
+    uint32_t depth_end[ENTITY_MAX_DEPTH]; /* one past the last entity */
+
+    void *block; /* every array above, one allocation */
+};
+
+void entity_store_init(struct entity_store *es, uint32_t cap);
+void entity_store_destroy(struct entity_store *es);
+void entity_store_clear(struct entity_store *es);
+
+/* Add an entity below parent, or a root for ENTITY_NONE, and return its
+ * index. Dies when full or when parent is shallower than the deepest
+ * entity's parent, so that entities are added breadth first. */
+uint32_t entity_add(struct entity_store *es, uint32_t parent,
+                    const vec3 pos, const vec4 rot, const vec3 scale,
+                    const vec4 col);
+
+/* write the world matrix and color of every entity to insts, in store
+ * order, running the chunks of each level on jobs */
+void entity_store_update(struct entity_store *es, struct jobs *jobs,
+                         struct instance *insts);
+
+#endif
@@ -0,0 +1,930 @@
+#include "graph.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "util.h"
+
+#define NONE UINT32_MAX
+
+struct access_info {
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    VkImageLayout layout; /* images only */
+    VkImageUsageFlags usage; /* images only */
+    bool write;
+};
+
+#define DEPTH_STAGES (VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | \
+                      VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT)
+#define WRITE_ACCESS (VK_ACCESS_SHADER_WRITE_BIT | \
+                      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | \
+                      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | \
+                      VK_ACCESS_TRANSFER_WRITE_BIT)
+
+static const struct access_info ACCESS[GRAPH_ACCESS_COUNT] = {
+    [GRAPH_TRANSFER_WRITE] = {
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_DST_BIT, true
+    },
+    [GRAPH_TRANSFER_READ] = {
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false
+    },
+    [GRAPH_COMPUTE_READ] = {
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_IMAGE_USAGE_SAMPLED_BIT, false
+    },
+    [GRAPH_COMPUTE_WRITE] = {
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, true
+    },
+    [GRAPH_INDIRECT_READ] = {
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, 0, false
+    },
+    [GRAPH_VERTEX_READ] = {
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, 0, false
+    },
+    [GRAPH_SAMPLED_READ] = {
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_IMAGE_USAGE_SAMPLED_BIT, false
+    },
+    [GRAPH_COLOR_WRITE] = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true
+    },
+    [GRAPH_DEPTH_WRITE] = {
+        DEPTH_STAGES,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true
+    },
+    [GRAPH_COLOR_RESOLVE] = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true
+    },
+    /* the layout stays, a pass testing against depth it just wrote would
+     * otherwise need a transition in between */
+    [GRAPH_DEPTH_READ] = {
+        DEPTH_STAGES, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, false
+    },
+};
+
+static bool attachment_access(enum graph_access access) {
+    return access >= GRAPH_COLOR_WRITE;
+}
+
+/* What a resource's memory went through since it was last written. A
+ * layout transition counts as a write by the stages it was made for. */
+struct track {
+    VkPipelineStageFlags write_stages;
+    VkAccessFlags write_access;
+    VkPipelineStageFlags read_stages; /* since the write */
+    VkPipelineStageFlags visible_stages; /* the write was made visible to */
+    VkAccessFlags visible_access;
+    enum graph_queue queue;
+    uint32_t pass; /* of the last use, NONE for one in an earlier frame */
+};
+
+struct hazard {
+    VkPipelineStageFlags src_stages, dst_stages;
+    VkAccessFlags src_access, dst_access;
+    uint32_t src_pass;
+};
+
+void graph_init(struct graph *g, VkDevice device, struct mem_allocator *ma,
+                VkExtent2D extent, void *arg) {
+    memset(g, 0, sizeof(*g));
+    g->device = device;
+    g->mem = ma;
+    g->extent = extent;
+    g->arg = arg;
+}
+
+void graph_destroy(struct graph *g, struct defer_queue *dq) {
+    for (uint32_t i = 0; i < g->renderpassc; i++) {
+        struct graph_renderpass *rp = &g->renderpasses[i];
+        for (uint32_t f = 0; f < rp->framebufc; f++) {
+            defer_framebuffer(dq, rp->framebufs[f]);
+        }
+        defer_render_pass(dq, rp->renderpass);
+    }
+    /* the memory of an alias group goes with the image owning it */
+    for (uint32_t i = 0; i < g->resourcec; i++) {
+        struct graph_resource *r = &g->resources[i];
+        if (!r->transient || r->images[0] == VK_NULL_HANDLE)
+            continue;
+        struct mem_alloc none = {0};
+        defer_image_view(dq, r->views[0]);
+        defer_image(dq, r->images[0], r->alias == i ? &r->mem : &none);
+    }
+    g->resourcec = g->passc = g->renderpassc = 0;
+}
+
+static uint32_t graph_resource(struct graph *g, const char *name) {
+    if (g->resourcec == GRAPH_MAX_RESOURCES)
+        die("render graph out of resources at %s", name);
+    struct graph_resource *r = &g->resources[g->resourcec];
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    r->samples = VK_SAMPLE_COUNT_1_BIT;
+    r->first = r->last = NONE;
+    r->alias = g->resourcec;
+    return g->resourcec++;
+}
+
+uint32_t graph_import_buffer(struct graph *g, const char *name,
+                             struct graph_state initial) {
+    uint32_t i = graph_resource(g, name);
+    g->resources[i].initial = initial;
+    return i;
+}
+
+uint32_t graph_import_image(struct graph *g, const char *name,
+                            VkFormat format, VkImageAspectFlags aspect,
+                            uint32_t imagec, const VkImage *images,
+                            const VkImageView *views,
+                            struct graph_state initial,
+                            VkImageLayout final_layout) {
+    if (imagec == 0 || imagec > GRAPH_MAX_IMAGES)
+        die("render graph cannot import %u images as %s", imagec, name);
+    uint32_t i = graph_resource(g, name);
+    struct graph_resource *r = &g->resources[i];
+    r->image = true;
+    r->format = format;
+    r->aspect = aspect;
+    r->initial = initial;
+    r->final_layout = final_layout;
+    r->imagec = imagec;
+    memcpy(r->images, images, imagec*sizeof(*images));
+    memcpy(r->views, views, imagec*sizeof(*views));
+    return i;
+}
+
+uint32_t graph_transient_image(struct graph *g, const char *name,
+                               VkFormat format, VkImageAspectFlags aspect,
+                               VkSampleCountFlagBits samples) {
+    uint32_t i = graph_resource(g, name);
+    struct graph_resource *r = &g->resources[i];
+    r->image = true;
+    r->transient = true;
+    r->format = format;
+    r->aspect = aspect;
+    r->samples = samples;
+    r->imagec = 1;
+    return i;
+}
+
+void graph_clear(struct graph *g, uint32_t resource, VkClearValue value) {
+    g->resources[resource].clear = true;
+    g->resources[resource].clear_value = value;
+}
+
+VkImage graph_image(struct graph *g, uint32_t resource, uint32_t image) {
+    struct graph_resource *r = &g->resources[resource];
+    return r->images[image % r->imagec];
+}
+
+uint32_t graph_pass(struct graph *g, const char *name,
+                    enum graph_queue queue, bool render,
+                    graph_record_fn record) {
+    if (g->passc == GRAPH_MAX_PASSES)
+        die("render graph out of passes at %s", name);
+    struct graph_pass *p = &g->passes[g->passc];
+    memset(p, 0, sizeof(*p));
+    p->name = name;
+    p->queue = queue;
+    p->render = render;
+    p->record = record;
+    p->renderpass = NONE;
+    return g->passc++;
+}
+
+void graph_use(struct graph *g, uint32_t pass, uint32_t resource,
+               enum graph_access access) {
+    struct graph_pass *p = &g->passes[pass];
+    struct graph_resource *r = &g->resources[resource];
+    if (p->usec == GRAPH_MAX_USES)
+        die("render graph pass %s uses too many resources", p->name);
+    if (attachment_access(access) && (!p->render || !r->image))
+        die("render graph pass %s cannot attach %s", p->name, r->name);
+    if (r->image ? ACCESS[access].usage == 0 : access == GRAPH_SAMPLED_READ)
+        die("render graph pass %s cannot use %s that way", p->name,
+            r->name);
+    for (uint32_t u = 0; u < p->usec; u++) {
+        if (p->uses[u].resource == resource)
+            die("render graph pass %s uses %s twice", p->name, r->name);
+    }
+    p->uses[p->usec++] = (struct graph_use){resource, access};
+    if (r->first == NONE)
+        r->first = pass;
+    r->last = pass;
+}
+
+void graph_secondaries(struct graph *g, uint32_t pass) {
+    g->passes[pass].secondaries = true;
+}
+
+void graph_bracketed(struct graph *g, uint32_t pass) {
+    g->passes[pass].bracketed = true;
+}
+
+/* Consecutive render passes on a queue share a VkRenderPass unless the
+ * later one samples an image, whose layout may need a barrier first. */
+static void graph_group(struct graph *g) {
+    for (uint32_t i = 0; i < g->passc; i++) {
+        struct graph_pass *p = &g->passes[i];
+        if (!p->render)
+            continue;
+        bool samples = false;
+        for (uint32_t u = 0; u < p->usec; u++) {
+            samples = samples ||
+                (g->resources[p->uses[u].resource].image &&
+                 !attachment_access(p->uses[u].access));
+        }
+        struct graph_pass *prev = i > 0 ? &g->passes[i-1] : NULL;
+        if (prev && prev->render && prev->queue == p->queue && !samples) {
+            struct graph_renderpass *rp = &g->renderpasses[prev->renderpass];
+            p->renderpass = prev->renderpass;
+            p->subpass = rp->passc++;
+            rp->bracketed = rp->bracketed || p->bracketed;
+            continue;
+        }
+        struct graph_renderpass *rp = &g->renderpasses[g->renderpassc];
+        memset(rp, 0, sizeof(*rp));
+        rp->area = g->extent;
+        rp->bracketed = p->bracketed;
+        rp->first = i;
+        rp->passc = 1;
+        p->renderpass = g->renderpassc++;
+        p->subpass = 0;
+    }
+}
+
+/* uses of a render pass count as spanning all of it, so aliases never
+ * meet within one */
+static void graph_span(struct graph *g, uint32_t pass,
+                       uint32_t *first, uint32_t *last) {
+    struct graph_pass *p = &g->passes[pass];
+    if (!p->render) {
+        *first = *last = pass;
+        return;
+    }
+    struct graph_renderpass *rp = &g->renderpasses[p->renderpass];
+    *first = rp->first;
+    *last = rp->first + rp->passc - 1;
+}
+
+static uint32_t lazy_type(struct mem_allocator *ma, uint32_t type_bits) {
+    VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                                  VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+    for (uint32_t i = 0; i < ma->props.memoryTypeCount; i++) {
+        if ((type_bits & (1u << i)) &&
+            (ma->props.memoryTypes[i].propertyFlags & props) == props)
+            return i;
+    }
+    return NONE;
+}
+
+/* Create the transient images and give those whose spans never overlap
+ * one allocation, first fit in declaration order. */
+static void graph_transients(struct graph *g) {
+    VkMemoryRequirements reqs[GRAPH_MAX_RESOURCES];
+    for (uint32_t i = 0; i < g->resourcec; i++) {
+        struct graph_resource *r = &g->resources[i];
+        if (!r->transient)
+            continue;
+        if (r->first == NONE)
+            die("render graph transient %s is never used", r->name);
+
+        /* only attachments within one render pass can stay in tile memory,
+         * anything else is loaded or stored */
+        bool attachment = true;
+        uint32_t renderpass = g->passes[r->first].renderpass;
+        r->usage = 0;
+        for (uint32_t p = r->first; p <= r->last; p++) {
+            struct graph_pass *pass = &g->passes[p];
+            for (uint32_t u = 0; u < pass->usec; u++) {
+                if (pass->uses[u].resource != i)
+                    continue;
+                enum graph_access access = pass->uses[u].access;
+                r->usage |= ACCESS[access].usage;
+                attachment = attachment && attachment_access(access) &&
+                             pass->renderpass == renderpass;
+            }
+        }
+        if (attachment)
+            r->usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+
+        VkImageCreateInfo create_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = r->format,
+            .extent = { g->extent.width, g->extent.height, 1 },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = r->samples,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = r->usage,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+        };
+        if (vkCreateImage(g->device, &create_info, vk_allocator, &r->images[0])
+                != VK_SUCCESS)
+            die("failed to create render graph image %s", r->name);
+        vkGetImageMemoryRequirements(g->device, r->images[0], &reqs[i]);
+
+        uint32_t first, last, dummy;
+        graph_span(g, r->first, &first, &dummy);
+        graph_span(g, r->last, &dummy, &last);
+        bool lazy = attachment &&
+                    lazy_type(g->mem, reqs[i].memoryTypeBits) != NONE;
+        for (uint32_t a = 0; a < i; a++) {
+            struct graph_resource *root = &g->resources[a];
+            if (!root->transient || root->alias != a)
+                continue;
+            bool root_lazy =
+                (root->usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) &&
+                lazy_type(g->mem, reqs[a].memoryTypeBits) != NONE;
+            bool fits = root_lazy == lazy &&
+                        (reqs[a].memoryTypeBits & reqs[i].memoryTypeBits);
+            for (uint32_t m = a; fits && m < i; m++) {
+                struct graph_resource *member = &g->resources[m];
+                if (!member->transient || member->alias != a)
+                    continue;
+                uint32_t mfirst, mlast;
+                graph_span(g, member->first, &mfirst, &dummy);
+                graph_span(g, member->last, &dummy, &mlast);
+                fits = last < mfirst || mlast < first;
+            }
+            if (!fits)
+                continue;
+            r->alias = a;
+            reqs[a].memoryTypeBits &= reqs[i].memoryTypeBits;
+            if (reqs[i].size > reqs[a].size)
+                reqs[a].size = reqs[i].size;
+            if (reqs[i].alignment > reqs[a].alignment)
+                reqs[a].alignment = reqs[i].alignment;
+            g->aliased++;
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < g->resourcec; i++) {
+        struct graph_resource *r = &g->resources[i];
+        if (!r->transient)
+            continue;
+        struct graph_resource *root = &g->resources[r->alias];
+        if (r->alias == i) {
+            bool lazy =
+                (r->usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) &&
+                lazy_type(g->mem, reqs[i].memoryTypeBits) != NONE;
+            VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            if (lazy) {
+                props |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+                g->lazy++;
+            }
+            mem_alloc(g->mem, reqs[i], props, false, &r->mem);
+        }
+        vkBindImageMemory(g->device, r->images[0], root->mem.memory,
+                          root->mem.offset);
+
+        VkImageViewCreateInfo view_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = r->images[0],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = r->format,
+            .subresourceRange = { r->aspect, 0, 1, 0, 1 },
+        };
+        if (vkCreateImageView(g->device, &view_info, vk_allocator,
+                              &r->views[0]) != VK_SUCCESS)
+            die("failed to create render graph image view %s", r->name);
+    }
+}
+
+/* the dependency a use needs on what came before it, on the same queue */
+static bool graph_hazard(struct track *t, enum graph_access access,
+                         bool transition, enum graph_queue queue,
+                         uint32_t pass, struct hazard *h) {
+    const struct access_info *info = &ACCESS[access];
+    bool same_queue = t->queue == queue;
+    bool needed = false;
+    h->src_pass = t->pass;
+    h->dst_stages = info->stages;
+    h->dst_access = info->access;
+
+    if (info->write || transition) {
+        h->src_stages = t->write_stages | t->read_stages;
+        h->src_access = t->write_access;
+        needed = h->src_stages != 0 || transition;
+        t->write_stages = info->stages;
+        t->write_access = info->write ? info->access & WRITE_ACCESS : 0;
+        t->read_stages = 0;
+        t->visible_stages = info->write ? 0 : info->stages;
+        t->visible_access = info->write ? 0 : info->access;
+    } else {
+        h->src_stages = t->write_stages;
+        h->src_access = t->write_access;
+        needed = t->write_stages != 0 &&
+                 ((info->stages & ~t->visible_stages) ||
+                  (info->access & ~t->visible_access));
+        t->read_stages |= info->stages;
+        t->visible_stages |= info->stages;
+        t->visible_access |= info->access;
+    }
+    /* the semaphore between the queues covers it */
+    if (!same_queue) {
+        needed = transition;
+        if (!info->write) {
+            t->write_stages = 0;
+            t->write_access = 0;
+        }
+    }
+    t->queue = queue;
+    t->pass = pass;
+    return needed;
+}
+
+static void barrier_add(struct graph_barrier *b, const struct hazard *h) {
+    b->src_stages |= h->src_stages;
+    b->dst_stages |= h->dst_stages;
+    b->src_access |= h->src_access;
+    b->dst_access |= h->dst_access;
+}
+
+static void barrier_image(struct graph_barrier *b, uint32_t resource,
+                          VkImageLayout old_layout, VkImageLayout new_layout) {
+    b->images[b->imagec] = resource;
+    b->old_layouts[b->imagec] = old_layout;
+    b->new_layouts[b->imagec++] = new_layout;
+}
+
+/* merge into an existing dependency between the same subpasses */
+static void dependency_add(VkSubpassDependency *deps, uint32_t *depc,
+                           uint32_t src, uint32_t dst,
+                           const struct hazard *h) {
+    VkPipelineStageFlags src_stages = h->src_stages
+        ? h->src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkDependencyFlags flags = src != VK_SUBPASS_EXTERNAL
+        ? VK_DEPENDENCY_BY_REGION_BIT : 0;
+    for (uint32_t i = 0; i < *depc; i++) {
+        if (deps[i].srcSubpass == src && deps[i].dstSubpass == dst) {
+            deps[i].srcStageMask |= src_stages;
+            deps[i].dstStageMask |= h->dst_stages;
+            deps[i].srcAccessMask |= h->src_access;
+            deps[i].dstAccessMask |= h->dst_access;
+            return;
+        }
+    }
+    deps[(*depc)++] = (VkSubpassDependency){
+        .srcSubpass = src,
+        .dstSubpass = dst,
+        .srcStageMask = src_stages,
+        .dstStageMask = h->dst_stages,
+        .srcAccessMask = h->src_access,
+        .dstAccessMask = h->dst_access,
+        .dependencyFlags = flags,
+    };
+}
+
+static uint32_t attachment_index(struct graph_renderpass *rp,
+                                 uint32_t resource) {
+    for (uint32_t a = 0; a < rp->attachmentc; a++) {
+        if (rp->attachments[a] == resource)
+            return a;
+    }
+    rp->attachments[rp->attachmentc] = resource;
+    return rp->attachmentc++;
+}
+
+/* Create a render pass from the uses of its subpasses, the tracks as they
+ * were on entry giving the initial layouts. */
+static void graph_renderpass_create(struct graph *g, uint32_t index,
+                                    const VkImageLayout *layouts,
+                                    VkSubpassDependency *deps,
+                                    uint32_t depc) {
+    struct graph_renderpass *rp = &g->renderpasses[index];
+    uint32_t last = rp->first + rp->passc - 1;
+    VkAttachmentDescription descs[GRAPH_MAX_RESOURCES];
+    VkAttachmentReference refs[GRAPH_MAX_PASSES][GRAPH_MAX_USES];
+    VkAttachmentReference resolves[GRAPH_MAX_PASSES][GRAPH_MAX_USES];
+    uint32_t preserve[GRAPH_MAX_PASSES][GRAPH_MAX_RESOURCES];
+    VkSubpassDescription subpasses[GRAPH_MAX_PASSES];
+
+    for (uint32_t s = 0; s < rp->passc; s++) {
+        struct graph_pass *p = &g->passes[rp->first + s];
+        uint32_t colorc = 0;
+        VkAttachmentReference *depth = NULL;
+        for (uint32_t u = 0; u < p->usec; u++) {
+            colorc += p->uses[u].access == GRAPH_COLOR_WRITE;
+        }
+        uint32_t c = 0, resolvec = 0;
+        for (uint32_t u = 0; u < p->usec; u++) {
+            enum graph_access access = p->uses[u].access;
+            if (!attachment_access(access))
+                continue;
+            uint32_t a = attachment_index(rp, p->uses[u].resource);
+            VkAttachmentReference ref = {a, ACCESS[access].layout};
+            struct graph_resource *r = &g->resources[p->uses[u].resource];
+            if (access == GRAPH_COLOR_WRITE) {
+                refs[s][c++] = ref;
+            } else if (access == GRAPH_COLOR_RESOLVE) {
+                if (r->samples != VK_SAMPLE_COUNT_1_BIT)
+                    die("render graph pass %s resolves into multisampled %s",
+                        p->name, r->name);
+                resolves[s][resolvec++] = ref;
+            } else {
+                if (depth)
+                    die("render graph pass %s has two depth attachments",
+                        p->name);
+                depth = &refs[s][colorc];
+                *depth = ref;
+            }
+        }
+        /* every color attachment is resolved or none is */
+        if (resolvec != 0 && resolvec != colorc)
+            die("render graph pass %s resolves %u of %u color attachments",
+                p->name, resolvec, colorc);
+        subpasses[s] = (VkSubpassDescription){
+            .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+            .colorAttachmentCount = colorc,
+            .pColorAttachments = refs[s],
+            .pResolveAttachments = resolvec ? resolves[s] : NULL,
+            .pDepthStencilAttachment = depth,
+            .pPreserveAttachments = preserve[s],
+        };
+    }
+
+    for (uint32_t a = 0; a < rp->attachmentc; a++) {
+        uint32_t i = rp->attachments[a];
+        struct graph_resource *r = &g->resources[i];
+        /* subpasses in and out of which it is used */
+        uint32_t first = NONE, end = 0;
+        VkImageLayout final = VK_IMAGE_LAYOUT_UNDEFINED;
+        for (uint32_t s = 0; s < rp->passc; s++) {
+            struct graph_pass *p = &g->passes[rp->first + s];
+            for (uint32_t u = 0; u < p->usec; u++) {
+                if (p->uses[u].resource != i)
+                    continue;
+                if (first == NONE)
+                    first = s;
+                end = s;
+                final = ACCESS[p->uses[u].access].layout;
+            }
+        }
+        for (uint32_t s = first + 1; s < end; s++) {
+            bool used = false;
+            struct graph_pass *p = &g->passes[rp->first + s];
+            for (uint32_t u = 0; u < p->usec; u++) {
+                used = used || p->uses[u].resource == i;
+            }
+            if (!used)
+                preserve[s][subpasses[s].preserveAttachmentCount++] = a;
+        }
+
+        /* contents come in if written earlier in the frame or imported
+         * with any, and go out if used later or imported */
+        bool clear = r->clear && r->first >= rp->first;
+        bool load = r->first < rp->first ||
+                    (!r->transient &&
+                     r->initial.layout != VK_IMAGE_LAYOUT_UNDEFINED);
+        bool store = r->last > last || !r->transient;
+        if (!r->transient && r->last <= last &&
+            r->final_layout != VK_IMAGE_LAYOUT_UNDEFINED)
+            final = r->final_layout;
+
+        VkAttachmentLoadOp load_op = clear ? VK_ATTACHMENT_LOAD_OP_CLEAR
+            : load ? VK_ATTACHMENT_LOAD_OP_LOAD
+            : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        descs[a] = (VkAttachmentDescription){
+            .format = r->format,
+            .samples = r->samples,
+            .loadOp = load_op,
+            .storeOp = store ? VK_ATTACHMENT_STORE_OP_STORE
+                             : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .initialLayout = load_op == VK_ATTACHMENT_LOAD_OP_LOAD
+                ? layouts[i] : VK_IMAGE_LAYOUT_UNDEFINED,
+            .finalLayout = final,
+        };
+        rp->clears[a] = r->clear_value;
+        rp->load_ops[a] = descs[a].loadOp;
+        rp->store_ops[a] = descs[a].storeOp;
+    }
+
+    VkRenderPassCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = rp->attachmentc,
+        .pAttachments = descs,
+        .subpassCount = rp->passc,
+        .pSubpasses = subpasses,
+        .dependencyCount = depc,
+        .pDependencies = deps
+    };
+    if (vkCreateRenderPass(g->device, &create_info, vk_allocator,
+                           &rp->renderpass) != VK_SUCCESS)
+        die("failed to create render pass for %s",
+            g->passes[rp->first].name);
+
+    rp->framebufc = 1;
+    for (uint32_t a = 0; a < rp->attachmentc; a++) {
+        uint32_t imagec = g->resources[rp->attachments[a]].imagec;
+        if (imagec > rp->framebufc)
+            rp->framebufc = imagec;
+    }
+    for (uint32_t f = 0; f < rp->framebufc; f++) {
+        VkImageView views[GRAPH_MAX_RESOURCES];
+        for (uint32_t a = 0; a < rp->attachmentc; a++) {
+            struct graph_resource *r = &g->resources[rp->attachments[a]];
+            views[a] = r->views[f % r->imagec];
+        }
+        VkFramebufferCreateInfo fb_info = {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = rp->renderpass,
+            .attachmentCount = rp->attachmentc,
+            .pAttachments = views,
+            .width = g->extent.width,
+            .height = g->extent.height,
+            .layers = 1
+        };
+        if (vkCreateFramebuffer(g->device, &fb_info, vk_allocator,
+                                &rp->framebufs[f]) != VK_SUCCESS)
+            die("failed to create framebuffer %u for %s", f,
+                g->passes[rp->first].name);
+    }
+}
+
+/* Walk the passes in order and derive what each use must wait for. The
+ * first walk only finds the state transients leave a frame in, which the
+ * second starts from to emit the barriers, the render passes and the
+ * final transitions of imported images. */
+static void graph_sweep(struct graph *g, struct track *tracks, bool emit) {
+    VkImageLayout layouts[GRAPH_MAX_RESOURCES];
+    for (uint32_t i = 0; i < g->resourcec; i++) {
+        struct graph_resource *r = &g->resources[i];
+        layouts[i] = r->transient ? VK_IMAGE_LAYOUT_UNDEFINED
+                                  : r->initial.layout;
+        if (r->first == NONE)
+            continue;
+        if (r->transient) {
+            if (emit && r->alias == i)
+                tracks[i].pass = NONE;
+            continue;
+        }
+        tracks[i] = (struct track){
+            .write_stages = r->initial.stages,
+            .write_access = r->initial.access,
+            .queue = g->passes[r->first].queue,
+            .pass = NONE,
+        };
+    }
+
+    VkImageLayout rp_layouts[GRAPH_MAX_RESOURCES];
+    VkSubpassDependency deps[GRAPH_MAX_PASSES*GRAPH_MAX_USES];
+    uint32_t depc = 0;
+    for (uint32_t p = 0; p < g->passc; p++) {
+        struct graph_pass *pass = &g->passes[p];
+        struct graph_renderpass *rp = pass->render
+            ? &g->renderpasses[pass->renderpass] : NULL;
+        if (rp && pass->subpass == 0) {
+            memcpy(rp_layouts, layouts, sizeof(layouts));
+            depc = 0;
+        }
+        memset(&pass->barrier, 0, sizeof(pass->barrier));
+
+        for (uint32_t u = 0; u < pass->usec; u++) {
+            uint32_t i = pass->uses[u].resource;
+            enum graph_access access = pass->uses[u].access;
+            struct graph_resource *r = &g->resources[i];
+            struct track *t = &tracks[r->transient ? r->alias : i];
+            VkImageLayout layout = ACCESS[access].layout;
+            /* a transient's contents start over with its first use */
+            if (r->transient && p == r->first) {
+                if (!ACCESS[access].write)
+                    die("render graph transient %s is read before written",
+                        r->name);
+                layouts[i] = VK_IMAGE_LAYOUT_UNDEFINED;
+            }
+            bool transition = r->image && layouts[i] != layout;
+            struct hazard h;
+            bool needed = graph_hazard(t, access, transition, pass->queue,
+                                       p, &h);
+            if (!emit || !needed) {
+                if (r->image)
+                    layouts[i] = layout;
+                continue;
+            }
+
+            if (rp && (attachment_access(access) || !r->image)) {
+                /* the render pass transitions the attachment and its
+                 * dependencies order the memory */
+                bool inside = h.src_pass != NONE && h.src_pass >= rp->first &&
+                              h.src_pass < p;
+                uint32_t src = inside ? g->passes[h.src_pass].subpass
+                                      : VK_SUBPASS_EXTERNAL;
+                if (h.src_stages != 0 || inside)
+                    dependency_add(deps, &depc, src, pass->subpass, &h);
+            } else {
+                barrier_add(&pass->barrier, &h);
+                if (transition)
+                    barrier_image(&pass->barrier, i, layouts[i], layout);
+            }
+            if (r->image)
+                layouts[i] = layout;
+        }
+
+        if (emit && rp && pass->subpass + 1 == rp->passc) {
+            graph_renderpass_create(g, pass->renderpass, rp_layouts,
+                                    deps, depc);
+            /* imported images may leave the pass in their final layout */
+            for (uint32_t a = 0; a < rp->attachmentc; a++) {
+                uint32_t i = rp->attachments[a];
+                struct graph_resource *r = &g->resources[i];
+                if (!r->transient && r->last == p &&
+                    r->final_layout != VK_IMAGE_LAYOUT_UNDEFINED)
+                    layouts[i] = r->final_layout;
+            }
+        }
+    }
+
+    for (int q = 0; emit && q < 2; q++) {
+        memset(&g->final[q], 0, sizeof(g->final[q]));
+    }
+    for (uint32_t i = 0; emit && i < g->resourcec; i++) {
+        struct graph_resource *r = &g->resources[i];
+        if (r->transient || !r->image || r->first == NONE ||
+            r->final_layout == VK_IMAGE_LAYOUT_UNDEFINED ||
+            layouts[i] == r->final_layout)
+            continue;
+        struct graph_barrier *b = &g->final[tracks[i].queue];
+        struct hazard h = {
+            .src_stages = tracks[i].write_stages | tracks[i].read_stages,
+            .dst_stages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            .src_access = tracks[i].write_access,
+        };
+        barrier_add(b, &h);
+        barrier_image(b, i, layouts[i], r->final_layout);
+    }
+}
+
+void graph_build(struct graph *g) {
+    graph_group(g);
+    graph_transients(g);
+
+    /* transients not yet used wait on nothing in the first walk */
+    struct track tracks[GRAPH_MAX_RESOURCES];
+    memset(tracks, 0, sizeof(tracks));
+    for (uint32_t i = 0; i < g->resourcec; i++) {
+        struct graph_resource *r = &g->resources[i];
+        if (r->first != NONE)
+            tracks[i].queue = g->passes[r->first].queue;
+        tracks[i].pass = NONE;
+    }
+    graph_sweep(g, tracks, false);
+    graph_sweep(g, tracks, true);
+}
+
+VkRenderPass graph_renderpass(struct graph *g, uint32_t pass) {
+    return g->renderpasses[g->passes[pass].renderpass].renderpass;
+}
+
+VkFramebuffer graph_framebuffer(struct graph *g, uint32_t pass,
+                                uint32_t image) {
+    struct graph_renderpass *rp =
+        &g->renderpasses[g->passes[pass].renderpass];
+    return rp->framebufs[image % rp->framebufc];
+}
+
+void graph_area(struct graph *g, uint32_t pass, VkExtent2D area) {
+    g->renderpasses[g->passes[pass].renderpass].area = area;
+}
+
+static void graph_barrier_record(struct graph *g, VkCommandBuffer cb,
+                                 const struct graph_barrier *b,
+                                 uint32_t image) {
+    if (b->src_stages == 0 && b->imagec == 0)
+        return;
+    VkMemoryBarrier memory = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = b->src_access,
+        .dstAccessMask = b->dst_access,
+    };
+    VkImageMemoryBarrier images[GRAPH_MAX_USES];
+    for (uint32_t i = 0; i < b->imagec; i++) {
+        struct graph_resource *r = &g->resources[b->images[i]];
+        images[i] = (VkImageMemoryBarrier){
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .oldLayout = b->old_layouts[i],
+            .newLayout = b->new_layouts[i],
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = graph_image(g, b->images[i], image),
+            .subresourceRange = { r->aspect, 0, 1, 0, 1 },
+        };
+    }
+    bool global = b->src_access != 0 || b->dst_access != 0;
+    vkCmdPipelineBarrier(cb, b->src_stages ? b->src_stages
+                                           : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         b->dst_stages, 0, global ? 1 : 0, &memory,
+                         0, NULL, b->imagec, images);
+}
+
+void graph_record(struct graph *g, VkCommandBuffer cb,
+                  enum graph_queue queue, uint32_t image,
+                  VkSubpassContents contents) {
+    for (uint32_t p = 0; p < g->passc; p++) {
+        struct graph_pass *pass = &g->passes[p];
+        if (pass->queue != queue)
+            continue;
+        if (!pass->render) {
+            graph_barrier_record(g, cb, &pass->barrier, image);
+            pass->record(g->arg, cb, 0);
+            continue;
+        }
+
+        struct graph_renderpass *rp = &g->renderpasses[pass->renderpass];
+        VkSubpassContents pass_contents = pass->secondaries
+            ? contents : VK_SUBPASS_CONTENTS_INLINE;
+        if (pass->subpass == 0) {
+            graph_barrier_record(g, cb, &pass->barrier, image);
+            if (g->bracket && rp->bracketed)
+                g->bracket(g->arg, cb, true);
+            VkRenderPassBeginInfo begin_info = {
+                .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+                .pNext = g->begin ? g->begin(g->arg, rp->area) : NULL,
+                .renderPass = rp->renderpass,
+                .framebuffer = rp->framebufs[image % rp->framebufc],
+                .renderArea = { .offset = {0, 0}, .extent = rp->area },
+                .clearValueCount = rp->attachmentc,
+                .pClearValues = rp->clears,
+            };
+            vkCmdBeginRenderPass(cb, &begin_info, pass_contents);
+        } else {
+            vkCmdNextSubpass(cb, pass_contents);
+        }
+        pass->record(g->arg, cb, pass->subpass);
+        if (pass->subpass + 1 == rp->passc) {
+            vkCmdEndRenderPass(cb);
+            if (g->bracket && rp->bracketed)
+                g->bracket(g->arg, cb, false);
+        }
+    }
+    graph_barrier_record(g, cb, &g->final[queue], image);
+}
+
+static const char *LOAD_OPS[] = {"load", "clear", "discard"};
+static const char *STORE_OPS[] = {"store", "discard"};
+
+void graph_print(struct graph *g) {
+    printf("render graph: %u pass(es), %u render pass(es)",
+           g->passc, g->renderpassc);
+    if (g->aliased > 0)
+        printf(", %u aliased image(s)", g->aliased);
+    if (g->lazy > 0)
+        printf(", %u lazily allocated", g->lazy);
+    printf("\n");
+    for (uint32_t p = 0; p < g->passc; p++) {
+        struct graph_pass *pass = &g->passes[p];
+        printf("  %s on %s", pass->name,
+               pass->queue == GRAPH_QUEUE_COMPUTE ? "compute" : "graphics");
+        if (pass->render)
+            printf(", subpass %u of render pass %u", pass->subpass,
+                   pass->renderpass);
+        if (pass->barrier.src_stages || pass->barrier.imagec)
+            printf(", barrier %x -> %x", pass->barrier.src_stages,
+                   pass->barrier.dst_stages);
+        printf("\n");
+    }
+    for (uint32_t i = 0; i < g->renderpassc; i++) {
+        struct graph_renderpass *rp = &g->renderpasses[i];
+        printf("  render pass %u:", i);
+        for (uint32_t a = 0; a < rp->attachmentc; a++) {
+            struct graph_resource *r = &g->resources[rp->attachments[a]];
+            printf(" %s", r->name);
+            if (r->samples != VK_SAMPLE_COUNT_1_BIT)
+                printf(" x%u", r->samples);
+            printf(" %s/%s", LOAD_OPS[rp->load_ops[a]],
+                   STORE_OPS[rp->store_ops[a]]);
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,223 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+#include "defer.h"
+#include "mem.h"
+
+/* A frame as a list of passes declaring how they use its images and
+ * buffers, from which the barriers between them are derived. Resources are
+ * either imported, owned by the caller with a known state on entry, or
+ * transient images the graph creates itself, whose contents never outlive
+ * the frame. Passes are run in declaration order.
+ *
+ * Consecutive render passes on one queue become subpasses of one
+ * VkRenderPass, attachment hazards turn into subpass dependencies and
+ * layout transitions into attachment layouts. Attachments no later pass
+ * reads are not stored, and not loaded unless written earlier in the
+ * frame; a transient image only ever used as an attachment is created
+ * TRANSIENT_ATTACHMENT in lazily allocated memory where the device has
+ * any, so on a tiler it need not exist outside tile memory at all.
+ * Transient images whose uses do not overlap share memory. A multisampled
+ * attachment is resolved by a GRAPH_COLOR_RESOLVE use in the same subpass,
+ * so the samples themselves can stay transient as well.
+ *
+ * Transient images are shared by all frames in flight, the first use in a
+ * frame waits for the last use of its memory in the previous one. Hazards
+ * between queues are left to the semaphores ordering them, images must
+ * stay on one queue. */
+
+#define GRAPH_MAX_RESOURCES 16
+#define GRAPH_MAX_PASSES 16
+#define GRAPH_MAX_USES 8
+#define GRAPH_MAX_IMAGES 8 /* views of an imported image */
+
+enum graph_queue {
+    GRAPH_QUEUE_GRAPHICS,
+    GRAPH_QUEUE_COMPUTE,
+};
+
+/* every use implies the stages, accesses and layout in graph.c */
+enum graph_access {
+    GRAPH_TRANSFER_WRITE,
+    GRAPH_TRANSFER_READ,
+    GRAPH_COMPUTE_READ,
+    GRAPH_COMPUTE_WRITE, /* read and written */
+    GRAPH_INDIRECT_READ,
+    GRAPH_VERTEX_READ,
+    GRAPH_SAMPLED_READ, /* in fragment shaders */
+    GRAPH_COLOR_WRITE, /* attachments from here on */
+    GRAPH_COLOR_RESOLVE, /* of the pass's color attachment in that order */
+    GRAPH_DEPTH_WRITE, /* tested and written */
+    GRAPH_DEPTH_READ, /* tested only */
+    GRAPH_ACCESS_COUNT
+};
+
+struct graph_state {
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    VkImageLayout layout;
+};
+
+struct graph_resource {
+    const char *name;
+    bool image;
+    bool transient;
+    VkFormat format;
+    VkImageAspectFlags aspect;
+    VkSampleCountFlagBits samples; /* 1 for imported images */
+    bool clear; /* the first write in a frame clears to clear_value */
+    VkClearValue clear_value;
+    struct graph_state initial; /* imported, on entry to the frame */
+    VkImageLayout final_layout; /* imported images, on exit */
+
+    /* imported images may have one per frame slot or swapchain image,
+     * picked by the image index of graph_record() */
+    uint32_t imagec;
+    VkImage images[GRAPH_MAX_IMAGES];
+    VkImageView views[GRAPH_MAX_IMAGES];
+
+    uint32_t first, last; /* passes between which it is used */
+
+    /* transient, found by graph_build() */
+    VkImageUsageFlags usage;
+    uint32_t alias; /* resource whose memory it is bound to */
+    struct mem_alloc mem; /* owned by the alias */
+};
+
+struct graph_use {
+    uint32_t resource;
+    enum graph_access access;
+};
+
+struct graph_barrier {
+    VkPipelineStageFlags src_stages, dst_stages;
+    VkAccessFlags src_access, dst_access; /* as a global memory barrier */
+    uint32_t imagec;
+    uint32_t images[GRAPH_MAX_USES]; /* layout transitions */
+    VkImageLayout old_layouts[GRAPH_MAX_USES], new_layouts[GRAPH_MAX_USES];
+};
+
+/* subpass is the render pass's subpass the pass draws, 0 otherwise */
+typedef void (*graph_record_fn)(void *arg, VkCommandBuffer cb,
+                                uint32_t subpass);
+/* called outside the render passes holding a bracketed pass, before
+ * beginning and after ending them, for queries that must not straddle the
+ * subpasses */
+typedef void (*graph_bracket_fn)(void *arg, VkCommandBuffer cb,
+                                 bool begin);
+/* what to chain to the VkRenderPassBeginInfo of a render pass drawing
+ * area, valid until the next call */
+typedef const void *(*graph_begin_fn)(void *arg, VkExtent2D area);
+
+struct graph_pass {
+    const char *name;
+    enum graph_queue queue;
+    bool render;
+    bool secondaries; /* may record from secondary command buffers */
+    bool bracketed; /* its render pass is within bracket calls */
+    graph_record_fn record;
+    uint32_t usec;
+    struct graph_use uses[GRAPH_MAX_USES];
+
+    /* found by graph_build() */
+    struct graph_barrier barrier; /* recorded before the pass */
+    uint32_t renderpass; /* index into renderpasses, render passes only */
+    uint32_t subpass;
+};
+
+struct graph_renderpass {
+    VkRenderPass renderpass;
+    /* drawn from the top left corner of the attachments, the extent
+     * unless set otherwise */
+    VkExtent2D area;
+    bool bracketed; /* any of its passes is */
+    uint32_t passc; /* subpasses, from the first pass on */
+    uint32_t first;
+    uint32_t attachmentc;
+    uint32_t attachments[GRAPH_MAX_RESOURCES]; /* resources */
+    VkClearValue clears[GRAPH_MAX_RESOURCES];
+    VkAttachmentLoadOp load_ops[GRAPH_MAX_RESOURCES];
+    VkAttachmentStoreOp store_ops[GRAPH_MAX_RESOURCES];
+    uint32_t framebufc;
+    VkFramebuffer framebufs[GRAPH_MAX_IMAGES];
+};
+
+struct graph {
+    VkDevice device;
+    struct mem_allocator *mem;
+    VkExtent2D extent;
+    void *arg; /* given to the callbacks */
+    graph_bracket_fn bracket; /* or NULL */
+    graph_begin_fn begin; /* or NULL */
+
+    uint32_t resourcec;
+    struct graph_resource resources[GRAPH_MAX_RESOURCES];
+    uint32_t passc;
+    struct graph_pass passes[GRAPH_MAX_PASSES];
+    uint32_t renderpassc;
+    struct graph_renderpass renderpasses[GRAPH_MAX_PASSES];
+    /* imported images into their final layouts, per queue */
+    struct graph_barrier final[2];
+    uint32_t aliased; /* transient images sharing another's memory */
+    uint32_t lazy; /* transient images in lazily allocated memory */
+};
+
+void graph_init(struct graph *g, VkDevice device, struct mem_allocator *ma,
+                VkExtent2D extent, void *arg);
+/* the created objects are retired to dq rather than destroyed */
+void graph_destroy(struct graph *g, struct defer_queue *dq);
+
+/* declare resources, each returns its index for graph_use() */
+uint32_t graph_import_buffer(struct graph *g, const char *name,
+                             struct graph_state initial);
+uint32_t graph_import_image(struct graph *g, const char *name,
+                            VkFormat format, VkImageAspectFlags aspect,
+                            uint32_t imagec, const VkImage *images,
+                            const VkImageView *views,
+                            struct graph_state initial,
+                            VkImageLayout final_layout);
+uint32_t graph_transient_image(struct graph *g, const char *name,
+                               VkFormat format, VkImageAspectFlags aspect,
+                               VkSampleCountFlagBits samples);
+void graph_clear(struct graph *g, uint32_t resource, VkClearValue value);
+VkImage graph_image(struct graph *g, uint32_t resource, uint32_t image);
+
+/* declare a pass, then its uses in the order they happen */
+uint32_t graph_pass(struct graph *g, const char *name,
+                    enum graph_queue queue, bool render,
+                    graph_record_fn record);
+void graph_use(struct graph *g, uint32_t pass, uint32_t resource,
+               enum graph_access access);
+/* the render pass may record from secondaries, begun with the contents
+ * given to graph_record(), others always record inline */
+void graph_secondaries(struct graph *g, uint32_t pass);
+/* the render pass holding pass is bracketed, once a frame, so a pass of
+ * it must be recorded only once a frame as well */
+void graph_bracketed(struct graph *g, uint32_t pass);
+
+/* derive barriers, create the render passes, framebuffers and transient
+ * images; nothing may be declared afterwards */
+void graph_build(struct graph *g);
+
+/* the render pass and framebuffer a render pass records in */
+VkRenderPass graph_renderpass(struct graph *g, uint32_t pass);
+VkFramebuffer graph_framebuffer(struct graph *g, uint32_t pass,
+                                uint32_t image);
+/* change the area of the render pass drawing pass, between frames */
+void graph_area(struct graph *g, uint32_t pass, VkExtent2D area);
+
+/* Record the passes on queue into cb, render passes with what begin
+ * gives for their area chained to their VkRenderPassBeginInfo. image
+ * picks among the images of imported resources and so the framebuffers. */
+void graph_record(struct graph *g, VkCommandBuffer cb,
+                  enum graph_queue queue, uint32_t image,
+                  VkSubpassContents contents);
+
+void graph_print(struct graph *g);
+
+#endif
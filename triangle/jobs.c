@@ -0,0 +1,101 @@
+#include "jobs.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "util.h"
+
+/* claim and run tasks until none are left, called with the lock held */
+static void jobs_drain(struct jobs *j) {
+    while (j->next < j->count) {
+        uint32_t index = j->next++;
+        pthread_mutex_unlock(&j->lock);
+        j->fn(j->arg, index);
+        pthread_mutex_lock(&j->lock);
+    }
+}
+
+static void *jobs_worker(void *arg) {
+    struct jobs *j = arg;
+
+    /* generation 0 is the one jobs_init() starts at, a worker that only
+     * gets the lock after the first batch was posted still runs it */
+    uint64_t seen = 0;
+    pthread_mutex_lock(&j->lock);
+    for (;;) {
+        while (!j->quit && j->generation == seen)
+            pthread_cond_wait(&j->start, &j->lock);
+        if (j->quit)
+            break;
+        seen = j->generation;
+
+        jobs_drain(j);
+        if (--j->busy == 0)
+            pthread_cond_signal(&j->done);
+    }
+    pthread_mutex_unlock(&j->lock);
+
+    return NULL;
+}
+
+void jobs_init(struct jobs *j, uint32_t threadc) {
+    j->threadc = threadc;
+    j->generation = 0;
+    j->quit = false;
+    j->next = j->count = j->busy = 0;
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->start, NULL);
+    pthread_cond_init(&j->done, NULL);
+
+    j->threads = malloc(threadc*sizeof(*j->threads));
+    if (threadc > 0 && !j->threads)
+        die("out of memory");
+    for (uint32_t i = 0; i < threadc; i++) {
+        if (pthread_create(&j->threads[i], NULL, jobs_worker, j) != 0)
+            die("failed to create worker thread %u", i);
+    }
+}
+
+void jobs_destroy(struct jobs *j) {
+    pthread_mutex_lock(&j->lock);
+    j->quit = true;
+    pthread_cond_broadcast(&j->start);
+    pthread_mutex_unlock(&j->lock);
+
+    for (uint32_t i = 0; i < j->threadc; i++) {
+        pthread_join(j->threads[i], NULL);
+    }
+    free(j->threads);
+
+    pthread_cond_destroy(&j->done);
+    pthread_cond_destroy(&j->start);
+    pthread_mutex_destroy(&j->lock);
+}
+
+uint32_t jobs_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+void jobs_run(struct jobs *j, uint32_t count, jobs_fn fn, void *arg) {
+    if (j->threadc == 0 || count <= 1) {
+        for (uint32_t i = 0; i < count; i++) {
+            fn(arg, i);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&j->lock);
+    j->fn = fn;
+    j->arg = arg;
+    j->next = 0;
+    j->count = count;
+    j->busy = j->threadc;
+    j->generation++;
+    pthread_cond_broadcast(&j->start);
+
+    jobs_drain(j);
+    while (j->busy > 0)
+        pthread_cond_wait(&j->done, &j->lock);
+    pthread_mutex_unlock(&j->lock);
+}
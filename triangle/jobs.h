@@ -0,0 +1,39 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+/* Fixed pool of worker threads running one batch of tasks at a time. The
+ * calling thread takes tasks as well, so a pool of n threads runs n + 1
+ * tasks in parallel and a pool of 0 threads runs everything inline. */
+
+typedef void (*jobs_fn)(void *arg, uint32_t index);
+
+struct jobs {
+    pthread_t *threads;
+    uint32_t threadc;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation; /* bumped for every batch */
+    bool quit;
+
+    jobs_fn fn;
+    void *arg;
+    uint32_t next, count; /* next task to claim, tasks in batch */
+    uint32_t busy; /* workers not yet finished with the batch */
+};
+
+void jobs_init(struct jobs *j, uint32_t threadc);
+void jobs_destroy(struct jobs *j);
+
+uint32_t jobs_cpu_count(void);
+
+/* run fn(arg, i) for every i < count and wait for all of them */
+void jobs_run(struct jobs *j, uint32_t count, jobs_fn fn, void *arg);
+
+#endif
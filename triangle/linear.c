@@ -1,6 +1,13 @@
 #include "linear.h"
 
 #include <math.h>
+#include <string.h>
+
+#if defined(LINEAR_SIMD) && defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(LINEAR_SIMD)
+#include <arm_neon.h>
+#endif
 
 void cross(vec3 product, vec3 a, vec3 b) {
     product[0] = a[1]*b[2] - a[2]*b[1];
@@ -19,7 +26,7 @@ float dot(vec3 a, vec3 b) {
 }
 
 void normalize(vec3 normal, vec3 vec) {
-    float length = sqrt(dot(vec, vec));
+    float length = sqrtf(dot(vec, vec));
     normal[0] = vec[0]/length;
     normal[1] = vec[1]/length;
     normal[2] = vec[2]/length;
@@ -40,25 +47,30 @@ void look_at(mat4 mat, vec3 eye, vec3 center, vec3 up) {
     mat[0][0] = s[0];
     mat[0][1] = u[0];
     mat[0][2] =-f[0];
+    mat[0][3] = 0;
     mat[1][0] = s[1];
     mat[1][1] = u[1];
     mat[1][2] =-f[1];
-    mat[2][1] = u[2];
+    mat[1][3] = 0;
     mat[2][0] = s[2];
+    mat[2][1] = u[2];
     mat[2][2] =-f[2];
+    mat[2][3] = 0;
     mat[3][0] =-dot(s, eye);
     mat[3][1] =-dot(u, eye);
     mat[3][2] = dot(f, eye);
+    mat[3][3] = 1;
 }
 
 void perspective(mat4 mat, float fov, float aspect,
                            float near, float far) {
-    mat[0][0] = 1 / aspect / tan(fov/2);
+    float t = tanf(fov/2);
+    mat[0][0] = 1 / aspect / t;
     mat[0][1] = 0;
     mat[0][2] = 0;
     mat[0][3] = 0;
     mat[1][0] = 0;
-    mat[1][1] = -1 / tan(fov/2);
+    mat[1][1] = -1 / t;
     mat[1][2] = 0;
     mat[1][3] = 0;
     mat[2][0] = 0;
@@ -70,3 +82,197 @@ void perspective(mat4 mat, float fov, float aspect,
     mat[3][2] = 2*(far * near) / (near - far);
     mat[3][3] = 0;
 }
+
+/* z_clip = near, w_clip = -z, so depth = near/-z without a far plane */
+void perspective_reverse_z(mat4 mat, float fov, float aspect, float near) {
+    float t = tanf(fov/2);
+    mat[0][0] = 1 / aspect / t;
+    mat[0][1] = 0;
+    mat[0][2] = 0;
+    mat[0][3] = 0;
+    mat[1][0] = 0;
+    mat[1][1] = -1 / t;
+    mat[1][2] = 0;
+    mat[1][3] = 0;
+    mat[2][0] = 0;
+    mat[2][1] = 0;
+    mat[2][2] = 0;
+    mat[2][3] = -1;
+    mat[3][0] = 0;
+    mat[3][1] = 0;
+    mat[3][2] = near;
+    mat[3][3] = 0;
+}
+
+void mat4_identity(mat4 mat) {
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            mat[c][r] = c == r;
+        }
+    }
+}
+
+/* Column c of a*b is a's columns weighted by b[c]. All of a is loaded
+ * before anything is stored and b[c] is read before column c is written,
+ * so the product may alias either operand. */
+#if defined(LINEAR_SIMD) && defined(__SSE__)
+static inline void mat4_mul_cols(mat4 product, __m128 a[4], mat4 b) {
+    for (int c = 0; c < 4; c++) {
+        __m128 p = _mm_mul_ps(a[0], _mm_set1_ps(b[c][0]));
+        p = _mm_add_ps(p, _mm_mul_ps(a[1], _mm_set1_ps(b[c][1])));
+        p = _mm_add_ps(p, _mm_mul_ps(a[2], _mm_set1_ps(b[c][2])));
+        p = _mm_add_ps(p, _mm_mul_ps(a[3], _mm_set1_ps(b[c][3])));
+        _mm_store_ps(product[c], p);
+    }
+}
+
+static inline void mat4_load(__m128 cols[4], mat4 m) {
+    for (int c = 0; c < 4; c++) {
+        cols[c] = _mm_load_ps(m[c]);
+    }
+}
+#elif defined(LINEAR_SIMD)
+static inline void mat4_mul_cols(mat4 product, float32x4_t a[4], mat4 b) {
+    for (int c = 0; c < 4; c++) {
+        float32x4_t p = vmulq_n_f32(a[0], b[c][0]);
+        p = vmlaq_n_f32(p, a[1], b[c][1]);
+        p = vmlaq_n_f32(p, a[2], b[c][2]);
+        p = vmlaq_n_f32(p, a[3], b[c][3]);
+        vst1q_f32(product[c], p);
+    }
+}
+
+static inline void mat4_load(float32x4_t cols[4], mat4 m) {
+    for (int c = 0; c < 4; c++) {
+        cols[c] = vld1q_f32(m[c]);
+    }
+}
+#endif
+
+void mat4_mul(mat4 product, mat4 a, mat4 b) {
+#ifdef LINEAR_SIMD
+    mat4_mul_batch((mat4*)product, a, (mat4*)b, 1);
+#else
+    mat4 p;
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            p[c][r] = a[0][r]*b[c][0] + a[1][r]*b[c][1] +
+                      a[2][r]*b[c][2] + a[3][r]*b[c][3];
+        }
+    }
+    memcpy(product, p, sizeof(p));
+#endif
+}
+
+void mat4_mul_batch(mat4 *products, mat4 a, mat4 *bs, size_t count) {
+#if defined(LINEAR_SIMD) && defined(__SSE__)
+    __m128 cols[4];
+#elif defined(LINEAR_SIMD)
+    float32x4_t cols[4];
+#endif
+#ifdef LINEAR_SIMD
+    mat4_load(cols, a);
+    for (size_t i = 0; i < count; i++) {
+        mat4_mul_cols(products[i], cols, bs[i]);
+    }
+#else
+    mat4 a_copy;
+    memcpy(a_copy, a, sizeof(a_copy));
+    for (size_t i = 0; i < count; i++) {
+        mat4_mul(products[i], a_copy, bs[i]);
+    }
+#endif
+}
+
+void mat4_transform(vec4 out, mat4 mat, vec4 v) {
+#if defined(LINEAR_SIMD) && defined(__SSE__)
+    __m128 p = _mm_mul_ps(_mm_load_ps(mat[0]), _mm_set1_ps(v[0]));
+    p = _mm_add_ps(p, _mm_mul_ps(_mm_load_ps(mat[1]), _mm_set1_ps(v[1])));
+    p = _mm_add_ps(p, _mm_mul_ps(_mm_load_ps(mat[2]), _mm_set1_ps(v[2])));
+    p = _mm_add_ps(p, _mm_mul_ps(_mm_load_ps(mat[3]), _mm_set1_ps(v[3])));
+    _mm_storeu_ps(out, p);
+#elif defined(LINEAR_SIMD)
+    float32x4_t p = vmulq_n_f32(vld1q_f32(mat[0]), v[0]);
+    p = vmlaq_n_f32(p, vld1q_f32(mat[1]), v[1]);
+    p = vmlaq_n_f32(p, vld1q_f32(mat[2]), v[2]);
+    p = vmlaq_n_f32(p, vld1q_f32(mat[3]), v[3]);
+    vst1q_f32(out, p);
+#else
+    vec4 p;
+    for (int r = 0; r < 4; r++) {
+        p[r] = mat[0][r]*v[0] + mat[1][r]*v[1] +
+               mat[2][r]*v[2] + mat[3][r]*v[3];
+    }
+    memcpy(out, p, sizeof(p));
+#endif
+}
+
+/* Cofactors from the 2x2 determinants of the lower and upper row pairs.
+ * Rare enough next to the products that it stays scalar. */
+bool mat4_inverse(mat4 inverse, mat4 m) {
+    float s0 = m[0][0]*m[1][1] - m[1][0]*m[0][1];
+    float s1 = m[0][0]*m[1][2] - m[1][0]*m[0][2];
+    float s2 = m[0][0]*m[1][3] - m[1][0]*m[0][3];
+    float s3 = m[0][1]*m[1][2] - m[1][1]*m[0][2];
+    float s4 = m[0][1]*m[1][3] - m[1][1]*m[0][3];
+    float s5 = m[0][2]*m[1][3] - m[1][2]*m[0][3];
+
+    float c5 = m[2][2]*m[3][3] - m[3][2]*m[2][3];
+    float c4 = m[2][1]*m[3][3] - m[3][1]*m[2][3];
+    float c3 = m[2][1]*m[3][2] - m[3][1]*m[2][2];
+    float c2 = m[2][0]*m[3][3] - m[3][0]*m[2][3];
+    float c1 = m[2][0]*m[3][2] - m[3][0]*m[2][2];
+    float c0 = m[2][0]*m[3][1] - m[3][0]*m[2][1];
+
+    float det = s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0;
+    if (det == 0)
+        return false;
+    float inv = 1 / det;
+
+    mat4 r;
+    r[0][0] = ( m[1][1]*c5 - m[1][2]*c4 + m[1][3]*c3) * inv;
+    r[0][1] = (-m[0][1]*c5 + m[0][2]*c4 - m[0][3]*c3) * inv;
+    r[0][2] = ( m[3][1]*s5 - m[3][2]*s4 + m[3][3]*s3) * inv;
+    r[0][3] = (-m[2][1]*s5 + m[2][2]*s4 - m[2][3]*s3) * inv;
+
+    r[1][0] = (-m[1][0]*c5 + m[1][2]*c2 - m[1][3]*c1) * inv;
+    r[1][1] = ( m[0][0]*c5 - m[0][2]*c2 + m[0][3]*c1) * inv;
+    r[1][2] = (-m[3][0]*s5 + m[3][2]*s2 - m[3][3]*s1) * inv;
+    r[1][3] = ( m[2][0]*s5 - m[2][2]*s2 + m[2][3]*s1) * inv;
+
+    r[2][0] = ( m[1][0]*c4 - m[1][1]*c2 + m[1][3]*c0) * inv;
+    r[2][1] = (-m[0][0]*c4 + m[0][1]*c2 - m[0][3]*c0) * inv;
+    r[2][2] = ( m[3][0]*s4 - m[3][1]*s2 + m[3][3]*s0) * inv;
+    r[2][3] = (-m[2][0]*s4 + m[2][1]*s2 - m[2][3]*s0) * inv;
+
+    r[3][0] = (-m[1][0]*c3 + m[1][1]*c1 - m[1][2]*c0) * inv;
+    r[3][1] = ( m[0][0]*c3 - m[0][1]*c1 + m[0][2]*c0) * inv;
+    r[3][2] = (-m[3][0]*s3 + m[3][1]*s1 - m[3][2]*s0) * inv;
+    r[3][3] = ( m[2][0]*s3 - m[2][1]*s1 + m[2][2]*s0) * inv;
+
+    memcpy(inverse, r, sizeof(r));
+    return true;
+}
+
+/* Planes of the clip volume -w <= x,y <= w, 0 <= z <= w in world space,
+ * as ax + by + cz + d >= 0 with unit normals. A plane that degenerates,
+ * e.g. the far plane of an infinite projection, is left as zero and never
+ * rejects anything. */
+void frustum_planes(vec4 planes[6], mat4 view_proj) {
+    for (int r = 0; r < 4; r++) {
+        float row = view_proj[r][3];
+        float x = view_proj[r][0], y = view_proj[r][1], z = view_proj[r][2];
+        planes[0][r] = row + x;
+        planes[1][r] = row - x;
+        planes[2][r] = row + y;
+        planes[3][r] = row - y;
+        planes[4][r] = z;
+        planes[5][r] = row - z;
+    }
+    for (int i = 0; i < 6; i++) {
+        float length = sqrtf(dot(planes[i], planes[i]));
+        for (int j = 0; j < 4; j++) {
+            planes[i][j] = length > 0 ? planes[i][j] / length : 0;
+        }
+    }
+}
@@ -1,8 +1,37 @@
-typedef float mat4[4][4];
+#ifndef LINEAR_H
+#define LINEAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Matrices are column major, mat[column][row], as GLSL expects them. They
+ * are 16 byte aligned so columns load straight into SSE/NEON registers;
+ * define LINEAR_SCALAR to build the plain C fallback instead. */
+#if !defined(LINEAR_SCALAR) && (defined(__SSE__) || defined(__ARM_NEON))
+#define LINEAR_SIMD 1
+#endif
+
+typedef float mat4[4][4] __attribute__((aligned(16)));
 typedef float vec2[2];
 typedef float vec4[4];
 typedef float vec3[3];
 
+float dot(vec3 a, vec3 b);
+void cross(vec3 product, vec3 a, vec3 b);
+
 void perspective(mat4 mat, float fov, float aspect,
                            float near, float far);
+/* depth 1 at near falling to 0 at infinity, for a GREATER depth test */
+void perspective_reverse_z(mat4 mat, float fov, float aspect, float near);
 void look_at(mat4 mat, vec3 eye, vec3 center, vec3 up);
+
+void mat4_identity(mat4 mat);
+void mat4_mul(mat4 product, mat4 a, mat4 b);
+/* products[i] = a*bs[i], products may alias bs */
+void mat4_mul_batch(mat4 *products, mat4 a, mat4 *bs, size_t count);
+bool mat4_inverse(mat4 inverse, mat4 mat);
+void mat4_transform(vec4 out, mat4 mat, vec4 v);
+
+void frustum_planes(vec4 planes[6], mat4 view_proj);
+
+#endif
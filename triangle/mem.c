@@ -0,0 +1,335 @@
+#include "mem.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "alloc.h"
+#include "util.h"
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize align) {
+    return align > 1 ? (value + align - 1) / align * align : value;
+}
+
+void mem_init(struct mem_allocator *ma, VkPhysicalDevice physical,
+              VkDevice device, uint32_t devicec) {
+    VkPhysicalDeviceProperties dev_props;
+    vkGetPhysicalDeviceProperties(physical, &dev_props);
+
+    ma->device = device;
+    vkGetPhysicalDeviceMemoryProperties(physical, &ma->props);
+    ma->granularity = dev_props.limits.bufferImageGranularity;
+    ma->max_allocc = dev_props.limits.maxMemoryAllocationCount;
+    ma->driver_allocc = 0;
+    ma->devicec = devicec;
+    for (int i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+        ma->blocks[i] = NULL;
+    }
+}
+
+static void mem_block_destroy(struct mem_allocator *ma,
+                              struct mem_block *block) {
+    struct mem_range *r = block->free;
+    while (r) {
+        struct mem_range *next = r->next;
+        free(r);
+        r = next;
+    }
+
+    if (block->mapped)
+        vkUnmapMemory(ma->device, block->memory);
+    vkFreeMemory(ma->device, block->memory, vk_allocator);
+    ma->driver_allocc--;
+
+    free(block);
+}
+
+void mem_destroy(struct mem_allocator *ma) {
+    for (int i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+        struct mem_block *block = ma->blocks[i];
+        while (block) {
+            struct mem_block *next = block->next;
+            if (block->allocc > 0)
+                fprintf(stderr, "warning: %u allocations leaked in memory "
+                                "type %d\n", block->allocc, i);
+            mem_block_destroy(ma, block);
+            block = next;
+        }
+        ma->blocks[i] = NULL;
+    }
+}
+
+uint32_t mem_type_index(struct mem_allocator *ma, uint32_t type_bits,
+                        VkMemoryPropertyFlags props) {
+    for (uint32_t i = 0; i < ma->props.memoryTypeCount; i++) {
+        if (~type_bits & (1 << i))
+            continue;
+        if ((ma->props.memoryTypes[i].propertyFlags & props) != props)
+            continue;
+        /* a device group gets an instance of such a heap per device by
+         * default, which cannot be mapped */
+        uint32_t heap = ma->props.memoryTypes[i].heapIndex;
+        if (ma->devicec > 1 && (props & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+            (ma->props.memoryHeaps[heap].flags &
+             VK_MEMORY_HEAP_MULTI_INSTANCE_BIT))
+            continue;
+
+        return i;
+    }
+
+    die("failed to find compatible memory type");
+    return 0;
+}
+
+static struct mem_block *mem_block_create(struct mem_allocator *ma,
+                                          uint32_t type_index, bool linear,
+                                          VkDeviceSize min_size) {
+    if (ma->driver_allocc >= ma->max_allocc)
+        die("out of device memory allocations (%u)", ma->max_allocc);
+
+    /* small heaps, e.g. the host visible device local window, get smaller
+     * blocks so a single block does not claim the whole heap */
+    uint32_t heap = ma->props.memoryTypes[type_index].heapIndex;
+    VkDeviceSize size = MEM_BLOCK_SIZE;
+    if (ma->props.memoryHeaps[heap].size / 8 < size)
+        size = ma->props.memoryHeaps[heap].size / 8;
+    if (size < min_size)
+        size = min_size;
+
+    struct mem_block *block = malloc(sizeof(*block));
+    struct mem_range *range = malloc(sizeof(*range));
+    if (!block || !range)
+        die("out of memory");
+
+    VkMemoryAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = size,
+        .memoryTypeIndex = type_index
+    };
+    if (vkAllocateMemory(ma->device, &alloc_info, vk_allocator, &block->memory)
+            != VK_SUCCESS)
+        die("failed to allocate %llu bytes of device memory",
+            (unsigned long long)size);
+    ma->driver_allocc++;
+
+    block->mapped = NULL;
+    VkMemoryPropertyFlags flags =
+        ma->props.memoryTypes[type_index].propertyFlags;
+    if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        void *data;
+        if (vkMapMemory(ma->device, block->memory, 0, VK_WHOLE_SIZE, 0, &data)
+                != VK_SUCCESS)
+            die("failed to map memory block");
+        block->mapped = data;
+    }
+
+    range->offset = 0;
+    range->size = size;
+    range->next = NULL;
+
+    block->size = size;
+    block->used = 0;
+    block->allocc = 0;
+    block->type_index = type_index;
+    block->linear = linear;
+    block->free = range;
+    block->next = ma->blocks[type_index];
+    ma->blocks[type_index] = block;
+
+    return block;
+}
+
+/* first fit, the padding in front of an aligned allocation stays free */
+static bool mem_block_take(struct mem_block *block, VkDeviceSize size,
+                           VkDeviceSize align, VkDeviceSize *offset) {
+    struct mem_range **prev = &block->free;
+    for (struct mem_range *r = block->free; r; prev = &r->next, r = r->next) {
+        VkDeviceSize start = align_up(r->offset, align);
+        VkDeviceSize end = r->offset + r->size;
+        if (start + size > end)
+            continue;
+
+        if (start + size < end) {
+            if (start > r->offset) {
+                struct mem_range *tail = malloc(sizeof(*tail));
+                if (!tail)
+                    die("out of memory");
+                tail->offset = start + size;
+                tail->size = end - tail->offset;
+                tail->next = r->next;
+                r->next = tail;
+                r->size = start - r->offset;
+            } else {
+                r->offset += size;
+                r->size -= size;
+            }
+        } else if (start > r->offset) {
+            r->size = start - r->offset;
+        } else {
+            *prev = r->next;
+            free(r);
+        }
+
+        block->used += size;
+        block->allocc++;
+        *offset = start;
+        return true;
+    }
+
+    return false;
+}
+
+static void mem_block_give(struct mem_block *block,
+                           VkDeviceSize offset, VkDeviceSize size) {
+    struct mem_range *prev = NULL, *next = block->free;
+    while (next && next->offset < offset) {
+        prev = next;
+        next = next->next;
+    }
+
+    bool merge_prev = prev && prev->offset + prev->size == offset;
+    bool merge_next = next && offset + size == next->offset;
+    if (merge_prev && merge_next) {
+        prev->size += size + next->size;
+        prev->next = next->next;
+        free(next);
+    } else if (merge_prev) {
+        prev->size += size;
+    } else if (merge_next) {
+        next->offset = offset;
+        next->size += size;
+    } else {
+        struct mem_range *r = malloc(sizeof(*r));
+        if (!r)
+            die("out of memory");
+        r->offset = offset;
+        r->size = size;
+        r->next = next;
+        if (prev)
+            prev->next = r;
+        else
+            block->free = r;
+    }
+
+    block->used -= size;
+    block->allocc--;
+}
+
+void mem_alloc(struct mem_allocator *ma, VkMemoryRequirements reqs,
+               VkMemoryPropertyFlags props, bool linear,
+               struct mem_alloc *alloc) {
+    uint32_t type_index = mem_type_index(ma, reqs.memoryTypeBits, props);
+
+    /* a block shared by buffers and images would need every neighbour of a
+     * different kind padded to the granularity, keep them apart instead */
+    struct mem_block *block;
+    VkDeviceSize offset = 0;
+    for (block = ma->blocks[type_index]; block; block = block->next) {
+        if (block->linear != linear)
+            continue;
+        if (block->size - block->used < reqs.size)
+            continue;
+        if (mem_block_take(block, reqs.size, reqs.alignment, &offset))
+            break;
+    }
+    if (!block) {
+        block = mem_block_create(ma, type_index, linear, reqs.size);
+        if (!mem_block_take(block, reqs.size, reqs.alignment, &offset))
+            die("failed to sub-allocate %llu bytes from new block",
+                (unsigned long long)reqs.size);
+    }
+
+    alloc->memory = block->memory;
+    alloc->offset = offset;
+    alloc->size = reqs.size;
+    alloc->mapped = block->mapped ? block->mapped + offset : NULL;
+    alloc->block = block;
+}
+
+void mem_free(struct mem_allocator *ma, struct mem_alloc *alloc) {
+    struct mem_block *block = alloc->block;
+    if (!block)
+        return;
+
+    mem_block_give(block, alloc->offset, alloc->size);
+    alloc->block = NULL;
+    alloc->mapped = NULL;
+
+    /* release empty blocks, but keep the last one of each type around so
+     * that a free followed by an alloc does not hit the driver */
+    if (block->allocc > 0)
+        return;
+    struct mem_block **prev = &ma->blocks[block->type_index];
+    if (*prev == block && !block->next)
+        return;
+    while (*prev != block)
+        prev = &(*prev)->next;
+    *prev = block->next;
+    mem_block_destroy(ma, block);
+}
+
+void mem_buffer_create(struct mem_allocator *ma,
+                       VkDeviceSize size, VkBufferUsageFlags usage,
+                       VkMemoryPropertyFlags props,
+                       uint32_t familyc, const uint32_t *families,
+                       VkBuffer *buffer, struct mem_alloc *buffer_mem) {
+    VkBufferCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = familyc > 1 ? VK_SHARING_MODE_CONCURRENT
+                                   : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = familyc > 1 ? familyc : 0,
+        .pQueueFamilyIndices = familyc > 1 ? families : NULL,
+    };
+    if (vkCreateBuffer(ma->device, &create_info, vk_allocator, buffer)
+            != VK_SUCCESS)
+        die("failed to create buffer");
+
+    VkMemoryRequirements mem_reqs;
+    vkGetBufferMemoryRequirements(ma->device, *buffer, &mem_reqs);
+    mem_alloc(ma, mem_reqs, props, true, buffer_mem);
+
+    vkBindBufferMemory(ma->device, *buffer,
+                       buffer_mem->memory, buffer_mem->offset);
+}
+
+void mem_buffer_destroy(struct mem_allocator *ma,
+                        VkBuffer buffer, struct mem_alloc *buffer_mem) {
+    vkDestroyBuffer(ma->device, buffer, vk_allocator);
+    mem_free(ma, buffer_mem);
+}
+
+void mem_stats(struct mem_allocator *ma, struct mem_stats *stats) {
+    stats->blockc = 0;
+    stats->allocc = 0;
+    stats->reserved = 0;
+    stats->used = 0;
+    for (int i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+        for (struct mem_block *b = ma->blocks[i]; b; b = b->next) {
+            stats->blockc++;
+            stats->allocc += b->allocc;
+            stats->reserved += b->size;
+            stats->used += b->used;
+        }
+    }
+}
+
+void mem_stats_print(struct mem_allocator *ma) {
+    printf("device memory:\n");
+    for (uint32_t i = 0; i < ma->props.memoryTypeCount; i++) {
+        uint32_t blockc = 0, allocc = 0;
+        VkDeviceSize reserved = 0, used = 0;
+        for (struct mem_block *b = ma->blocks[i]; b; b = b->next) {
+            blockc++;
+            allocc += b->allocc;
+            reserved += b->size;
+            used += b->used;
+        }
+        if (blockc == 0)
+            continue;
+        printf("  type %u (flags %x): %u block(s), %u allocation(s), "
+               "%.2f/%.2f MiB\n",
+               i, ma->props.memoryTypes[i].propertyFlags, blockc, allocc,
+               used/1048576.0, reserved/1048576.0);
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdbool.h>
+
+#include <vulkan/vulkan.h>
+
+/* Device memory sub-allocator. Memory is allocated from the driver in large
+ * blocks per memory type and handed out in pieces from a sorted free list.
+ * Host visible blocks are mapped once for their whole lifetime. Linear
+ * (buffer) and optimal (image) resources never share a block, so
+ * bufferImageGranularity never has to be padded for inside a block. */
+
+#define MEM_BLOCK_SIZE (64*1024*1024)
+
+struct mem_range {
+    VkDeviceSize offset, size;
+    struct mem_range *next;
+};
+
+struct mem_block {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    VkDeviceSize used;
+    uint32_t allocc;
+    uint32_t type_index;
+    bool linear;
+    char *mapped;
+    struct mem_range *free; /* sorted by offset, adjacent ranges merged */
+    struct mem_block *next;
+};
+
+struct mem_alloc {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    void *mapped; /* NULL unless host visible */
+    struct mem_block *block;
+};
+
+struct mem_stats {
+    uint32_t blockc;
+    uint32_t allocc;
+    VkDeviceSize reserved; /* allocated from the driver */
+    VkDeviceSize used; /* handed out to resources */
+};
+
+struct mem_allocator {
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties props;
+    VkDeviceSize granularity;
+    uint32_t max_allocc;
+    uint32_t driver_allocc;
+    uint32_t devicec; /* physical devices in the logical one */
+    struct mem_block *blocks[VK_MAX_MEMORY_TYPES];
+};
+
+/* devicec is the size of the device group, 1 without one */
+void mem_init(struct mem_allocator *ma, VkPhysicalDevice physical,
+              VkDevice device, uint32_t devicec);
+void mem_destroy(struct mem_allocator *ma);
+
+uint32_t mem_type_index(struct mem_allocator *ma, uint32_t type_bits,
+                        VkMemoryPropertyFlags props);
+void mem_alloc(struct mem_allocator *ma, VkMemoryRequirements reqs,
+               VkMemoryPropertyFlags props, bool linear,
+               struct mem_alloc *alloc);
+void mem_free(struct mem_allocator *ma, struct mem_alloc *alloc);
+
+/* buffers shared by more than one queue family are created concurrent */
+void mem_buffer_create(struct mem_allocator *ma,
+                       VkDeviceSize size, VkBufferUsageFlags usage,
+                       VkMemoryPropertyFlags props,
+                       uint32_t familyc, const uint32_t *families,
+                       VkBuffer *buffer, struct mem_alloc *buffer_mem);
+void mem_buffer_destroy(struct mem_allocator *ma,
+                        VkBuffer buffer, struct mem_alloc *buffer_mem);
+
+void mem_stats(struct mem_allocator *ma, struct mem_stats *stats);
+void mem_stats_print(struct mem_allocator *ma);
+
+#endif
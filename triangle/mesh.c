@@ -0,0 +1,524 @@
+#include "mesh.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "linear.h"
+#include "meshopt.h"
+#include "util.h"
+
+#define OBJ_LINE_MAX 4096
+
+/* grow an array to hold at least need elements */
+static void *grow(void *ptr, uint32_t *cap, uint32_t need, size_t size) {
+    if (need <= *cap)
+        return ptr;
+    uint32_t new_cap = *cap ? *cap : 256;
+    while (new_cap < need)
+        new_cap *= 2;
+    ptr = realloc(ptr, (size_t)new_cap*size);
+    if (!ptr)
+        die("out of memory");
+    *cap = new_cap;
+    return ptr;
+}
+
+void mesh_builder_init(struct mesh_builder *b) {
+    memset(b, 0, sizeof(*b));
+}
+
+void mesh_builder_destroy(struct mesh_builder *b) {
+    free(b->pos);
+    free(b->normal);
+    free(b->col);
+    free(b->indices);
+    mesh_builder_init(b);
+}
+
+uint32_t mesh_builder_vertex(struct mesh_builder *b, const float pos[3],
+                             const float normal[3], const float col[4]) {
+    uint32_t cap = b->vertex_cap;
+    b->pos = grow(b->pos, &cap, b->vertexc + 1, sizeof(*b->pos));
+    cap = b->vertex_cap;
+    b->normal = grow(b->normal, &cap, b->vertexc + 1, sizeof(*b->normal));
+    cap = b->vertex_cap;
+    b->col = grow(b->col, &cap, b->vertexc + 1, sizeof(*b->col));
+    b->vertex_cap = cap;
+
+    memcpy(b->pos[b->vertexc], pos, sizeof(*b->pos));
+    memcpy(b->normal[b->vertexc], normal, sizeof(*b->normal));
+    memcpy(b->col[b->vertexc], col, sizeof(*b->col));
+    return b->vertexc++;
+}
+
+void mesh_builder_index(struct mesh_builder *b, uint32_t index) {
+    b->indices = grow(b->indices, &b->index_cap, b->indexc + 1,
+                      sizeof(*b->indices));
+    b->indices[b->indexc++] = index;
+}
+
+static void mesh_bind(struct mesh *m, const struct mesh_header *h) {
+    m->vertexc = h->vertexc;
+    m->indexc = h->indexc;
+    m->index_size = h->index_size;
+    memcpy(m->min, h->min, sizeof(m->min));
+    memcpy(m->scale, h->scale, sizeof(m->scale));
+    m->radius = h->radius;
+    m->opt = h->opt;
+    memcpy(m->acmr, h->acmr, sizeof(m->acmr));
+    m->vertices = (const struct mesh_vertex*)(h + 1);
+    m->indices = m->vertices + h->vertexc;
+}
+
+static size_t mesh_blob_size(const struct mesh_header *h) {
+    return sizeof(*h) + (size_t)h->vertexc*sizeof(struct mesh_vertex) +
+           (size_t)h->indexc*h->index_size;
+}
+
+static void mesh_optimize(struct mesh_builder *b, uint32_t opt,
+                          float acmr[2]) {
+    acmr[0] = meshopt_acmr(b->indices, b->indexc, b->vertexc,
+                           MESHOPT_CACHE_SIZE);
+
+    if (opt & MESH_OPT_VERTEX_CACHE) {
+        uint32_t *clusters = NULL;
+        if (opt & MESH_OPT_OVERDRAW) {
+            clusters = malloc((b->indexc/3 + 1)*sizeof(*clusters));
+            if (!clusters)
+                die("out of memory");
+        }
+        uint32_t clusterc = meshopt_vertex_cache(b->indices, b->indexc,
+                                                 b->vertexc,
+                                                 MESHOPT_CACHE_SIZE,
+                                                 clusters);
+        if (clusters) {
+            meshopt_overdraw(b->indices, b->indexc,
+                             (const float (*)[3])b->pos,
+                             clusters, clusterc);
+            free(clusters);
+        }
+    }
+
+    if (opt & MESH_OPT_VERTEX_FETCH) {
+        uint32_t *remap = malloc((b->vertexc + 1)*sizeof(*remap));
+        float (*pos)[3] = malloc((b->vertexc + 1)*sizeof(*pos));
+        float (*normal)[3] = malloc((b->vertexc + 1)*sizeof(*normal));
+        float (*col)[4] = malloc((b->vertexc + 1)*sizeof(*col));
+        if (!remap || !pos || !normal || !col)
+            die("out of memory");
+        uint32_t used = meshopt_vertex_fetch(b->indices, b->indexc,
+                                             b->vertexc, remap);
+        for (uint32_t v = 0; v < b->vertexc; v++) {
+            if (remap[v] == UINT32_MAX)
+                continue;
+            memcpy(pos[remap[v]], b->pos[v], sizeof(*pos));
+            memcpy(normal[remap[v]], b->normal[v], sizeof(*normal));
+            memcpy(col[remap[v]], b->col[v], sizeof(*col));
+        }
+        free(b->pos);
+        free(b->normal);
+        free(b->col);
+        b->pos = pos;
+        b->normal = normal;
+        b->col = col;
+        b->vertexc = used;
+        b->vertex_cap = b->vertexc + 1;
+        free(remap);
+    }
+
+    acmr[1] = meshopt_acmr(b->indices, b->indexc, b->vertexc,
+                           MESHOPT_CACHE_SIZE);
+}
+
+/* components beyond those given are zero */
+struct vertex_source {
+#define VERTEX_SOURCE_MEMBER(name, location, type, count, format, glsl, \
+                             encoding) \
+    float name[4];
+    VERTEX_ATTRIBUTES(VERTEX_SOURCE_MEMBER)
+#undef VERTEX_SOURCE_MEMBER
+};
+
+static inline float clamp(float x, float lo, float hi) {
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+/* one per encoding of vertex.h, a layout need not use them all */
+static inline void encode_float32(float *out, const float *in, int count) {
+    memcpy(out, in, count*sizeof(*out));
+}
+
+static inline void encode_unorm16(uint16_t *out, const float *in,
+                                  int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = clamp(in[i], 0, 1)*65535 + 0.5f;
+    }
+}
+
+static inline void encode_snorm16(int16_t *out, const float *in,
+                                  int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = roundf(clamp(in[i], -1, 1)*32767);
+    }
+}
+
+static inline void encode_unorm8(uint8_t *out, const float *in, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = clamp(in[i], 0, 1)*255 + 0.5f;
+    }
+}
+
+static void vertex_encode(struct mesh_vertex *v,
+                          const struct vertex_source *src) {
+#define VERTEX_ENCODE(name, location, type, count, format, glsl, encoding) \
+    encode_##encoding(v->name, src->name, count);
+    VERTEX_ATTRIBUTES(VERTEX_ENCODE)
+#undef VERTEX_ENCODE
+}
+
+/* Project onto the octahedron |x| + |y| + |z| = 1 and fold the lower half
+ * over the upper, so a unit vector fits in two components. The zero
+ * vector maps to the centre, which decodes as +z. */
+static void octahedral(float out[2], const float n[3]) {
+    float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    if (l1 == 0) {
+        out[0] = out[1] = 0;
+        return;
+    }
+    float x = n[0]/l1, y = n[1]/l1;
+    if (n[2] < 0) {
+        float fx = (1 - fabsf(y))*(x >= 0 ? 1 : -1);
+        float fy = (1 - fabsf(x))*(y >= 0 ? 1 : -1);
+        x = fx;
+        y = fy;
+    }
+    out[0] = x;
+    out[1] = y;
+}
+
+void mesh_build(struct mesh_builder *b, uint32_t opt, struct mesh *m) {
+    struct mesh_header h = {
+        .magic = MESH_MAGIC,
+        .version = MESH_VERSION,
+        .layout = VERTEX_LAYOUT,
+        .opt = opt,
+    };
+    mesh_optimize(b, opt, h.acmr);
+    h.vertexc = b->vertexc;
+    h.indexc = b->indexc;
+    h.index_size = b->vertexc <= 65536 ? 2 : 4;
+
+    float max[3] = {0, 0, 0};
+    for (uint32_t i = 0; i < b->vertexc; i++) {
+        for (int j = 0; j < 3; j++) {
+            float p = b->pos[i][j];
+            if (i == 0 || p < h.min[j])
+                h.min[j] = p;
+            if (i == 0 || p > max[j])
+                max[j] = p;
+        }
+        float r = sqrtf(dot(b->pos[i], b->pos[i]));
+        if (r > h.radius)
+            h.radius = r;
+    }
+    for (int j = 0; j < 3; j++) {
+        h.scale[j] = max[j] - h.min[j];
+    }
+
+    size_t size = mesh_blob_size(&h);
+    char *blob = malloc(size);
+    if (!blob)
+        die("out of memory");
+    memcpy(blob, &h, sizeof(h));
+
+    struct mesh_vertex *vertices = (struct mesh_vertex*)(blob + sizeof(h));
+    for (uint32_t i = 0; i < b->vertexc; i++) {
+        struct vertex_source src = {{0}};
+        for (int j = 0; j < 3; j++) {
+            src.pos[j] = h.scale[j] > 0
+                       ? (b->pos[i][j] - h.min[j]) / h.scale[j] : 0;
+        }
+        octahedral(src.normal, b->normal[i]);
+        memcpy(src.col, b->col[i], sizeof(b->col[i]));
+        vertex_encode(&vertices[i], &src);
+    }
+
+    void *indices = vertices + b->vertexc;
+    for (uint32_t i = 0; i < b->indexc; i++) {
+        if (h.index_size == 2)
+            ((uint16_t*)indices)[i] = b->indices[i];
+        else
+            ((uint32_t*)indices)[i] = b->indices[i];
+    }
+
+    m->blob = blob;
+    m->blob_size = size;
+    m->mapped = false;
+    mesh_bind(m, (const struct mesh_header*)blob);
+}
+
+/* face corners are deduplicated on their position and normal, texture
+ * coordinates are not drawn */
+struct corner_map {
+    uint64_t *keys; /* 0 for empty */
+    uint32_t *values;
+    uint32_t cap, count;
+};
+
+static uint64_t corner_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static void corner_map_grow(struct corner_map *map) {
+    struct corner_map old = *map;
+    map->cap = old.cap ? old.cap*2 : 1024;
+    map->count = 0;
+    map->keys = calloc(map->cap, sizeof(*map->keys));
+    map->values = malloc(map->cap*sizeof(*map->values));
+    if (!map->keys || !map->values)
+        die("out of memory");
+
+    for (uint32_t i = 0; i < old.cap; i++) {
+        if (!old.keys[i])
+            continue;
+        uint32_t slot = corner_hash(old.keys[i]) & (map->cap - 1);
+        while (map->keys[slot])
+            slot = (slot + 1) & (map->cap - 1);
+        map->keys[slot] = old.keys[i];
+        map->values[slot] = old.values[i];
+        map->count++;
+    }
+    free(old.keys);
+    free(old.values);
+}
+
+/* slot of key, which is empty if the key is not in the map */
+static uint32_t corner_map_find(struct corner_map *map, uint64_t key) {
+    if ((map->count + 1)*2 > map->cap)
+        corner_map_grow(map);
+    uint32_t slot = corner_hash(key) & (map->cap - 1);
+    while (map->keys[slot] && map->keys[slot] != key)
+        slot = (slot + 1) & (map->cap - 1);
+    return slot;
+}
+
+/* 1-based, negative counts back from the last element defined */
+static uint32_t obj_index(long i, uint32_t count, const char *path,
+                          size_t line) {
+    long resolved = i < 0 ? (long)count + i : i - 1;
+    if (i == 0 || resolved < 0 || resolved >= count)
+        die("%s:%zu: index %ld out of range", path, line, i);
+    return resolved;
+}
+
+static void obj_floats(char *s, float *out, int count, const char *path,
+                       size_t line) {
+    for (int i = 0; i < count; i++) {
+        char *end;
+        out[i] = strtof(s, &end);
+        if (end == s)
+            die("%s:%zu: expected %d numbers", path, line, count);
+        s = end;
+    }
+}
+
+void mesh_load_obj(struct mesh *m, const char *path, uint32_t opt) {
+    FILE *f = fopen(path, "r");
+    if (!f)
+        die("failed to open %s", path);
+
+    float (*v)[3] = NULL, (*vn)[3] = NULL;
+    uint32_t vc = 0, vcap = 0, vnc = 0, vncap = 0;
+    struct corner_map map = {0};
+    struct mesh_builder b;
+    mesh_builder_init(&b);
+
+    char line[OBJ_LINE_MAX];
+    size_t lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        size_t len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len-1] != '\n' && !feof(f))
+            die("%s:%zu: line longer than %d", path, lineno, OBJ_LINE_MAX);
+
+        if (line[0] == 'v' && isspace((unsigned char)line[1])) {
+            v = grow(v, &vcap, vc + 1, sizeof(*v));
+            obj_floats(line + 1, v[vc++], 3, path, lineno);
+        } else if (line[0] == 'v' && line[1] == 'n' &&
+                   isspace((unsigned char)line[2])) {
+            vn = grow(vn, &vncap, vnc + 1, sizeof(*vn));
+            obj_floats(line + 2, vn[vnc++], 3, path, lineno);
+        } else if (line[0] == 'f' && isspace((unsigned char)line[1])) {
+            /* polygons are fanned out from their first corner */
+            uint32_t first = 0, prev = 0;
+            int cornerc = 0;
+            char *s = line + 1;
+            for (;;) {
+                while (isspace((unsigned char)*s))
+                    s++;
+                if (*s == '\0')
+                    break;
+
+                char *end;
+                long vi = strtol(s, &end, 10), ni = 0;
+                if (end == s)
+                    die("%s:%zu: malformed face", path, lineno);
+                s = end;
+                if (*s == '/') {
+                    strtol(s + 1, &end, 10); /* texture coordinate */
+                    s = end;
+                    if (*s == '/') {
+                        ni = strtol(s + 1, &end, 10);
+                        s = end;
+                    }
+                }
+                if (*s != '\0' && !isspace((unsigned char)*s))
+                    die("%s:%zu: malformed face", path, lineno);
+
+                uint32_t pi = obj_index(vi, vc, path, lineno);
+                uint32_t nk = ni ? obj_index(ni, vnc, path, lineno) + 1 : 0;
+                uint64_t key = (uint64_t)(pi + 1) << 32 | nk;
+                uint32_t slot = corner_map_find(&map, key);
+                if (!map.keys[slot]) {
+                    const float none[3] = {0, 0, 0};
+                    const float white[4] = {1, 1, 1, 1};
+                    map.keys[slot] = key;
+                    map.values[slot] = mesh_builder_vertex(
+                        &b, v[pi], nk ? vn[nk-1] : none, white);
+                    map.count++;
+                }
+                uint32_t index = map.values[slot];
+
+                if (cornerc == 0) {
+                    first = index;
+                } else if (cornerc >= 2) {
+                    mesh_builder_index(&b, first);
+                    mesh_builder_index(&b, prev);
+                    mesh_builder_index(&b, index);
+                }
+                prev = index;
+                cornerc++;
+            }
+            if (cornerc < 3)
+                die("%s:%zu: face with %d corners", path, lineno, cornerc);
+        }
+    }
+    if (ferror(f))
+        die("failed to read %s", path);
+    fclose(f);
+
+    if (b.indexc == 0)
+        die("%s: no faces", path);
+    mesh_build(&b, opt, m);
+
+    mesh_builder_destroy(&b);
+    free(map.keys);
+    free(map.values);
+    free(v);
+    free(vn);
+}
+
+/* native byte order, a cache is only ever read where it was written */
+void mesh_write_cache(const struct mesh *m, const char *path) {
+    size_t len = strlen(path);
+    char *tmp = malloc(len + 5);
+    if (!tmp)
+        die("out of memory");
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", 5);
+
+    /* written aside and renamed so a reader never maps half a file */
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        fprintf(stderr, "warning: failed to open %s\n", tmp);
+        free(tmp);
+        return;
+    }
+    bool ok = fwrite(m->blob, 1, m->blob_size, f) == m->blob_size;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "warning: failed to write mesh cache %s\n", path);
+        remove(tmp);
+    }
+    free(tmp);
+}
+
+bool mesh_load_cache(struct mesh *m, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(struct mesh_header)) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *blob = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (blob == MAP_FAILED)
+        return false;
+
+    const struct mesh_header *h = blob;
+    if (memcmp(h->magic, MESH_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != MESH_VERSION || h->layout != VERTEX_LAYOUT ||
+        (h->index_size != 2 && h->index_size != 4) ||
+        mesh_blob_size(h) != size) {
+        munmap(blob, size);
+        return false;
+    }
+
+    m->blob = blob;
+    m->blob_size = size;
+    m->mapped = true;
+    mesh_bind(m, h);
+    return true;
+}
+
+void mesh_load(struct mesh *m, const char *path, uint32_t opt) {
+    size_t len = strlen(path);
+    char *cache = malloc(len + 6);
+    if (!cache)
+        die("out of memory");
+    memcpy(cache, path, len);
+    memcpy(cache + len, ".mesh", 6);
+
+    struct stat obj_st, cache_st;
+    if (stat(path, &obj_st) != 0)
+        die("failed to stat %s", path);
+    bool fresh = stat(cache, &cache_st) == 0 &&
+                 cache_st.st_mtime >= obj_st.st_mtime;
+
+    bool cached = fresh && mesh_load_cache(m, cache);
+    if (cached && m->opt != opt) {
+        mesh_release(m);
+        cached = false;
+    }
+    if (!cached) {
+        mesh_load_obj(m, path, opt);
+        mesh_write_cache(m, cache);
+    }
+    free(cache);
+}
+
+void mesh_release(struct mesh *m) {
+    if (!m->blob)
+        return;
+    if (m->mapped)
+        munmap(m->blob, m->blob_size);
+    else
+        free(m->blob);
+    m->blob = NULL;
+    m->vertices = NULL;
+    m->indices = NULL;
+}
@@ -0,0 +1,97 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vertex.h"
+
+/* Meshes as the GPU draws them, in the layout of vertex.h. Positions are
+ * stored relative to the mesh's bounding box, min + pos*scale is back in
+ * model space. Every mesh is one blob laid out like
+ * the cache file, a header followed by the vertices and the indices, so a
+ * cached mesh is used straight from its mapping. */
+
+#define MESH_MAGIC "TRIM"
+#define MESH_VERSION 3
+
+/* reorderings applied by mesh_build(), see meshopt.h */
+enum mesh_opt {
+    MESH_OPT_VERTEX_CACHE = 1 << 0,
+    MESH_OPT_OVERDRAW = 1 << 1, /* sorts the vertex cache clusters */
+    MESH_OPT_VERTEX_FETCH = 1 << 2,
+};
+
+#define MESH_OPT_DEFAULT (MESH_OPT_VERTEX_CACHE | MESH_OPT_VERTEX_FETCH)
+
+#define MESH_VERTEX_MEMBER(name, location, type, count, format, glsl, \
+                           encoding) \
+    type name[count];
+struct mesh_vertex {
+    VERTEX_ATTRIBUTES(MESH_VERTEX_MEMBER)
+};
+#undef MESH_VERTEX_MEMBER
+
+struct mesh_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t vertexc;
+    uint32_t indexc;
+    uint32_t index_size; /* 2 when every index fits, otherwise 4 */
+    uint32_t layout; /* VERTEX_LAYOUT */
+    float min[3];
+    float scale[3]; /* extent of the bounds, 0 if flat along an axis */
+    float radius; /* around the model space origin */
+    uint32_t opt; /* enum mesh_opt */
+    float acmr[2]; /* before and after optimization */
+};
+
+struct mesh {
+    uint32_t vertexc;
+    uint32_t indexc;
+    uint32_t index_size;
+    float min[3], scale[3];
+    float radius;
+    uint32_t opt;
+    float acmr[2];
+    const struct mesh_vertex *vertices;
+    const void *indices;
+
+    void *blob; /* mapped or allocated, NULL once released */
+    size_t blob_size;
+    bool mapped;
+};
+
+/* unquantized triangles collected before building a mesh */
+struct mesh_builder {
+    float (*pos)[3];
+    float (*normal)[3]; /* zero for none */
+    float (*col)[4];
+    uint32_t vertexc, vertex_cap;
+    uint32_t *indices;
+    uint32_t indexc, index_cap;
+};
+
+void mesh_builder_init(struct mesh_builder *b);
+void mesh_builder_destroy(struct mesh_builder *b);
+uint32_t mesh_builder_vertex(struct mesh_builder *b, const float pos[3],
+                             const float normal[3], const float col[4]);
+void mesh_builder_index(struct mesh_builder *b, uint32_t index);
+/* reorder by opt and quantize into a heap blob owned by the mesh, this
+ * reorders the builder as well */
+void mesh_build(struct mesh_builder *b, uint32_t opt, struct mesh *m);
+
+/* Load an OBJ file through its cache at path + ".mesh", which is rebuilt
+ * when missing, stale, of another version or optimized differently. The
+ * OBJ is parsed one line at a time, only the vertex attributes it refers
+ * back to are kept. */
+void mesh_load(struct mesh *m, const char *path, uint32_t opt);
+void mesh_load_obj(struct mesh *m, const char *path, uint32_t opt);
+bool mesh_load_cache(struct mesh *m, const char *path);
+void mesh_write_cache(const struct mesh *m, const char *path);
+
+/* unmap or free the vertex and index data, the counts remain valid */
+void mesh_release(struct mesh *m);
+
+#endif
@@ -0,0 +1,263 @@
+#include "meshopt.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "linear.h"
+#include "util.h"
+
+static void *alloc(size_t count, size_t size) {
+    void *ptr = calloc(count ? count : 1, size);
+    if (!ptr)
+        die("out of memory");
+    return ptr;
+}
+
+/* A vertex is cached while fewer than cache_size misses have followed
+ * the one that loaded it. Stamps start at 0 and time above cache_size so
+ * every vertex starts out uncached. */
+float meshopt_acmr(const uint32_t *indices, uint32_t indexc,
+                   uint32_t vertexc, uint32_t cache_size) {
+    if (indexc < 3)
+        return 0;
+    uint32_t *stamps = alloc(vertexc, sizeof(*stamps));
+    uint32_t time = cache_size + 1, misses = 0;
+    for (uint32_t i = 0; i < indexc; i++) {
+        uint32_t v = indices[i];
+        if (time - stamps[v] > cache_size) {
+            stamps[v] = time++;
+            misses++;
+        }
+    }
+    free(stamps);
+    return (float)misses / (indexc/3);
+}
+
+struct tipsify {
+    uint32_t *offsets, *adjacency; /* triangles around each vertex */
+    uint32_t *live; /* triangles not yet emitted per vertex */
+    uint32_t *stamps;
+    uint32_t *dead_ends, dead_endc; /* recently used, may have live ones */
+    uint32_t cursor; /* every vertex before it is done */
+    uint32_t vertexc;
+};
+
+/* a vertex with live triangles from the dead end stack, otherwise the
+ * next in input order, UINT32_MAX when every triangle is out */
+static uint32_t tipsify_restart(struct tipsify *t) {
+    while (t->dead_endc > 0) {
+        uint32_t v = t->dead_ends[--t->dead_endc];
+        if (t->live[v] > 0)
+            return v;
+    }
+    while (t->cursor < t->vertexc) {
+        uint32_t v = t->cursor++;
+        if (t->live[v] > 0)
+            return v;
+    }
+    return UINT32_MAX;
+}
+
+uint32_t meshopt_vertex_cache(uint32_t *indices, uint32_t indexc,
+                              uint32_t vertexc, uint32_t cache_size,
+                              uint32_t *clusters) {
+    uint32_t tric = indexc/3;
+    if (tric == 0)
+        return 0;
+
+    struct tipsify t = {
+        .offsets = alloc(vertexc + 1, sizeof(uint32_t)),
+        .adjacency = alloc(indexc, sizeof(uint32_t)),
+        .live = alloc(vertexc, sizeof(uint32_t)),
+        .stamps = alloc(vertexc, sizeof(uint32_t)),
+        .dead_ends = alloc(indexc, sizeof(uint32_t)),
+        .vertexc = vertexc,
+    };
+    for (uint32_t i = 0; i < tric*3; i++) {
+        t.live[indices[i]]++;
+    }
+    for (uint32_t v = 0; v < vertexc; v++) {
+        t.offsets[v+1] = t.offsets[v] + t.live[v];
+    }
+    uint32_t *fill = alloc(vertexc, sizeof(*fill));
+    for (uint32_t i = 0; i < tric*3; i++) {
+        uint32_t v = indices[i];
+        t.adjacency[t.offsets[v] + fill[v]++] = i/3;
+    }
+    free(fill);
+
+    bool *emitted = alloc(tric, sizeof(*emitted));
+    uint32_t *candidates = alloc(indexc, sizeof(*candidates));
+    uint32_t *out = alloc(indexc, sizeof(*out));
+    uint32_t outc = 0, clusterc = 0;
+    uint32_t time = cache_size + 1;
+
+    uint32_t fan = tipsify_restart(&t);
+    if (clusters)
+        clusters[clusterc] = 0;
+    clusterc++;
+    while (fan != UINT32_MAX) {
+        uint32_t candidatec = 0;
+        for (uint32_t a = t.offsets[fan]; a < t.offsets[fan+1]; a++) {
+            uint32_t tri = t.adjacency[a];
+            if (emitted[tri])
+                continue;
+            emitted[tri] = true;
+            for (int c = 0; c < 3; c++) {
+                uint32_t v = indices[tri*3 + c];
+                out[outc++] = v;
+                t.dead_ends[t.dead_endc++] = v;
+                candidates[candidatec++] = v;
+                t.live[v]--;
+                if (time - t.stamps[v] > cache_size)
+                    t.stamps[v] = time++;
+            }
+        }
+
+        /* the oldest candidate that will still be cached once all of its
+         * triangles are out, else any live candidate */
+        uint32_t next = UINT32_MAX;
+        int64_t best = -1;
+        for (uint32_t i = 0; i < candidatec; i++) {
+            uint32_t v = candidates[i];
+            if (t.live[v] == 0)
+                continue;
+            int64_t age = time - t.stamps[v];
+            int64_t priority = age + 2*t.live[v] <= cache_size ? age : 0;
+            if (priority > best) {
+                best = priority;
+                next = v;
+            }
+        }
+        if (next == UINT32_MAX) {
+            next = tipsify_restart(&t);
+            if (next != UINT32_MAX) {
+                if (clusters)
+                    clusters[clusterc] = outc/3;
+                clusterc++;
+            }
+        }
+        fan = next;
+    }
+    memcpy(indices, out, outc*sizeof(*out));
+
+    free(out);
+    free(candidates);
+    free(emitted);
+    free(t.dead_ends);
+    free(t.stamps);
+    free(t.live);
+    free(t.adjacency);
+    free(t.offsets);
+    return clusterc;
+}
+
+struct cluster {
+    float key;
+    uint32_t start, count;
+};
+
+static int cluster_cmp(const void *a, const void *b) {
+    const struct cluster *ca = a, *cb = b;
+    if (ca->key != cb->key)
+        return ca->key < cb->key ? 1 : -1;
+    return ca->start < cb->start ? -1 : ca->start > cb->start;
+}
+
+/* area weighted centroid (times 3) and normal (times 2) of a triangle */
+static void triangle_moments(const float (*pos)[3], const uint32_t *tri,
+                             vec3 centroid, vec3 normal) {
+    vec3 a, b, c, ab, ac;
+    memcpy(a, pos[tri[0]], sizeof(a));
+    memcpy(b, pos[tri[1]], sizeof(b));
+    memcpy(c, pos[tri[2]], sizeof(c));
+    for (int j = 0; j < 3; j++) {
+        ab[j] = b[j] - a[j];
+        ac[j] = c[j] - a[j];
+    }
+    cross(normal, ab, ac);
+    float area = sqrtf(dot(normal, normal));
+    for (int j = 0; j < 3; j++) {
+        centroid[j] = (a[j] + b[j] + c[j])*area;
+    }
+}
+
+/* Sander et al.'s sort by occlusion potential, the distance of a cluster
+ * from the mesh centroid along the cluster's normal */
+void meshopt_overdraw(uint32_t *indices, uint32_t indexc,
+                      const float (*pos)[3], const uint32_t *clusters,
+                      uint32_t clusterc) {
+    uint32_t tric = indexc/3;
+    if (clusterc <= 1)
+        return;
+
+    vec3 mesh_centroid = {0, 0, 0};
+    float mesh_area = 0;
+    for (uint32_t i = 0; i < tric; i++) {
+        vec3 centroid, normal;
+        triangle_moments(pos, &indices[i*3], centroid, normal);
+        for (int j = 0; j < 3; j++) {
+            mesh_centroid[j] += centroid[j];
+        }
+        mesh_area += sqrtf(dot(normal, normal));
+    }
+    for (int j = 0; j < 3; j++) {
+        mesh_centroid[j] = mesh_area > 0 ? mesh_centroid[j]/mesh_area : 0;
+    }
+
+    struct cluster *sorted = alloc(clusterc, sizeof(*sorted));
+    for (uint32_t c = 0; c < clusterc; c++) {
+        uint32_t start = clusters[c];
+        uint32_t end = c + 1 < clusterc ? clusters[c+1] : tric;
+        vec3 sum_centroid = {0, 0, 0}, sum_normal = {0, 0, 0};
+        float area = 0;
+        for (uint32_t i = start; i < end; i++) {
+            vec3 centroid, normal;
+            triangle_moments(pos, &indices[i*3], centroid, normal);
+            for (int j = 0; j < 3; j++) {
+                sum_centroid[j] += centroid[j];
+                sum_normal[j] += normal[j];
+            }
+            area += sqrtf(dot(normal, normal));
+        }
+
+        float length = sqrtf(dot(sum_normal, sum_normal));
+        vec3 offset;
+        for (int j = 0; j < 3; j++) {
+            float centroid = area > 0 ? sum_centroid[j]/area : 0;
+            offset[j] = centroid - mesh_centroid[j];
+        }
+        sorted[c].key = length > 0 ? dot(offset, sum_normal)/length : 0;
+        sorted[c].start = start;
+        sorted[c].count = end - start;
+    }
+    qsort(sorted, clusterc, sizeof(*sorted), cluster_cmp);
+
+    uint32_t *out = alloc(indexc, sizeof(*out));
+    uint32_t outc = 0;
+    for (uint32_t c = 0; c < clusterc; c++) {
+        memcpy(&out[outc], &indices[sorted[c].start*3],
+               sorted[c].count*3*sizeof(*out));
+        outc += sorted[c].count*3;
+    }
+    memcpy(indices, out, outc*sizeof(*out));
+    free(out);
+    free(sorted);
+}
+
+uint32_t meshopt_vertex_fetch(uint32_t *indices, uint32_t indexc,
+                              uint32_t vertexc, uint32_t *remap) {
+    for (uint32_t v = 0; v < vertexc; v++) {
+        remap[v] = UINT32_MAX;
+    }
+    uint32_t next = 0;
+    for (uint32_t i = 0; i < indexc; i++) {
+        uint32_t v = indices[i];
+        if (remap[v] == UINT32_MAX)
+            remap[v] = next++;
+        indices[i] = remap[v];
+    }
+    return next;
+}
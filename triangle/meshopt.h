@@ -0,0 +1,41 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include <stdint.h>
+
+/* Reordering of triangle lists for the post-transform vertex cache, for
+ * overdraw and for vertex fetch. Indices are rewritten in place; none of
+ * it changes what is drawn. The cache is modelled as a FIFO, which is
+ * close enough to what hardware does that an order good for one size is
+ * good for all nearby sizes. */
+
+#define MESHOPT_CACHE_SIZE 16
+
+/* average cache miss ratio, transformed vertices per triangle: 0.5 at
+ * best for a large regular mesh, 3 at worst */
+float meshopt_acmr(const uint32_t *indices, uint32_t indexc,
+                   uint32_t vertexc, uint32_t cache_size);
+
+/* Tipsify, Sander et al. 2007. Triangles are emitted in fans around the
+ * vertex most likely to still be cached, in time linear in the index
+ * count. When clusters is not NULL the first triangle of every run that
+ * had to restart away from the cache is written to it, at most indexc/3
+ * entries, and the run count is returned. */
+uint32_t meshopt_vertex_cache(uint32_t *indices, uint32_t indexc,
+                              uint32_t vertexc, uint32_t cache_size,
+                              uint32_t *clusters);
+
+/* Order the clusters of meshopt_vertex_cache() outside in, those facing
+ * away from the mesh centre first, as they are the likeliest to occlude
+ * the rest. Triangle order within each cluster is kept. */
+void meshopt_overdraw(uint32_t *indices, uint32_t indexc,
+                      const float (*pos)[3], const uint32_t *clusters,
+                      uint32_t clusterc);
+
+/* Number vertices in order of first use so fetches walk memory forwards.
+ * remap[old] is the new index, UINT32_MAX for vertices never used, and
+ * the count of used vertices is returned. */
+uint32_t meshopt_vertex_fetch(uint32_t *indices, uint32_t indexc,
+                              uint32_t vertexc, uint32_t *remap);
+
+#endif
@@ -0,0 +1,452 @@
+#include "profile.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "alloc.h"
+#include "util.h"
+
+static const char *cpu_names[PROFILE_CPU_COUNT] = {
+    "wait", "pace", "acquire", "ubo", "record", "submit", "present"
+};
+static const char *gpu_names[PROFILE_GPU_COUNT] = {
+    "gpu_frame", "gpu_cull", "gpu_renderpass"
+};
+static const char *stat_names[PROFILE_STAT_COUNT] = {
+    "ia_vertices", "ia_primitives", "vs_invocations", "clip_primitives",
+    "fs_invocations"
+};
+
+double profile_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e3 + ts.tv_nsec/1e6;
+}
+
+static uint64_t tick_mask(uint32_t valid_bits) {
+    return valid_bits >= 64 ? ~0ULL : (1ULL << valid_bits) - 1;
+}
+
+void profile_init(struct profile *p, VkDevice device,
+                  VkPhysicalDevice physical, uint32_t family,
+                  uint32_t compute_family, uint32_t slotc, bool timestamps,
+                  bool statistics) {
+    if (slotc > PROFILE_MAX_SLOTS)
+        die("profiler supports at most %d frames in flight",
+            PROFILE_MAX_SLOTS);
+
+    memset(p, 0, sizeof(*p));
+    p->device = device;
+    p->slotc = slotc;
+    p->epoch = profile_now();
+
+    p->history = malloc(PROFILE_HISTORY*sizeof(*p->history));
+    if (!p->history)
+        die("out of memory");
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physical, &props);
+    uint32_t propc = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical, &propc, NULL);
+    VkQueueFamilyProperties *fprops = malloc(propc*sizeof(*fprops));
+    vkGetPhysicalDeviceQueueFamilyProperties(physical, &propc, fprops);
+    uint32_t valid_bits = family < propc ? fprops[family].timestampValidBits
+                                         : 0;
+    uint32_t compute_bits = compute_family < propc
+                          ? fprops[compute_family].timestampValidBits : 0;
+    free(fprops);
+
+    if (!timestamps) {
+        printf("gpu timestamps disabled\n");
+    } else if (valid_bits == 0) {
+        printf("gpu timestamps not supported by queue family %u\n", family);
+    } else {
+        p->ns_per_tick = props.limits.timestampPeriod;
+        p->gpu_scopes = PROFILE_GPU_ALL;
+        for (int i = 0; i < PROFILE_GPU_COUNT; i++) {
+            p->tick_masks[i] = tick_mask(valid_bits);
+        }
+        p->tick_masks[PROFILE_GPU_CULL] = tick_mask(compute_bits);
+        if (compute_bits == 0) {
+            printf("gpu timestamps not supported by queue family %u, "
+                   "culling not timed\n", compute_family);
+            p->gpu_scopes &= ~PROFILE_GPU_BIT(PROFILE_GPU_CULL);
+        }
+
+        VkQueryPoolCreateInfo create_info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = slotc*PROFILE_GPU_COUNT*2
+        };
+        if (vkCreateQueryPool(device, &create_info, vk_allocator,
+                              &p->timestamps) != VK_SUCCESS)
+            die("failed to create timestamp query pool");
+    }
+
+    if (statistics) {
+        p->statistic_flags =
+            VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+            VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+        VkQueryPoolCreateInfo create_info = {
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+            .queryCount = slotc,
+            .pipelineStatistics = p->statistic_flags
+        };
+        if (vkCreateQueryPool(device, &create_info, vk_allocator,
+                              &p->statistics) != VK_SUCCESS)
+            die("failed to create pipeline statistics query pool");
+    }
+}
+
+void profile_destroy(struct profile *p) {
+    if (p->timestamps)
+        vkDestroyQueryPool(p->device, p->timestamps, vk_allocator);
+    if (p->statistics)
+        vkDestroyQueryPool(p->device, p->statistics, vk_allocator);
+    free(p->history);
+}
+
+void profile_frame_begin(struct profile *p, uint64_t frame) {
+    memset(&p->current, 0, sizeof(p->current));
+    p->current.frame = frame;
+    p->current.start = profile_now() - p->epoch;
+}
+
+void profile_frame_end(struct profile *p, uint32_t slot) {
+    p->slots[slot].rec = p->current;
+    p->slots[slot].pending = true;
+}
+
+void profile_cpu_begin(struct profile *p, enum profile_cpu which) {
+    p->current.cpu_start[which] = profile_now() - p->epoch;
+}
+
+void profile_cpu_end(struct profile *p, enum profile_cpu which) {
+    p->current.cpu[which] =
+        profile_now() - p->epoch - p->current.cpu_start[which];
+}
+
+void profile_input(struct profile *p) {
+    p->current.input = profile_now() - p->epoch;
+}
+
+void profile_cmd_reset(struct profile *p, VkCommandBuffer cb, uint32_t slot,
+                       uint32_t scopes) {
+    for (int i = 0; p->timestamps && i < PROFILE_GPU_COUNT; i++) {
+        if (scopes & p->gpu_scopes & PROFILE_GPU_BIT(i))
+            vkCmdResetQueryPool(cb, p->timestamps,
+                                (slot*PROFILE_GPU_COUNT + i)*2, 2);
+    }
+    if (p->statistics && (scopes & PROFILE_GPU_BIT(PROFILE_GPU_RENDERPASS)))
+        vkCmdResetQueryPool(cb, p->statistics, slot, 1);
+}
+
+void profile_cmd_begin(struct profile *p, VkCommandBuffer cb, uint32_t slot,
+                       enum profile_gpu which) {
+    if (p->gpu_scopes & PROFILE_GPU_BIT(which))
+        vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                            p->timestamps,
+                            (slot*PROFILE_GPU_COUNT + which)*2);
+}
+
+void profile_cmd_end(struct profile *p, VkCommandBuffer cb, uint32_t slot,
+                     enum profile_gpu which) {
+    if (p->gpu_scopes & PROFILE_GPU_BIT(which))
+        vkCmdWriteTimestamp(cb, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            p->timestamps,
+                            (slot*PROFILE_GPU_COUNT + which)*2 + 1);
+}
+
+void profile_cmd_stats_begin(struct profile *p, VkCommandBuffer cb,
+                             uint32_t slot) {
+    if (p->statistics)
+        vkCmdBeginQuery(cb, p->statistics, slot, 0);
+}
+
+void profile_cmd_stats_end(struct profile *p, VkCommandBuffer cb,
+                           uint32_t slot) {
+    if (p->statistics)
+        vkCmdEndQuery(cb, p->statistics, slot);
+}
+
+/* done is when the slot was seen complete, negative if unknown */
+static void profile_collect_at(struct profile *p, uint32_t slot,
+                               double done) {
+    struct profile_slot *s = &p->slots[slot];
+    if (!s->pending)
+        return;
+    s->pending = false;
+
+    struct profile_record *rec = &s->rec;
+    if (done >= 0 && rec->input > 0) {
+        rec->latency = done - rec->input;
+        rec->latency_valid = true;
+    }
+
+    /* no WAIT_BIT, the frame has completed so results are normally there,
+     * and if a driver is late the frame is simply recorded without them.
+     * Scopes are read one by one as the untimed ones are never written. */
+    uint64_t ts[PROFILE_GPU_COUNT*2] = {0};
+    rec->gpu_valid = p->timestamps != VK_NULL_HANDLE;
+    for (int i = 0; rec->gpu_valid && i < PROFILE_GPU_COUNT; i++) {
+        if (p->gpu_scopes & PROFILE_GPU_BIT(i))
+            rec->gpu_valid =
+                vkGetQueryPoolResults(p->device, p->timestamps,
+                                      (slot*PROFILE_GPU_COUNT + i)*2, 2,
+                                      2*sizeof(*ts), &ts[i*2], sizeof(*ts),
+                                      VK_QUERY_RESULT_64_BIT) == VK_SUCCESS;
+    }
+    /* each scope wraps at the bits of its own family, its start at the
+     * fewer of those and the frame's */
+    for (int i = 0; rec->gpu_valid && i < PROFILE_GPU_COUNT; i++) {
+        uint64_t mask = p->tick_masks[i];
+        uint64_t start_mask = mask & p->tick_masks[PROFILE_GPU_FRAME];
+        uint64_t begin = ts[i*2] & mask;
+        uint64_t end = ts[i*2+1] & mask;
+        uint64_t base = ts[PROFILE_GPU_FRAME*2] & start_mask;
+        rec->gpu_start[i] = ((begin - base) & start_mask)
+                            * p->ns_per_tick / 1e6;
+        rec->gpu[i] = ((end - begin) & mask) * p->ns_per_tick / 1e6;
+    }
+
+    if (p->statistics &&
+        vkGetQueryPoolResults(p->device, p->statistics, slot, 1,
+                              sizeof(rec->stats), rec->stats,
+                              sizeof(rec->stats),
+                              VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+        rec->stats_valid = true;
+
+    p->history[p->historyc % PROFILE_HISTORY] = *rec;
+    p->historyc++;
+}
+
+void profile_collect(struct profile *p, uint32_t slot) {
+    profile_collect_at(p, slot, profile_now() - p->epoch);
+}
+
+/* waited on long after completion, their latency would be meaningless */
+void profile_flush(struct profile *p) {
+    for (uint32_t i = 0; i < p->slotc; i++) {
+        profile_collect_at(p, i, -1);
+    }
+}
+
+const struct profile_record *profile_latest(struct profile *p) {
+    if (p->historyc == 0)
+        return NULL;
+    return &p->history[(p->historyc - 1) % PROFILE_HISTORY];
+}
+
+static uint64_t profile_first(struct profile *p) {
+    return p->historyc > PROFILE_HISTORY ? p->historyc - PROFILE_HISTORY : 0;
+}
+
+void profile_summary(struct profile *p) {
+    uint64_t first = profile_first(p);
+    uint64_t n = p->historyc - first;
+    if (n < 2)
+        return;
+
+    double cpu[PROFILE_CPU_COUNT] = {0}, gpu[PROFILE_GPU_COUNT] = {0};
+    double latency = 0;
+    uint64_t gpun = 0, latencyn = 0;
+    for (uint64_t i = first; i < p->historyc; i++) {
+        const struct profile_record *rec = &p->history[i % PROFILE_HISTORY];
+        for (int j = 0; j < PROFILE_CPU_COUNT; j++) {
+            cpu[j] += rec->cpu[j];
+        }
+        if (rec->latency_valid) {
+            latency += rec->latency;
+            latencyn++;
+        }
+        if (rec->gpu_valid) {
+            for (int j = 0; j < PROFILE_GPU_COUNT; j++) {
+                gpu[j] += rec->gpu[j];
+            }
+            gpun++;
+        }
+    }
+    const struct profile_record *a = &p->history[first % PROFILE_HISTORY];
+    const struct profile_record *b = profile_latest(p);
+    double frame = (b->start - a->start) / (n - 1);
+
+    printf("profile over %llu frames: %.3f ms/frame (%.1f fps)\n",
+           (unsigned long long)n, frame, 1e3/frame);
+    for (int j = 0; j < PROFILE_CPU_COUNT; j++) {
+        printf("  %-16s %8.3f ms\n", cpu_names[j], cpu[j]/n);
+    }
+    for (int j = 0; gpun > 0 && j < PROFILE_GPU_COUNT; j++) {
+        if (p->gpu_scopes & PROFILE_GPU_BIT(j))
+            printf("  %-16s %8.3f ms\n", gpu_names[j], gpu[j]/gpun);
+    }
+    if (latencyn > 0)
+        printf("  %-16s %8.3f ms\n", "latency", latency/latencyn);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_line(const char *name, double *v, uint64_t n,
+                       FILE *out) {
+    qsort(v, n, sizeof(*v), cmp_double);
+    double sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        sum += v[i];
+    }
+    uint64_t p99 = (n*99 + 99) / 100;
+    double stats[] = {v[0], sum/n, v[p99 > 0 ? p99 - 1 : 0], v[n-1]};
+    printf("  %-10s min %8.3f  avg %8.3f  p99 %8.3f  max %8.3f ms\n",
+           name, stats[0], stats[1], stats[2], stats[3]);
+    const char *suffixes[] = {"min", "avg", "p99", "max"};
+    for (int i = 0; out && i < 4; i++) {
+        fprintf(out, "%s_%s_ms %.4f\n", name, suffixes[i], stats[i]);
+    }
+}
+
+/* Frame time is the interval between consecutive frame starts, the only
+ * measure that includes everything the loop does. Frames are collected in
+ * submission order so the history is already sorted by start. */
+void profile_benchmark(struct profile *p, uint64_t warmup,
+                       uint32_t width, uint32_t height, FILE *out) {
+    uint64_t first = profile_first(p) + warmup;
+    if (first + 2 > p->historyc) {
+        printf("benchmark: too few frames after %llu warmup frames\n",
+               (unsigned long long)warmup);
+        return;
+    }
+    uint64_t n = p->historyc - first - 1;
+
+    double *cpu = malloc(n*sizeof(*cpu));
+    double *gpu = malloc(n*sizeof(*gpu));
+    double *latency = malloc(n*sizeof(*latency));
+    if (!cpu || !gpu || !latency)
+        die("out of memory");
+
+    uint64_t gpun = 0, latencyn = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        const struct profile_record *a =
+            &p->history[(first + i) % PROFILE_HISTORY];
+        const struct profile_record *b =
+            &p->history[(first + i + 1) % PROFILE_HISTORY];
+        cpu[i] = b->start - a->start;
+        if (a->gpu_valid)
+            gpu[gpun++] = a->gpu[PROFILE_GPU_FRAME];
+        if (a->latency_valid)
+            latency[latencyn++] = a->latency;
+    }
+
+    const struct profile_record *a = &p->history[first % PROFILE_HISTORY];
+    const struct profile_record *b = profile_latest(p);
+    double total = b->start - a->start;
+    double fps = n*1e3/total;
+    printf("benchmark: %llu frames at %ux%u in %.1f ms, %.1f fps, "
+           "%.1f Mpixel/s\n",
+           (unsigned long long)n, width, height, total, fps,
+           fps*width*height/1e6);
+    if (out)
+        fprintf(out, "frames %llu\nfps %.2f\n", (unsigned long long)n, fps);
+    bench_line("frame", cpu, n, out);
+    if (gpun > 0)
+        bench_line("gpu_frame", gpu, gpun, out);
+    if (latencyn > 0)
+        bench_line("latency", latency, latencyn, out);
+
+    free(cpu);
+    free(gpu);
+    free(latency);
+}
+
+void profile_export_csv(struct profile *p, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "warning: failed to open %s\n", path);
+        return;
+    }
+
+    fprintf(f, "frame,start_ms");
+    for (int j = 0; j < PROFILE_CPU_COUNT; j++) {
+        fprintf(f, ",%s_ms", cpu_names[j]);
+    }
+    for (int j = 0; j < PROFILE_GPU_COUNT; j++) {
+        fprintf(f, ",%s_ms", gpu_names[j]);
+    }
+    for (int j = 0; j < PROFILE_STAT_COUNT; j++) {
+        fprintf(f, ",%s", stat_names[j]);
+    }
+    fprintf(f, ",latency_ms\n");
+
+    for (uint64_t i = profile_first(p); i < p->historyc; i++) {
+        const struct profile_record *rec = &p->history[i % PROFILE_HISTORY];
+        fprintf(f, "%llu,%.4f", (unsigned long long)rec->frame, rec->start);
+        for (int j = 0; j < PROFILE_CPU_COUNT; j++) {
+            fprintf(f, ",%.4f", rec->cpu[j]);
+        }
+        for (int j = 0; j < PROFILE_GPU_COUNT; j++) {
+            if (rec->gpu_valid && (p->gpu_scopes & PROFILE_GPU_BIT(j)))
+                fprintf(f, ",%.4f", rec->gpu[j]);
+            else
+                fprintf(f, ",");
+        }
+        for (int j = 0; j < PROFILE_STAT_COUNT; j++) {
+            if (rec->stats_valid)
+                fprintf(f, ",%llu", (unsigned long long)rec->stats[j]);
+            else
+                fprintf(f, ",");
+        }
+        if (rec->latency_valid)
+            fprintf(f, ",%.4f\n", rec->latency);
+        else
+            fprintf(f, ",\n");
+    }
+
+    fclose(f);
+    printf("wrote profile to %s\n", path);
+}
+
+static void trace_event(FILE *f, bool *first, const char *name, int tid,
+                        double start, double dur) {
+    fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+               "\"ts\":%.3f,\"dur\":%.3f}",
+            *first ? "" : ",", name, tid, start*1e3, dur*1e3);
+    *first = false;
+}
+
+/* Chrome trace event format, load in chrome://tracing or Perfetto. The GPU
+ * has no common clock with the CPU here, so each frame's GPU scopes are
+ * placed relative to the start of its submit. */
+void profile_export_trace(struct profile *p, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "warning: failed to open %s\n", path);
+        return;
+    }
+
+    bool first = true;
+    fprintf(f, "{\"traceEvents\":[");
+    for (uint64_t i = profile_first(p); i < p->historyc; i++) {
+        const struct profile_record *rec = &p->history[i % PROFILE_HISTORY];
+        for (int j = 0; j < PROFILE_CPU_COUNT; j++) {
+            trace_event(f, &first, cpu_names[j], 1,
+                        rec->cpu_start[j], rec->cpu[j]);
+        }
+        for (int j = 0; rec->gpu_valid && j < PROFILE_GPU_COUNT; j++) {
+            if (!(p->gpu_scopes & PROFILE_GPU_BIT(j)))
+                continue;
+            double base = rec->cpu_start[PROFILE_CPU_SUBMIT];
+            trace_event(f, &first, gpu_names[j], 2,
+                        base + rec->gpu_start[j], rec->gpu[j]);
+        }
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    fclose(f);
+    printf("wrote trace to %s\n", path);
+}
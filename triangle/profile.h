@@ -0,0 +1,142 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vulkan/vulkan.h>
+
+/* Frame profiler. CPU phases are timed with CLOCK_MONOTONIC, GPU scopes with
+ * timestamp queries written into the frame's command buffers. Queries are
+ * kept per frame in flight slot and only read back once the slot's frame
+ * has been waited on, i.e. a full set of frames in flight late, so reading
+ * them never stalls.
+ *
+ * Latency runs from the point a frame samples its input to the CPU seeing
+ * the frame's timeline value signaled. That is where a frame's submission
+ * is known to be done; the time until scan out is not visible without
+ * present timing extensions, so the figure is a lower bound on what is seen
+ * on screen when GPU bound and somewhat late when the value was already
+ * signaled. */
+
+#define PROFILE_MAX_SLOTS 4
+#define PROFILE_HISTORY 8192
+
+enum profile_cpu {
+    PROFILE_CPU_WAIT,
+    PROFILE_CPU_PACE,
+    PROFILE_CPU_ACQUIRE,
+    PROFILE_CPU_UBO,
+    PROFILE_CPU_RECORD,
+    PROFILE_CPU_SUBMIT,
+    PROFILE_CPU_PRESENT,
+    PROFILE_CPU_COUNT
+};
+
+enum profile_gpu {
+    PROFILE_GPU_FRAME,
+    PROFILE_GPU_CULL,
+    PROFILE_GPU_RENDERPASS,
+    PROFILE_GPU_COUNT
+};
+#define PROFILE_GPU_BIT(which) (1u << (which))
+#define PROFILE_GPU_ALL (PROFILE_GPU_BIT(PROFILE_GPU_COUNT) - 1)
+
+enum profile_stat {
+    PROFILE_STAT_IA_VERTICES,
+    PROFILE_STAT_IA_PRIMITIVES,
+    PROFILE_STAT_VS_INVOCATIONS,
+    PROFILE_STAT_CLIP_PRIMITIVES,
+    PROFILE_STAT_FS_INVOCATIONS,
+    PROFILE_STAT_COUNT
+};
+
+/* times in ms, starts relative to profile_init() */
+struct profile_record {
+    uint64_t frame;
+    double start;
+    double cpu_start[PROFILE_CPU_COUNT];
+    double cpu[PROFILE_CPU_COUNT];
+    double gpu_start[PROFILE_GPU_COUNT];
+    double gpu[PROFILE_GPU_COUNT];
+    bool gpu_valid;
+    uint64_t stats[PROFILE_STAT_COUNT];
+    bool stats_valid;
+    double input;
+    double latency;
+    bool latency_valid;
+};
+
+struct profile_slot {
+    struct profile_record rec;
+    bool pending; /* submitted, queries not yet read */
+};
+
+struct profile {
+    VkDevice device;
+    VkQueryPool timestamps;
+    VkQueryPool statistics;
+    VkQueryPipelineStatisticFlags statistic_flags;
+    double ns_per_tick;
+    uint32_t gpu_scopes; /* PROFILE_GPU_BIT()s timed */
+    /* valid bits of the family writing each scope */
+    uint64_t tick_masks[PROFILE_GPU_COUNT];
+    uint32_t slotc;
+    double epoch;
+
+    struct profile_record current;
+    struct profile_slot slots[PROFILE_MAX_SLOTS];
+
+    struct profile_record *history; /* ring of the last PROFILE_HISTORY */
+    uint64_t historyc;
+};
+
+/* Without timestamps no GPU scopes are timed at all. The cull scope is
+ * written on compute_family, family when culling runs there as well, and
+ * is not timed if that family has no timestamps. */
+void profile_init(struct profile *p, VkDevice device,
+                  VkPhysicalDevice physical, uint32_t family,
+                  uint32_t compute_family, uint32_t slotc, bool timestamps,
+                  bool statistics);
+void profile_destroy(struct profile *p);
+
+double profile_now(void);
+
+void profile_frame_begin(struct profile *p, uint64_t frame);
+void profile_frame_end(struct profile *p, uint32_t slot);
+void profile_cpu_begin(struct profile *p, enum profile_cpu which);
+void profile_cpu_end(struct profile *p, enum profile_cpu which);
+/* the frame has sampled its input */
+void profile_input(struct profile *p);
+
+/* Command buffer side, reset must be recorded outside a render pass and
+ * ahead of the scopes' queries on the queue that writes them, scopes is a
+ * mask of PROFILE_GPU_BIT()s. Statistics are reset with the render pass
+ * scope they run alongside. */
+void profile_cmd_reset(struct profile *p, VkCommandBuffer cb, uint32_t slot,
+                       uint32_t scopes);
+void profile_cmd_begin(struct profile *p, VkCommandBuffer cb, uint32_t slot,
+                       enum profile_gpu which);
+void profile_cmd_end(struct profile *p, VkCommandBuffer cb, uint32_t slot,
+                     enum profile_gpu which);
+void profile_cmd_stats_begin(struct profile *p, VkCommandBuffer cb,
+                             uint32_t slot);
+void profile_cmd_stats_end(struct profile *p, VkCommandBuffer cb,
+                           uint32_t slot);
+
+/* call once the slot's previous submission is known to be complete */
+void profile_collect(struct profile *p, uint32_t slot);
+/* collect every pending slot, the device must be idle */
+void profile_flush(struct profile *p);
+const struct profile_record *profile_latest(struct profile *p);
+
+void profile_summary(struct profile *p);
+/* min/avg/p99 frame times and throughput, skipping the first warmup
+ * frames, also written to out as "metric value" lines unless NULL */
+void profile_benchmark(struct profile *p, uint64_t warmup,
+                       uint32_t width, uint32_t height, FILE *out);
+void profile_export_csv(struct profile *p, const char *path);
+void profile_export_trace(struct profile *p, const char *path);
+
+#endif
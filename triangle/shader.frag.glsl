@@ -1,10 +1,33 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+/* built a second time with -DBINDLESS as bindless.frag.spv */
+#ifdef BINDLESS
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(push_constant) uniform draw_push {
+    mat4 model;
+    vec4 scale;
+    vec4 min;
+    uint object;
+    uint image;
+} draw;
+
+layout(set = 1, binding = 0) uniform sampler2D textures[];
+
+/* pipeline variant feature, see variants.h */
+layout(constant_id = 1) const bool TEXTURED = true;
+#endif
+
 layout(location = 0) in vec4 col_frag;
+layout(location = 1) in vec2 uv_frag;
 
 layout(location = 0) out vec4 col_out;
 
 void main() {
     col_out = col_frag;
+#ifdef BINDLESS
+    if (TEXTURED)
+        col_out *= texture(textures[nonuniformEXT(draw.image)], uv_frag);
+#endif
 }
@@ -1,18 +1,59 @@
 #version 450    
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "vertex.h"
 
 layout(binding = 0) uniform buffer_object {
-    mat4 model;
     mat4 view;
     mat4 proj;
 } ubo;
 
-layout(location = 0) in vec2 pos;
-layout(location = 1) in vec4 col;
+layout(push_constant) uniform draw_push {
+    mat4 model;
+    vec4 scale;
+    vec4 min;
+    uint object;
+    uint image;
+} draw;
+
+#define VERTEX_INPUT(name, loc, type, count, fmt, glsl, encoding) \
+    layout(location = loc) in glsl name;
+VERTEX_ATTRIBUTES(VERTEX_INPUT)
+layout(location = VERTEX_LOCATIONS) in mat4 inst_model;
+layout(location = VERTEX_LOCATIONS + 4) in vec4 inst_col;
 
 layout(location = 0) out vec4 col_frag;
+layout(location = 1) out vec2 uv_frag;
+
+/* the pre-pass and shading pipelines must agree on depth exactly */
+invariant gl_Position;
+
+/* pipeline variant features, see variants.h */
+layout(constant_id = 0) const bool LIT = true;
+
+const vec3 LIGHT = normalize(vec3(1.0, 0.5, 2.0));
+
+/* inverse of the octahedral mapping in mesh.c */
+vec3 octahedral(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(pos, 0.0, 1.0);
-    col_frag = col;
+    vec3 model_pos = draw.min.xyz + pos*draw.scale.xyz;
+    gl_Position = ubo.proj * ubo.view * inst_model * draw.model
+                * vec4(model_pos, 1.0);
+    float light = 1.0;
+    if (LIT) {
+        vec3 n = normalize(mat3(inst_model) * mat3(draw.model)
+                         * octahedral(normal));
+        light = 0.4 + 0.6*max(dot(n, LIGHT), 0.0);
+    }
+    col_frag = vec4(col.rgb*light, col.a) * inst_col;
+    /* planar over the bounding box until meshes carry coordinates */
+    uv_frag = pos.xy;
 }
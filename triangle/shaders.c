@@ -0,0 +1,176 @@
+#include "shaders.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc.h"
+#include "util.h"
+
+#define SPIRV_MAGIC 0x07230203
+
+static uint64_t fnv1a(const void *data, size_t size) {
+    const unsigned char *p = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void *shader_map(const char *path, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return NULL;
+    *size = st.st_size;
+    return data;
+}
+
+/* a file caught halfway through being written fails these checks */
+static bool shader_load(struct shader_cache *sc, struct shader *s,
+                        VkShaderModule *module) {
+    size_t size;
+    const uint32_t *code = shader_map(s->path, &size);
+    if (!code) {
+        fprintf(stderr, "warning: failed to map %s\n", s->path);
+        return false;
+    }
+    s->hash = fnv1a(code, size);
+
+    bool ok = size % 4 == 0 && size >= 20 && code[0] == SPIRV_MAGIC;
+    if (!ok) {
+        fprintf(stderr, "warning: %s is not spir-v\n", s->path);
+    } else {
+        VkShaderModuleCreateInfo create_info = {
+            .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+            .codeSize = size,
+            .pCode = code,
+        };
+        ok = vkCreateShaderModule(sc->device, &create_info, vk_allocator,
+                                  module) == VK_SUCCESS;
+        if (!ok)
+            fprintf(stderr, "warning: failed to create shader module for "
+                    "%s\n", s->path);
+    }
+    munmap((void*)code, size);
+    return ok;
+}
+
+void shader_cache_init(struct shader_cache *sc, VkDevice device) {
+    sc->device = device;
+    sc->shaders = NULL;
+    sc->count = sc->cap = 0;
+    sc->retired = NULL;
+    sc->retiredc = sc->retired_cap = 0;
+    pthread_mutex_init(&sc->lock, NULL);
+}
+
+void shader_cache_destroy(struct shader_cache *sc) {
+    shader_cache_collect(sc);
+    host_free(sc->retired);
+    for (uint32_t i = 0; i < sc->count; i++) {
+        vkDestroyShaderModule(sc->device, sc->shaders[i].module, vk_allocator);
+        host_free(sc->shaders[i].path);
+    }
+    host_free(sc->shaders);
+    pthread_mutex_destroy(&sc->lock);
+}
+
+static struct shader *shader_find(struct shader_cache *sc,
+                                  const char *path) {
+    for (uint32_t i = 0; i < sc->count; i++) {
+        if (strcmp(sc->shaders[i].path, path) == 0)
+            return &sc->shaders[i];
+    }
+    return NULL;
+}
+
+/* pipelines already built keep working without the module they were
+ * built from, but one being built on another thread may have been handed
+ * the old module just before, so it is retired rather than destroyed */
+VkShaderModule shader_module(struct shader_cache *sc, const char *path) {
+    pthread_mutex_lock(&sc->lock);
+    struct shader *s = shader_find(sc, path);
+    if (!s) {
+        if (sc->count == sc->cap) {
+            sc->cap = sc->cap ? sc->cap*2 : 8;
+            sc->shaders = host_realloc(sc->shaders,
+                                       sc->cap*sizeof(*sc->shaders));
+        }
+        s = &sc->shaders[sc->count];
+        s->path = host_realloc(NULL, strlen(path) + 1);
+        strcpy(s->path, path);
+        s->stale = false;
+        if (!shader_load(sc, s, &s->module))
+            die("failed to load shader %s", path);
+        sc->count++;
+    } else if (s->stale) {
+        VkShaderModule module;
+        if (shader_load(sc, s, &module)) {
+            if (sc->retiredc == sc->retired_cap) {
+                uint32_t cap = sc->retired_cap ? sc->retired_cap*2 : 8;
+                sc->retired = host_realloc(sc->retired,
+                                           cap*sizeof(*sc->retired));
+                sc->retired_cap = cap;
+            }
+            sc->retired[sc->retiredc++] = s->module;
+            s->module = module;
+        }
+        s->stale = false;
+    }
+    VkShaderModule module = s->module;
+    pthread_mutex_unlock(&sc->lock);
+    return module;
+}
+
+void shader_cache_collect(struct shader_cache *sc) {
+    pthread_mutex_lock(&sc->lock);
+    for (uint32_t i = 0; i < sc->retiredc; i++) {
+        vkDestroyShaderModule(sc->device, sc->retired[i], vk_allocator);
+    }
+    sc->retiredc = 0;
+    pthread_mutex_unlock(&sc->lock);
+}
+
+uint32_t shader_cache_poll(struct shader_cache *sc) {
+    pthread_mutex_lock(&sc->lock);
+    uint32_t stalec = 0;
+    for (uint32_t i = 0; i < sc->count; i++) {
+        struct shader *s = &sc->shaders[i];
+        size_t size;
+        void *data = shader_map(s->path, &size);
+        if (data) {
+            uint64_t hash = fnv1a(data, size);
+            munmap(data, size);
+            if (hash != s->hash) {
+                s->hash = hash;
+                s->stale = true;
+            }
+        }
+        stalec += s->stale;
+    }
+    pthread_mutex_unlock(&sc->lock);
+    return stalec;
+}
+
+bool shader_stale(struct shader_cache *sc, const char *path) {
+    pthread_mutex_lock(&sc->lock);
+    struct shader *s = shader_find(sc, path);
+    bool stale = s && s->stale;
+    pthread_mutex_unlock(&sc->lock);
+    return stale;
+}
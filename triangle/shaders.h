@@ -0,0 +1,50 @@
+#ifndef SHADERS_H
+#define SHADERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+
+/* Shader modules created once per SPIR-V file, which is mapped rather than
+ * read. Entries are keyed by path and remember a hash of the contents, so
+ * a file that is only touched or rewritten unchanged keeps its module.
+ * Modules are requested from pipeline build jobs, hence the lock. */
+
+struct shader {
+    char *path;
+    uint64_t hash; /* FNV-1a of the contents last seen */
+    bool stale; /* contents changed since the module was created */
+    VkShaderModule module;
+};
+
+struct shader_cache {
+    VkDevice device;
+    pthread_mutex_t lock;
+    struct shader *shaders;
+    uint32_t count, cap;
+    /* replaced modules, a build may still be using them */
+    VkShaderModule *retired;
+    uint32_t retiredc, retired_cap;
+};
+
+void shader_cache_init(struct shader_cache *sc, VkDevice device);
+void shader_cache_destroy(struct shader_cache *sc);
+
+/* The module for path, created on first use and recreated once stale.
+ * Dies if the first load fails; a failed reload warns and keeps the old
+ * module. */
+VkShaderModule shader_module(struct shader_cache *sc, const char *path);
+/* destroy the modules replaced so far, once no pipeline build that may
+ * have been given one is running */
+void shader_cache_collect(struct shader_cache *sc);
+
+/* Hash every file again and mark those whose contents changed as stale,
+ * returns the number of stale shaders. SPIR-V files are small enough that
+ * this is cheaper than reliably telling edits apart by mtime. */
+uint32_t shader_cache_poll(struct shader_cache *sc);
+bool shader_stale(struct shader_cache *sc, const char *path);
+
+#endif
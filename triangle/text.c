@@ -0,0 +1,436 @@
+#include "text.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "util.h"
+
+#define PSF2_HEADER_SIZE 32
+static const unsigned char PSF2_MAGIC[] = {0x72, 0xb5, 0x4a, 0x86};
+
+static uint32_t read_u32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Glyph rows are padded to whole bytes with the leftmost pixel in the top
+ * bit, each bit becomes a byte of the atlas as in obj/types.rs. */
+void font_load_psf2(struct font *f, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        die("failed to open %s", path);
+    unsigned char header[PSF2_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+        memcmp(header, PSF2_MAGIC, sizeof(PSF2_MAGIC)) != 0)
+        die("%s: not a psf2 font", path);
+    uint32_t headersize = read_u32(header + 8);
+    uint32_t length = read_u32(header + 16);
+    uint32_t charsize = read_u32(header + 20);
+    uint32_t height = read_u32(header + 24);
+    uint32_t width = read_u32(header + 28);
+    uint32_t row_bytes = (width + 7) / 8;
+    if (length == 0 || width == 0 || height == 0 || length > UINT16_MAX ||
+        charsize < row_bytes*height)
+        die("%s: malformed psf2 header", path);
+
+    unsigned char *bits = malloc((size_t)length*charsize);
+    if (!bits)
+        die("out of memory");
+    if (fseek(file, headersize, SEEK_SET) != 0 ||
+        fread(bits, charsize, length, file) != length)
+        die("%s: truncated glyphs", path);
+    fclose(file);
+
+    f->glyphc = length;
+    f->width = width;
+    f->height = height;
+    f->atlas_width = TEXT_ATLAS_COLUMNS*width;
+    f->atlas_height = (length + TEXT_ATLAS_COLUMNS - 1) / TEXT_ATLAS_COLUMNS
+                      * height;
+    f->pixels = calloc((size_t)f->atlas_width*f->atlas_height, 1);
+    if (!f->pixels)
+        die("out of memory");
+    for (uint32_t g = 0; g < length; g++) {
+        uint32_t x0 = g % TEXT_ATLAS_COLUMNS * width;
+        uint32_t y0 = g / TEXT_ATLAS_COLUMNS * height;
+        for (uint32_t y = 0; y < height; y++) {
+            const unsigned char *row = bits + g*charsize + y*row_bytes;
+            unsigned char *out = f->pixels + (y0 + y)*f->atlas_width + x0;
+            for (uint32_t x = 0; x < width; x++) {
+                out[x] = (row[x / 8] >> (7 - x % 8) & 1) ? 255 : 0;
+            }
+        }
+    }
+    free(bits);
+}
+
+void font_release(struct font *f) {
+    free(f->pixels);
+    f->pixels = NULL;
+}
+
+static void text_atlas(struct text *t, struct mem_allocator *ma,
+                       struct upload_queue *uq, const struct font *font,
+                       uint32_t familyc, const uint32_t *families) {
+    VkFormat format = VK_FORMAT_R8_UNORM;
+    VkImageCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent = { font->atlas_width, font->atlas_height, 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                 VK_IMAGE_USAGE_SAMPLED_BIT,
+        .sharingMode = familyc > 1 ? VK_SHARING_MODE_CONCURRENT
+                                   : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = familyc > 1 ? familyc : 0,
+        .pQueueFamilyIndices = families,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    if (vkCreateImage(t->device, &create_info, vk_allocator, &t->atlas)
+            != VK_SUCCESS)
+        die("failed to create glyph atlas");
+    VkMemoryRequirements reqs;
+    vkGetImageMemoryRequirements(t->device, t->atlas, &reqs);
+    mem_alloc(ma, reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+              &t->atlas_mem);
+    vkBindImageMemory(t->device, t->atlas, t->atlas_mem.memory,
+                      t->atlas_mem.offset);
+
+    VkImageViewCreateInfo view_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = t->atlas,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = format,
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+    };
+    if (vkCreateImageView(t->device, &view_info, vk_allocator, &t->atlas_view)
+            != VK_SUCCESS)
+        die("failed to create glyph atlas view");
+
+    VkExtent2D extent = {font->atlas_width, font->atlas_height};
+    upload_image(uq, t->atlas, extent, font->pixels,
+                 (VkDeviceSize)extent.width*extent.height);
+}
+
+/* one combined image sampler for the atlas, fonts are drawn unfiltered at
+ * whole multiples of their size */
+static void text_descriptors(struct text *t) {
+    VkSamplerCreateInfo sampler_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_NEAREST,
+        .minFilter = VK_FILTER_NEAREST,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .maxLod = 0,
+    };
+    if (vkCreateSampler(t->device, &sampler_info, vk_allocator, &t->sampler)
+            != VK_SUCCESS)
+        die("failed to create glyph sampler");
+
+    VkDescriptorSetLayoutBinding binding = {
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .pImmutableSamplers = &t->sampler,
+    };
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindings = &binding,
+    };
+    if (vkCreateDescriptorSetLayout(t->device, &layout_info, vk_allocator,
+                                    &t->set_layout) != VK_SUCCESS)
+        die("failed to create text descriptor set layout");
+
+    VkDescriptorPoolSize size = {
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1
+    };
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .maxSets = 1,
+        .poolSizeCount = 1,
+        .pPoolSizes = &size,
+    };
+    if (vkCreateDescriptorPool(t->device, &pool_info, vk_allocator, &t->pool)
+            != VK_SUCCESS)
+        die("failed to create text descriptor pool");
+
+    VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = t->pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &t->set_layout,
+    };
+    if (vkAllocateDescriptorSets(t->device, &alloc_info, &t->set)
+            != VK_SUCCESS)
+        die("failed to allocate text descriptor set");
+
+    VkDescriptorImageInfo image_info = {
+        .imageView = t->atlas_view,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+    VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = t->set,
+        .dstBinding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .pImageInfo = &image_info,
+    };
+    vkUpdateDescriptorSets(t->device, 1, &write, 0, NULL);
+
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .offset = 0,
+        .size = sizeof(struct text_push),
+    };
+    VkPipelineLayoutCreateInfo pipeline_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &t->set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range,
+    };
+    if (vkCreatePipelineLayout(t->device, &pipeline_layout_info, vk_allocator,
+                               &t->layout) != VK_SUCCESS)
+        die("failed to create text pipeline layout");
+}
+
+void text_init(struct text *t, struct mem_allocator *ma,
+               struct upload_queue *uq, const struct font *font,
+               uint32_t slotc, uint32_t familyc, const uint32_t *families) {
+    memset(t, 0, sizeof(*t));
+    t->device = ma->device;
+    t->glyphc = font->glyphc;
+    t->width = font->width;
+    t->height = font->height;
+    t->push = (struct text_push){
+        .cell = {(float)font->width / font->atlas_width,
+                 (float)font->height / font->atlas_height},
+        .glyph = {font->width, font->height},
+        .columns = TEXT_ATLAS_COLUMNS,
+    };
+    text_atlas(t, ma, uq, font, familyc, families);
+    text_descriptors(t);
+
+    t->stride = TEXT_MAX_GLYPHS*sizeof(struct text_glyph);
+    mem_buffer_create(ma, slotc*t->stride, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                      familyc, families, &t->buf, &t->buf_mem);
+    text_begin(t, 0);
+}
+
+void text_destroy(struct text *t, struct mem_allocator *ma) {
+    mem_buffer_destroy(ma, t->buf, &t->buf_mem);
+    vkDestroyPipelineLayout(t->device, t->layout, vk_allocator);
+    vkDestroyDescriptorPool(t->device, t->pool, vk_allocator);
+    vkDestroyDescriptorSetLayout(t->device, t->set_layout, vk_allocator);
+    vkDestroySampler(t->device, t->sampler, vk_allocator);
+    vkDestroyImageView(t->device, t->atlas_view, vk_allocator);
+    vkDestroyImage(t->device, t->atlas, vk_allocator);
+    mem_free(ma, &t->atlas_mem);
+}
+
+/* the corners of each glyph come from the vertex index of a strip */
+void text_pipeline(struct text *t, struct shader_cache *shaders,
+                   VkPipelineCache cache, VkRenderPass renderpass,
+                   uint32_t subpass, const char *vert_path,
+                   const char *frag_path, VkPipeline *pipeline) {
+    VkPipelineShaderStageCreateInfo shader_stages[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = shader_module(shaders, vert_path),
+            .pName = "main",
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .module = shader_module(shaders, frag_path),
+            .pName = "main",
+        }
+    };
+
+    VkVertexInputBindingDescription bind_desc = {
+        .binding = 0,
+        .stride = sizeof(struct text_glyph),
+        .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
+    };
+    VkVertexInputAttributeDescription attr_descs[] = {
+        {
+            .binding = 0,
+            .location = 0,
+            .format = VK_FORMAT_R16G16_SINT,
+            .offset = offsetof(struct text_glyph, x)
+        },
+        {
+            .binding = 0,
+            .location = 1,
+            .format = VK_FORMAT_R16G16_UINT,
+            .offset = offsetof(struct text_glyph, glyph)
+        },
+        {
+            .binding = 0,
+            .location = 2,
+            .format = VK_FORMAT_R8G8B8A8_UNORM,
+            .offset = offsetof(struct text_glyph, color)
+        }
+    };
+    VkPipelineVertexInputStateCreateInfo vertex_input = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = 1,
+        .pVertexBindingDescriptions = &bind_desc,
+        .vertexAttributeDescriptionCount =
+            sizeof(attr_descs)/sizeof(*attr_descs),
+        .pVertexAttributeDescriptions = attr_descs
+    };
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP,
+    };
+    VkPipelineViewportStateCreateInfo viewport_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .scissorCount = 1,
+    };
+    VkPipelineRasterizationStateCreateInfo rasterizer = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .cullMode = VK_CULL_MODE_NONE,
+        .frontFace = VK_FRONT_FACE_CLOCKWISE,
+        .lineWidth = 1
+    };
+    VkPipelineMultisampleStateCreateInfo multisampling = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+        .minSampleShading = 1,
+    };
+    VkPipelineColorBlendAttachmentState blend_attachment = {
+        .blendEnable = VK_TRUE,
+        .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+        .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+        .colorBlendOp = VK_BLEND_OP_ADD,
+        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+        .alphaBlendOp = VK_BLEND_OP_ADD,
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
+    };
+    VkPipelineColorBlendStateCreateInfo blending = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &blend_attachment,
+    };
+    VkDynamicState dyn_states[] = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR
+    };
+    VkPipelineDynamicStateCreateInfo dyn_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = sizeof(dyn_states)/sizeof(*dyn_states),
+        .pDynamicStates = dyn_states,
+    };
+
+    /* the subpass has no depth attachment */
+    VkGraphicsPipelineCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .stageCount = 2,
+        .pStages = shader_stages,
+        .pVertexInputState = &vertex_input,
+        .pInputAssemblyState = &input_assembly,
+        .pViewportState = &viewport_state,
+        .pRasterizationState = &rasterizer,
+        .pMultisampleState = &multisampling,
+        .pColorBlendState = &blending,
+        .pDynamicState = &dyn_state,
+        .layout = t->layout,
+        .renderPass = renderpass,
+        .subpass = subpass,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1
+    };
+    if (vkCreateGraphicsPipelines(t->device, cache, 1, &create_info,
+                                  vk_allocator, pipeline) != VK_SUCCESS)
+        die("failed to create text pipeline");
+}
+
+void text_begin(struct text *t, uint32_t slot) {
+    t->slot = slot;
+    t->glyphs = (struct text_glyph*)((char*)t->buf_mem.mapped +
+                                     slot*t->stride);
+    t->count = 0;
+}
+
+int32_t text_print(struct text *t, int32_t x, int32_t y, uint32_t scale,
+                   uint32_t color, const char *s) {
+    int32_t left = x;
+    int32_t line = t->height*scale;
+    uint16_t missing = '?' < t->glyphc ? '?' : 0;
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '\n') {
+            x = left;
+            y += line;
+            continue;
+        }
+        if (c != ' ' && t->count < TEXT_MAX_GLYPHS)
+            t->glyphs[t->count++] = (struct text_glyph){
+                .x = x,
+                .y = y,
+                .glyph = c < t->glyphc ? c : missing,
+                .scale = scale,
+                .color = color,
+            };
+        x += t->width*scale;
+    }
+    return y + line;
+}
+
+/* formatted on the stack, lines of a HUD are short */
+int32_t text_printf(struct text *t, int32_t x, int32_t y, uint32_t scale,
+                    uint32_t color, const char *fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    return text_print(t, x, y, scale, color, buf);
+}
+
+void text_record(struct text *t, VkCommandBuffer cb, VkPipeline pipeline,
+                 VkExtent2D extent) {
+    if (t->count == 0)
+        return;
+    vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    VkViewport viewport = {
+        .width = extent.width,
+        .height = extent.height,
+        .minDepth = 0,
+        .maxDepth = 1
+    };
+    VkRect2D scissor = { .offset = {0, 0}, .extent = extent };
+    vkCmdSetViewport(cb, 0, 1, &viewport);
+    vkCmdSetScissor(cb, 0, 1, &scissor);
+
+    VkDeviceSize offset = t->slot*t->stride;
+    vkCmdBindVertexBuffers(cb, 0, 1, &t->buf, &offset);
+    vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, t->layout,
+                            0, 1, &t->set, 0, NULL);
+    t->push.screen[0] = extent.width;
+    t->push.screen[1] = extent.height;
+    vkCmdPushConstants(cb, t->layout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                       sizeof(t->push), &t->push);
+    vkCmdDraw(cb, 4, t->count, 0, 0);
+}
@@ -0,0 +1,13 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec2 uv_frag;
+layout(location = 1) in vec4 col_frag;
+
+layout(location = 0) out vec4 col_out;
+
+layout(binding = 0) uniform sampler2D atlas;
+
+void main() {
+    col_out = vec4(col_frag.rgb, col_frag.a * texture(atlas, uv_frag).r);
+}
@@ -0,0 +1,97 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+#include "mem.h"
+#include "shaders.h"
+#include "upload.h"
+
+/* Text drawn from a glyph atlas. Every string of a frame is written as
+ * one instance per glyph straight into a persistently mapped buffer, with
+ * a slot per frame in flight, and all of it is drawn with one instanced
+ * draw of a quad. Strings cost neither allocations nor draws of their own,
+ * however many there are. Fonts are PC screen fonts version 2, glyphs
+ * are picked by byte value as the unicode table is ignored. */
+
+#define TEXT_MAX_GLYPHS 4096 /* per frame */
+#define TEXT_ATLAS_COLUMNS 16
+
+/* glyphs in rows of TEXT_ATLAS_COLUMNS, a byte per pixel */
+struct font {
+    uint32_t glyphc;
+    uint32_t width, height; /* of a glyph */
+    uint32_t atlas_width, atlas_height;
+    unsigned char *pixels;
+};
+
+/* must match the vertex inputs of text.vert.glsl */
+struct text_glyph {
+    int16_t x, y; /* top left corner in pixels */
+    uint16_t glyph;
+    uint16_t scale; /* pixels per font pixel */
+    uint32_t color; /* RGBA8, red in the lowest byte */
+};
+
+struct text_push {
+    float screen[2]; /* pixels */
+    float cell[2]; /* size of a glyph in atlas coordinates */
+    uint32_t glyph[2]; /* pixels */
+    uint32_t columns;
+};
+
+struct text {
+    VkDevice device;
+    uint32_t glyphc, width, height; /* of the font */
+    VkImage atlas;
+    struct mem_alloc atlas_mem;
+    VkImageView atlas_view;
+    VkSampler sampler;
+    VkDescriptorSetLayout set_layout;
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+    VkPipelineLayout layout;
+    struct text_push push; /* the screen is set when recording */
+
+    VkBuffer buf;
+    struct mem_alloc buf_mem; /* mapped, a slot per frame */
+    VkDeviceSize stride;
+    uint32_t slot;
+    struct text_glyph *glyphs; /* the slot's */
+    uint32_t count; /* written this frame */
+};
+
+/* dies if the file cannot be read or is not a psf2 font */
+void font_load_psf2(struct font *f, const char *path);
+void font_release(struct font *f);
+
+/* The atlas is uploaded through uq and shared by the families, the font
+ * may be released afterwards. */
+void text_init(struct text *t, struct mem_allocator *ma,
+               struct upload_queue *uq, const struct font *font,
+               uint32_t slotc, uint32_t familyc, const uint32_t *families);
+void text_destroy(struct text *t, struct mem_allocator *ma);
+
+/* alpha blended over a single sampled color attachment */
+void text_pipeline(struct text *t, struct shader_cache *shaders,
+                   VkPipelineCache cache, VkRenderPass renderpass,
+                   uint32_t subpass, const char *vert_path,
+                   const char *frag_path, VkPipeline *pipeline);
+
+/* start the frame's text in a slot no frame in flight reads */
+void text_begin(struct text *t, uint32_t slot);
+/* Append s with its top left corner at x, y in pixels, newlines going a
+ * line down. Glyphs beyond TEXT_MAX_GLYPHS are dropped. Returns the y of
+ * the line after the last. */
+int32_t text_print(struct text *t, int32_t x, int32_t y, uint32_t scale,
+                   uint32_t color, const char *s);
+int32_t text_printf(struct text *t, int32_t x, int32_t y, uint32_t scale,
+                    uint32_t color, const char *fmt, ...);
+/* draw the frame's text over the whole of extent */
+void text_record(struct text *t, VkCommandBuffer cb, VkPipeline pipeline,
+                 VkExtent2D extent);
+
+#endif
@@ -0,0 +1,29 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+/* one instance per glyph, see struct text_glyph in text.h */
+layout(location = 0) in ivec2 pos;
+layout(location = 1) in uvec2 glyph_scale;
+layout(location = 2) in vec4 col;
+
+layout(push_constant) uniform text_push {
+    vec2 screen;
+    vec2 cell;
+    uvec2 glyph;
+    uint columns;
+} text;
+
+layout(location = 0) out vec2 uv_frag;
+layout(location = 1) out vec4 col_frag;
+
+void main() {
+    /* the corners of a strip of two triangles */
+    vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+    vec2 p = vec2(pos) + corner*vec2(text.glyph)*float(glyph_scale.y);
+    gl_Position = vec4(p / text.screen * 2.0 - 1.0, 0.0, 1.0);
+
+    uint glyph = glyph_scale.x;
+    vec2 cell = vec2(glyph % text.columns, glyph / text.columns);
+    uv_frag = (cell + corner) * text.cell;
+    col_frag = col;
+}
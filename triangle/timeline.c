@@ -0,0 +1,52 @@
+#include "timeline.h"
+
+#include "alloc.h"
+#include "util.h"
+
+void timeline_init(struct timeline *t, VkDevice device) {
+    t->device = device;
+    t->last = 0;
+
+    VkSemaphoreTypeCreateInfo type_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0
+    };
+    VkSemaphoreCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &type_info
+    };
+    if (vkCreateSemaphore(device, &create_info, vk_allocator, &t->semaphore)
+            != VK_SUCCESS)
+        die("failed to create timeline semaphore");
+}
+
+void timeline_destroy(struct timeline *t) {
+    vkDestroySemaphore(t->device, t->semaphore, vk_allocator);
+}
+
+uint64_t timeline_next(struct timeline *t) {
+    return ++t->last;
+}
+
+uint64_t timeline_completed(struct timeline *t) {
+    uint64_t value;
+    if (vkGetSemaphoreCounterValue(t->device, t->semaphore, &value)
+            != VK_SUCCESS)
+        die("failed to read timeline semaphore");
+    return value;
+}
+
+void timeline_wait(struct timeline *t, uint64_t value) {
+    VkSemaphoreWaitInfo wait_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &t->semaphore,
+        .pValues = &value
+    };
+    /* anything but success here is a lost device */
+    VkResult res = vkWaitSemaphores(t->device, &wait_info, UINT64_MAX);
+    if (res != VK_SUCCESS)
+        die("failed to wait for timeline value %llu (%d)",
+            (unsigned long long)value, res);
+}
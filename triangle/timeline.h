@@ -0,0 +1,29 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stdint.h>
+
+#include <vulkan/vulkan.h>
+
+/* GPU progress on one queue as a single increasing value. Every submission
+ * signals the next value, so "done with everything up to submission n" is
+ * one number that can be waited on from the host or from another queue's
+ * submission, and retiring work is a comparison against it. */
+
+struct timeline {
+    VkDevice device;
+    VkSemaphore semaphore;
+    uint64_t last; /* last value handed out to a submission */
+};
+
+void timeline_init(struct timeline *t, VkDevice device);
+void timeline_destroy(struct timeline *t);
+
+/* value for the next submission to signal */
+uint64_t timeline_next(struct timeline *t);
+/* latest value signaled by the gpu, never blocks */
+uint64_t timeline_completed(struct timeline *t);
+/* block until value has been signaled */
+void timeline_wait(struct timeline *t, uint64_t value);
+
+#endif
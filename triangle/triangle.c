@@ -1,7 +1,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <math.h>
+#include <string.h>
 
+#include <pthread.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -9,62 +12,334 @@
 #include <SDL2/SDL_vulkan.h>
 #include <vulkan/vulkan.h>
 
+#include "alloc.h"
+#include "bindless.h"
+#include "defer.h"
+#include "entity.h"
+#include "graph.h"
+#include "jobs.h"
 #include "linear.h"
+#include "mem.h"
+#include "mesh.h"
+#include "meshopt.h"
+#include "profile.h"
+#include "shaders.h"
+#include "text.h"
+#include "timeline.h"
+#include "upload.h"
+#include "util.h"
+#include "variants.h"
 
 #define APP_NAME "VULKAN_TEST"
 
+#define PIPELINE_CACHE_PATH "triangle/pipeline.cache"
+
+/* most frames in flight, the present policy picks the actual count */
 #define CONCURRENT_FRAMES 3
 #define FOV 1.0
+#define NEAR 0.1
+
+#define MAX_INSTANCES 65536
+
+/* instances culled per workgroup and drawn per indirect command, must
+ * match local_size_x in cull.comp.glsl */
+#define CULL_BATCH 256
+#define CULL_MAX_BATCHES (MAX_INSTANCES/CULL_BATCH)
+#define CULL_COMPACT 1 /* commands compacted, drawn with a gpu count */
+#define CULL_FIRST_INSTANCE 2 /* commands may use firstInstance */
+/* draw count followed by the commands in each slot of the draw buffer */
+#define CULL_DRAWS_OFFSET 4
+
+/* threads recording secondary command buffers, each gets a slice of the
+ * cull batches */
+#define MAX_RECORDERS 16
+/* depth pre-pass and shading */
+#define MAX_SUBPASSES 2
+
+/* how often watch mode checks the shaders for changes, in ms */
+#define RELOAD_PERIOD 250
+
+/* dynamic resolution never draws at less than this scale per axis, and
+ * moves only this fraction of the way to the scale it aims for per frame */
+#define DYNRES_MIN_SCALE 0.5
+#define DYNRES_GAIN 0.25
+
+/* the overlay's font is doubled from this height of the image on up, and
+ * its frame time smoothed by this factor per frame */
+#define HUD_DOUBLE_HEIGHT 1200
+#define HUD_SMOOTHING 0.05
+
+/* host arenas in bytes: what lives as long as the renderer, what is
+ * replaced with the swapchain, and enumerations released right away */
+#define ARENA_PERSISTENT (4 << 10)
+#define ARENA_SWAPCHAIN (4 << 10)
+#define ARENA_SCRATCH (256 << 10)
+
+#define HEADLESS_FORMAT VK_FORMAT_B8G8R8A8_UNORM
+#define HEADLESS_FRAMES 1000
+
+/* physical devices driven together in multi gpu mode */
+#define MAX_GROUP_DEVICES 8
+
+/* How the frames are spread over a device group. Alternate frames go to
+ * each device in turn, split frames are drawn by all devices at once, each
+ * rendering a band of the image. */
+enum multi_gpu {
+    MULTI_GPU_NONE,
+    MULTI_GPU_AFR,
+    MULTI_GPU_SFR,
+    MULTI_GPU_COUNT
+};
+
+const char *MULTI_GPU_NAMES[MULTI_GPU_COUNT] = {
+    [MULTI_GPU_NONE] = "none",
+    [MULTI_GPU_AFR] = "afr",
+    [MULTI_GPU_SFR] = "sfr",
+};
+
+/* Present modes in order of preference and the frames in flight used with
+ * them. FIFO is always supported so every list ends with it. */
+enum present_policy {
+    PRESENT_LATENCY, /* newest frame wins, fewest frames queued */
+    PRESENT_POWER, /* vsync, the GPU idles once the queue is full */
+    PRESENT_POLICY_COUNT
+};
+
+struct present_modes {
+    const char *name;
+    VkPresentModeKHR modes[3];
+    uint32_t modec;
+    uint32_t frames;
+};
+
+const struct present_modes PRESENT_POLICIES[PRESENT_POLICY_COUNT] = {
+    [PRESENT_LATENCY] = {
+        "latency",
+        {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR,
+         VK_PRESENT_MODE_FIFO_KHR}, 3,
+        2
+    },
+    [PRESENT_POWER] = {
+        "power",
+        {VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR}, 2,
+        CONCURRENT_FRAMES
+    },
+};
+
+/* -O levels, mesh reorderings from none to all */
+const uint32_t MESH_OPT_LEVELS[] = {
+    0,
+    MESH_OPT_DEFAULT,
+    MESH_OPT_DEFAULT | MESH_OPT_OVERDRAW,
+};
+#define MESH_OPT_LEVELC (sizeof(MESH_OPT_LEVELS)/sizeof(*MESH_OPT_LEVELS))
+
+struct render_options {
+    const char *profile_csv;
+    const char *profile_trace;
+    const char *bench_out; /* benchmark metrics, NULL for none */
+    bool statistics;
+    bool headless; /* render to offscreen images, no window or swapchain */
+    uint32_t frames; /* stop after this many frames, 0 to run until closed */
+    uint32_t width, height;
+    uint32_t instances;
+    uint32_t recorders; /* 0 for one per cpu */
+    bool prepass; /* depth pre-pass before shading */
+    uint32_t samples; /* per pixel, 1 without multisampling */
+    double frame_target; /* gpu ms dynamic resolution holds, 0 for none */
+    enum present_policy present;
+    uint32_t frames_in_flight; /* 0 for the policy's default */
+    uint32_t fps_cap; /* 0 for uncapped */
+    const char *mesh; /* obj file, NULL for the built in mesh */
+    uint32_t mesh_opt; /* enum mesh_opt */
+    bool bindless; /* texture through descriptor indexing */
+    bool watch; /* rebuild pipelines when their shaders change */
+    const char *device; /* index or part of the name, NULL for the best */
+    enum multi_gpu multi_gpu; /* headless only */
+    const char *hud_font; /* psf2 font of the overlay, NULL for none */
+};
+
+/* The pipelines drawn with, each a variant picked by the options. All are
+ * built together on start and the graphics ones again on a format change;
+ * in watch mode each is rebuilt on its own once one of its shaders
+ * changes. */
+enum render_pipeline {
+    PIPELINE_PREPASS,
+    PIPELINE_SHADE,
+    PIPELINE_CULL,
+    PIPELINE_TEXT,
+    PIPELINE_COUNT
+};
+#define PIPELINE_BIT(p) (1u << (p))
+
+/* Per draw data pushed with the draw's state, std430 and well within the
+ * 128 bytes every device takes. Positions come dequantized as
+ * min + pos*scale, the model matrix then only rotates and scales
+ * uniformly and serves for normals as well. */
+struct draw_push {
+    mat4 model;
+    vec4 scale; /* w unused */
+    vec4 min; /* w unused */
+    uint32_t object;
+    uint32_t image; /* bindless index of the texture, when bindless */
+};
+
+/* Queue families by role. A role without a family suited to it shares the
+ * graphics family; buffers and images used across roles are shared
+ * concurrently by the distinct families in uniq rather than transferred. */
+struct queue_families {
+    uint32_t gfx;
+    uint32_t present; /* gfx when headless */
+    uint32_t compute; /* async compute and culling */
+    uint32_t xfer; /* uploads */
+    uint32_t uniqc;
+    uint32_t uniq[4];
+};
 
 struct render_handles {
+    struct render_options opts;
+    struct host_alloc host; /* installed as vk_allocator */
+    uint64_t host_init; /* driver allocations made by render_init() */
+    uint64_t app_init; /* and ours */
+    struct arena arena, sc_arena, scratch;
     SDL_Window *window;
     VkInstance instance;
     VkSurfaceKHR surface;
     VkPhysicalDevice physical;
+    uint32_t groupc; /* devices in the logical one, 1 without multi gpu */
+    VkPhysicalDevice group[MAX_GROUP_DEVICES];
     VkDevice device;
-    VkQueue queue; /* gfx and present, assumed to be the same */
+    VkPhysicalDeviceFeatures features; /* enabled on device */
+    PFN_vkCmdDrawIndexedIndirectCountKHR draw_indirect_count; /* or NULL */
+    struct mem_allocator mem;
+    struct queue_families qf;
+    VkQueue queue; /* graphics */
+    VkQueue present_queue;
+    VkQueue compute_queue;
+    VkQueue xfer_queue;
+    struct upload_queue upload;
+    uint64_t upload_value; /* waited on by the next submit, 0 if none */
     VkFormat format;
-    VkRenderPass renderpass;
+    VkFormat depth_format;
+    VkSampleCountFlagBits samples; /* of the color and depth attachments */
+    VkRenderPass renderpass; /* the graph's, pipelines are built for it */
+    VkPipelineCache pipeline_cache;
+    struct shader_cache shaders;
+    struct variants variants; /* own the pipelines below */
     VkDescriptorSetLayout descset_layout;
     VkPipelineLayout pipeline_layout;
     VkPipeline pipeline;
+    VkPipeline prepass_pipeline; /* or VK_NULL_HANDLE */
+    VkDescriptorSetLayout cull_descset_layout;
+    VkPipelineLayout cull_pipeline_layout;
+    VkPipeline cull_pipeline;
+    VkPipeline text_pipeline; /* or VK_NULL_HANDLE */
     VkDescriptorPool descpool;
+    VkDescriptorSet descset;
+    VkDescriptorSet cull_descset;
+    VkBuffer uniform_buf;
+    struct mem_alloc uniform_buf_mem; /* persistently mapped */
+    VkDeviceSize uniform_stride;
     VkCommandPool cmdpool;
     VkBuffer vertex_buf;
-    VkDeviceMemory vertex_buf_mem;
+    struct mem_alloc vertex_buf_mem;
     VkBuffer index_buf;
-    VkDeviceMemory index_buf_mem;
-
+    struct mem_alloc index_buf_mem;
+    VkBuffer instance_buf;
+    struct mem_alloc instance_buf_mem; /* mapped, a slot per frame */
+    VkDeviceSize instance_stride;
+    uint32_t instancec; /* written for the current frame */
+    struct entity_store entities; /* drawn as the instances */
+    struct timespec epoch; /* animations run from */
+    struct mesh mesh; /* data released once uploaded */
+    VkIndexType index_type;
+    struct draw_push push;
+    bool descriptor_indexing;
+    struct bindless bindless; /* when opts.bindless */
+    VkImage texture;
+    struct mem_alloc texture_mem;
+    VkImageView texture_view;
+    VkSampler sampler;
+
+    /* written by the cull pass, a slot per frame like the host side */
+    VkBuffer visible_buf;
+    struct mem_alloc visible_buf_mem;
+    VkBuffer draw_buf;
+    struct mem_alloc draw_buf_mem;
+    VkDeviceSize draw_stride;
+    uint32_t cull_flags;
+
+    /* watch mode, stale variants are rebuilt on a thread of their own and
+     * swapped in by the first frame after they are done */
+    pthread_t reload_thread;
+    pthread_mutex_t reload_lock;
+    bool reloading; /* thread started and not yet joined */
+    bool reload_done; /* under reload_lock */
+    uint32_t reload_count; /* variants rebuilt */
+    double reload_time; /* ms the rebuild took */
+    double reload_polled; /* last check of the shaders */
+
+    /* when headless the images are offscreen and owned by us */
     VkSwapchainKHR sc;
+    VkPresentModeKHR present_mode;
     VkExtent2D sc_extent;
     uint32_t sc_imgc;
     VkImage *sc_imgs;
+    struct mem_alloc *sc_img_mems; /* headless only */
     VkImageView *sc_imageviews;
-    VkFramebuffer *sc_framebufs;
-    VkCommandBuffer *sc_cmdbufs;
-    VkBuffer *sc_uniform_bufs;
-    VkDeviceMemory *sc_uniform_bufs_mem;
-    VkDescriptorSet *sc_descsets;
-
-    VkSemaphore *img_available;
-    VkSemaphore *img_rendered;
-
-    VkFence frm_inflight[CONCURRENT_FRAMES];
+    /* the frame's passes, rebuilt with the swapchain */
+    struct graph graph;
+    uint32_t shade_pass; /* the last render pass, after any pre-pass */
+    struct record_slices *slices; /* the frame's, while recording */
+    /* dynamic resolution, the frame is drawn at render_extent into the top
+     * left of scene and blitted up to the whole color image */
+    float scale;
+    float slot_scales[CONCURRENT_FRAMES]; /* each slot's frame drawn at */
+    VkExtent2D render_extent; /* sc_extent without dynamic resolution */
+    uint32_t scene, color; /* graph resources of the upscale */
+    VkFilter blit_filter;
+    /* the overlay, drawn over the color image after anything else */
+    struct text text;
+    uint32_t hud_pass;
+    VkRenderPass hud_renderpass; /* the text pipeline is built for it */
+    double hud_last, hud_interval; /* ms */
+
+    VkSemaphore *img_available; /* per frame in flight */
+    VkSemaphore *img_rendered; /* per swapchain image */
+    /* multi gpu, a frame's work on each device but the first signals
+     * group_done[slot*groupc + device] for the first to join it */
+    VkSemaphore *group_done;
+    /* split frames, chained to the render pass being begun */
+    VkRect2D group_areas[MAX_GROUP_DEVICES];
+    VkDeviceGroupRenderPassBeginInfo group_rp_info;
+
+    VkCommandBuffer frm_cmdbufs[CONCURRENT_FRAMES];
+    /* culling when it runs on a compute family of its own, signaling a
+     * timeline of its own the frame's graphics work waits on */
+    VkCommandPool compute_pool;
+    VkCommandBuffer compute_cmdbufs[CONCURRENT_FRAMES];
+    struct timeline compute_timeline;
+    /* a pool per recorder and frame, reset as a whole once the frame's
+     * timeline value is reached; 1 recorder records inline into
+     * frm_cmdbufs */
+    struct jobs jobs;
+    uint32_t recorderc;
+    uint32_t subpassc;
+    VkCommandPool rec_pools[CONCURRENT_FRAMES][MAX_RECORDERS];
+    VkCommandBuffer
+        rec_cmdbufs[CONCURRENT_FRAMES][MAX_SUBPASSES][MAX_RECORDERS];
+    struct timeline timeline; /* a value per submitted frame */
+    struct defer_queue retired;
+    uint64_t frm_values[CONCURRENT_FRAMES]; /* signaled by the slot's frame */
+    uint32_t framec; /* frames in flight, at most CONCURRENT_FRAMES */
     size_t frm_index;
-};
+    uint64_t frame;
+    double pace_next; /* earliest start of the next frame when capped */
 
-void die(const char *fmt, ...) {
-    va_list ap;
-
-    fprintf(stderr, "error: ");
-    va_start(ap, fmt);
-    vfprintf(stderr, fmt, ap);
-    va_end(ap);
-    fprintf(stderr, "\n");
-
-    exit(1);
-}
+    struct profile profile;
+};
 
+/* the built in mesh, quantized like any other by render_builtin_mesh() */
 struct vertex {
     vec2 pos;
     vec4 col;
@@ -92,24 +367,31 @@ const uint16_t INDICES[] = {
     0, 9, 10,
 };
 
+/* per frame camera and culling data, std140 */
 struct uniform_buf_obj {
-    mat4 model;
     mat4 view;
     mat4 proj;
+    vec4 planes[6];
+    uint32_t instancec;
+    uint32_t index_count;
+    float radius;
+    uint32_t cull_flags;
 };
 
-void vulkan_instance(SDL_Window *window, VkInstance *instance) {
+void vulkan_instance(SDL_Window *window, struct arena *scratch,
+                     VkInstance *instance) {
     VkApplicationInfo app_info = {
         .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
         .pApplicationName = APP_NAME,
         .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
         .pEngineName = NULL,
         .engineVersion = 0,
-        .apiVersion = VK_API_VERSION_1_0
+        .apiVersion = VK_API_VERSION_1_2
     };
     
-    unsigned int extc_sdl;
-    if (!SDL_Vulkan_GetInstanceExtensions(window, &extc_sdl, NULL))
+    /* no window when headless, and then no surface extensions either */
+    unsigned int extc_sdl = 0;
+    if (window && !SDL_Vulkan_GetInstanceExtensions(window, &extc_sdl, NULL))
         die("failed to get instance extension count for sdl -- %s",
             SDL_GetError());
 
@@ -118,11 +400,13 @@ void vulkan_instance(SDL_Window *window, VkInstance *instance) {
     };
     unsigned int extc_static = sizeof(ext_static)/sizeof(*ext_static);
     unsigned int extc = extc_sdl + extc_static;
-    const char **ext = malloc(extc*sizeof(*ext));
+    size_t mark = arena_mark(scratch);
+    const char **ext = arena_alloc(scratch, extc*sizeof(*ext));
     for (int i = 0; i < extc_static; i++) {
         ext[i] = ext_static[i];
     }
-    if (!SDL_Vulkan_GetInstanceExtensions(window, &extc_sdl, ext+extc_static))
+    if (window &&
+        !SDL_Vulkan_GetInstanceExtensions(window, &extc_sdl, ext+extc_static))
         die("failed to get %d instance extensions for sdl -- %s",
             extc, SDL_GetError());
 
@@ -153,172 +437,485 @@ void vulkan_instance(SDL_Window *window, VkInstance *instance) {
         .ppEnabledExtensionNames = ext,
     };
 
-    if (vkCreateInstance(&create_info, NULL, instance) != VK_SUCCESS)
+    if (vkCreateInstance(&create_info, vk_allocator, instance) != VK_SUCCESS)
         die("failed to create vulkan instance");
 
-    free(ext);
+    arena_reset(scratch, mark);
+}
+
+bool vulkan_device_extension(VkPhysicalDevice physical,
+                             struct arena *scratch, const char *name) {
+    uint32_t extc = 0;
+    vkEnumerateDeviceExtensionProperties(physical, NULL, &extc, NULL);
+    size_t mark = arena_mark(scratch);
+    VkExtensionProperties *exts = arena_alloc(scratch, extc*sizeof(*exts));
+    vkEnumerateDeviceExtensionProperties(physical, NULL, &extc, exts);
+
+    bool found = false;
+    for (uint32_t i = 0; i < extc; i++) {
+        if (strcmp(exts[i].extensionName, name) == 0)
+            found = true;
+    }
+
+    arena_reset(scratch, mark);
+    return found;
+}
+
+/* 0 for a device that cannot run us at all. Otherwise the type ranks
+ * first, discrete over integrated over virtual over cpu, then device local
+ * memory and last whether culling and uploads get queues of their own. */
+uint64_t vulkan_device_score(VkPhysicalDevice physical, bool windowed,
+                             struct arena *scratch) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physical, &props);
+    if (props.apiVersion < VK_API_VERSION_1_2)
+        return 0;
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+    };
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &timeline
+    };
+    vkGetPhysicalDeviceFeatures2(physical, &features);
+    if (!timeline.timelineSemaphore)
+        return 0;
+    if (windowed &&
+        !vulkan_device_extension(physical, scratch,
+                                 VK_KHR_SWAPCHAIN_EXTENSION_NAME))
+        return 0;
+
+    uint32_t propc = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical, &propc, NULL);
+    size_t mark = arena_mark(scratch);
+    VkQueueFamilyProperties *qprops = arena_alloc(scratch,
+                                                  propc*sizeof(*qprops));
+    vkGetPhysicalDeviceQueueFamilyProperties(physical, &propc, qprops);
+    bool gfx = false, compute = false, xfer = false;
+    for (uint32_t i = 0; i < propc; i++) {
+        VkQueueFlags flags = qprops[i].queueFlags;
+        gfx = gfx || (flags & VK_QUEUE_GRAPHICS_BIT);
+        compute = compute || ((flags & VK_QUEUE_COMPUTE_BIT) &&
+                              !(flags & VK_QUEUE_GRAPHICS_BIT) &&
+                              qprops[i].timestampValidBits > 0);
+        xfer = xfer || ((flags & VK_QUEUE_TRANSFER_BIT) &&
+                        !(flags & (VK_QUEUE_GRAPHICS_BIT |
+                                   VK_QUEUE_COMPUTE_BIT)));
+    }
+    arena_reset(scratch, mark);
+    if (!gfx)
+        return 0;
+
+    VkPhysicalDeviceMemoryProperties mem;
+    vkGetPhysicalDeviceMemoryProperties(physical, &mem);
+    uint64_t local = 0;
+    for (uint32_t i = 0; i < mem.memoryHeapCount; i++) {
+        if (mem.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            local += mem.memoryHeaps[i].size;
+    }
+    uint64_t type;
+    switch (props.deviceType) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: type = 4; break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: type = 3; break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: type = 2; break;
+        default: type = 1; break;
+    }
+    /* MiB fit in the 46 bits between, up to 64 PiB */
+    return type << 48 | (local >> 20) << 2 | compute << 1 | xfer;
+}
+
+const char *device_type_name(VkPhysicalDeviceType type) {
+    switch (type) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+        case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+        default: return "other";
+    }
 }
 
-void vulkan_physical(VkInstance instance, VkPhysicalDevice *physical) {
+/* The best scoring device, unless override names one either by index or
+ * by a part of its name. With group_wanted the devices of the group it is
+ * in, if it is in one of several, go to group; groupc is 1 otherwise and
+ * group holds only the device. */
+void vulkan_physical(VkInstance instance, bool windowed,
+                     const char *override, bool group_wanted,
+                     struct arena *scratch,
+                     VkPhysicalDevice *physical,
+                     uint32_t *groupc, VkPhysicalDevice *group) {
     uint32_t devc = 0;
     vkEnumeratePhysicalDevices(instance, &devc, NULL);
 
     if (devc == 0)
         die("no vulkan gpu detected");
 
-    VkPhysicalDevice *devs = malloc(devc*sizeof(*devs));
+    size_t mark = arena_mark(scratch);
+    VkPhysicalDevice *devs = arena_alloc(scratch, devc*sizeof(*devs));
     if (vkEnumeratePhysicalDevices(instance, &devc, devs) != VK_SUCCESS)
         die("failed to get physical devices");
 
     printf("%d availiable device(s):\n", devc);
+    int selected = -1;
+    uint64_t best = 0;
+    char *end;
+    long index = override ? strtol(override, &end, 10) : -1;
+    bool by_index = override && *override && *end == '\0';
     for (int i = 0; i < devc; i++) {
         VkPhysicalDeviceProperties dev_props;
         vkGetPhysicalDeviceProperties(devs[i], &dev_props);
-        printf("  [%d]: %s\n", i, dev_props.deviceName);
-    }
-
-    int selected = -1;
-    if (devc == 1) {
-        selected = 0;
-    } else {
-        while (selected < 0 || selected >= devc) {
-            printf("select device to use: ");
-            scanf("%d", &selected);
-            printf("\n");
+        VkPhysicalDeviceMemoryProperties mem;
+        vkGetPhysicalDeviceMemoryProperties(devs[i], &mem);
+        uint64_t local = 0;
+        for (uint32_t h = 0; h < mem.memoryHeapCount; h++) {
+            if (mem.memoryHeaps[h].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+                local += mem.memoryHeaps[h].size;
+        }
+        uint64_t score = vulkan_device_score(devs[i], windowed, scratch);
+        printf("  [%d]: %s, %s, %lu MiB, score %lx\n", i,
+               dev_props.deviceName, device_type_name(dev_props.deviceType),
+               (unsigned long)(local >> 20), (unsigned long)score);
+
+        if (override) {
+            bool match = by_index
+                ? index == i
+                : strstr(dev_props.deviceName, override) != NULL;
+            if (match && selected < 0) {
+                if (score == 0)
+                    die("device %d (%s) is not suitable", i,
+                        dev_props.deviceName);
+                selected = i;
+            }
+        } else if (score > best) {
+            best = score;
+            selected = i;
         }
     }
+    if (selected < 0) {
+        if (override)
+            die("no device matches '%s'", override);
+        die("no suitable vulkan gpu");
+    }
 
     *physical = devs[selected];
-
     printf("selected device %d\n", selected);
+    arena_reset(scratch, mark);
+
+    *groupc = 1;
+    group[0] = *physical;
+    if (!group_wanted)
+        return;
+
+    uint32_t gc = 0;
+    vkEnumeratePhysicalDeviceGroups(instance, &gc, NULL);
+    VkPhysicalDeviceGroupProperties *groups =
+        arena_alloc(scratch, gc*sizeof(*groups));
+    for (uint32_t g = 0; g < gc; g++) {
+        groups[g] = (VkPhysicalDeviceGroupProperties){
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GROUP_PROPERTIES,
+        };
+    }
+    if (vkEnumeratePhysicalDeviceGroups(instance, &gc, groups)
+            != VK_SUCCESS)
+        die("failed to get physical device groups");
+    for (uint32_t g = 0; g < gc; g++) {
+        bool member = false;
+        for (uint32_t d = 0; d < groups[g].physicalDeviceCount; d++) {
+            member = member || groups[g].physicalDevices[d] == *physical;
+        }
+        if (groups[g].physicalDeviceCount < 2 || !member)
+            continue;
+        *groupc = groups[g].physicalDeviceCount;
+        if (*groupc > MAX_GROUP_DEVICES) {
+            fprintf(stderr, "warning: device group of %u, using only the "
+                    "first %d\n", *groupc, MAX_GROUP_DEVICES);
+            *groupc = MAX_GROUP_DEVICES;
+        }
+        memcpy(group, groups[g].physicalDevices, *groupc*sizeof(*group));
+    }
+    arena_reset(scratch, mark);
+    if (*groupc == 1)
+        printf("device %d is in no group of several, using it alone\n",
+               selected);
+    else
+        printf("device group of %u\n", *groupc);
+}
 
+/* Graphics goes to the first family that can also present, if any. A
+ * family with compute but no graphics runs culling alongside the graphics
+ * queue, one with transfer but neither is usually backed by a dma engine.
+ * Culling is timed, so its family must support timestamps. */
+void vulkan_queue_families(VkPhysicalDevice physical, VkSurfaceKHR surface,
+                           struct arena *scratch,
+                           struct queue_families *qf) {
     uint32_t propc = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(*physical, &propc, NULL);
-    VkQueueFamilyProperties *props = malloc(propc*sizeof(*props));
-    vkGetPhysicalDeviceQueueFamilyProperties(*physical, &propc, props);
-    printf("family queues for device:\n");
-    for (int i = 0; i < propc; i++) {
-        printf("%d: %x\n", i, props[i].queueFlags); 
+    vkGetPhysicalDeviceQueueFamilyProperties(physical, &propc, NULL);
+    size_t mark = arena_mark(scratch);
+    VkQueueFamilyProperties *props = arena_alloc(scratch,
+                                                 propc*sizeof(*props));
+    vkGetPhysicalDeviceQueueFamilyProperties(physical, &propc, props);
+
+    const uint32_t NONE = UINT32_MAX;
+    uint32_t gfx = NONE, present = NONE, compute = NONE, xfer = NONE;
+    printf("queue families:\n");
+    for (uint32_t i = 0; i < propc; i++) {
+        VkQueueFlags flags = props[i].queueFlags;
+        VkBool32 can_present = VK_FALSE;
+        if (surface != VK_NULL_HANDLE)
+            vkGetPhysicalDeviceSurfaceSupportKHR(physical, i, surface,
+                                                 &can_present);
+        printf("  [%u]: flags %x, %u queue(s)%s\n", i, flags,
+               props[i].queueCount, can_present ? ", present" : "");
+
+        if ((flags & VK_QUEUE_GRAPHICS_BIT) &&
+            (gfx == NONE || (can_present && present != gfx))) {
+            gfx = i;
+            if (can_present)
+                present = i;
+        }
+        if (can_present && present == NONE)
+            present = i;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) &&
+            !(flags & VK_QUEUE_GRAPHICS_BIT) &&
+            props[i].timestampValidBits > 0 && compute == NONE)
+            compute = i;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) &&
+            !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+            xfer == NONE)
+            xfer = i;
     }
+    arena_reset(scratch, mark);
 
-    free(devs);
-    free(props);
+    if (gfx == NONE)
+        die("no graphics queue family");
+    if (surface != VK_NULL_HANDLE && present == NONE)
+        die("device does not support presentation to surface");
+    qf->gfx = gfx;
+    qf->present = surface != VK_NULL_HANDLE ? present : gfx;
+    qf->compute = compute != NONE ? compute : gfx;
+    qf->xfer = xfer != NONE ? xfer : gfx;
+
+    uint32_t roles[] = {qf->gfx, qf->present, qf->compute, qf->xfer};
+    qf->uniqc = 0;
+    for (int r = 0; r < 4; r++) {
+        bool seen = false;
+        for (uint32_t u = 0; u < qf->uniqc; u++) {
+            seen = seen || qf->uniq[u] == roles[r];
+        }
+        if (!seen)
+            qf->uniq[qf->uniqc++] = roles[r];
+    }
+    printf("queue families: graphics %u, present %u, compute %u, "
+           "transfer %u\n", qf->gfx, qf->present, qf->compute, qf->xfer);
 }
 
 void vulkan_logical(VkInstance instance, VkPhysicalDevice physical,
-                    SDL_Window *window,
+                    uint32_t groupc, const VkPhysicalDevice *group,
+                    SDL_Window *window, struct arena *scratch,
                     VkSurfaceKHR *surface,
-                    VkDevice *device, VkQueue *queue) {
-    uint32_t family_index = 0;
-    uint32_t queue_index = 0;
+                    VkDevice *device, VkPhysicalDeviceFeatures *features,
+                    bool *draw_indirect_count, bool *descriptor_indexing,
+                    struct queue_families *qf,
+                    VkQueue *queue, VkQueue *present_queue,
+                    VkQueue *compute_queue, VkQueue *xfer_queue) {
+    /* families are picked by what can present to the surface */
+    *surface = VK_NULL_HANDLE;
+    if (window && !SDL_Vulkan_CreateSurface(window, instance, surface))
+        die("failed to create vulkan surface for sdl -- %s", SDL_GetError());
+    vulkan_queue_families(physical, *surface, scratch, qf);
+
+    /* one queue of each distinct family, roles sharing a family share the
+     * queue as well */
     float prios[] = {1};
-    VkDeviceQueueCreateInfo queue_create_info = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        .queueFamilyIndex = family_index,
-        .queueCount = 1,
-        .pQueuePriorities = prios,
-    };
+    VkDeviceQueueCreateInfo queue_create_infos[4];
+    for (uint32_t i = 0; i < qf->uniqc; i++) {
+        queue_create_infos[i] = (VkDeviceQueueCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = qf->uniq[i],
+            .queueCount = 1,
+            .pQueuePriorities = prios,
+        };
+    }
 
-    VkPhysicalDeviceFeatures features = {
-        .logicOp = VK_TRUE
+    /* frames are scheduled on a timeline semaphore, core in 1.2 */
+    VkPhysicalDeviceProperties dev_props;
+    vkGetPhysicalDeviceProperties(physical, &dev_props);
+    if (dev_props.apiVersion < VK_API_VERSION_1_2)
+        die("device only supports vulkan %u.%u, 1.2 is required",
+            VK_VERSION_MAJOR(dev_props.apiVersion),
+            VK_VERSION_MINOR(dev_props.apiVersion));
+    VkPhysicalDeviceDescriptorIndexingFeatures indexing = {
+        .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
     };
-    const char *ext[] = {
-        VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+        .pNext = &indexing
+    };
+    VkPhysicalDeviceFeatures2 supported2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &timeline
+    };
+    vkGetPhysicalDeviceFeatures2(physical, &supported2);
+    if (!timeline.timelineSemaphore)
+        die("timeline semaphores not supported by device");
+
+    /* only what bindless.c relies on, enabled whenever all of it is there */
+    *descriptor_indexing =
+        indexing.shaderSampledImageArrayNonUniformIndexing &&
+        indexing.descriptorBindingSampledImageUpdateAfterBind &&
+        indexing.descriptorBindingStorageBufferUpdateAfterBind &&
+        indexing.descriptorBindingUpdateUnusedWhilePending &&
+        indexing.descriptorBindingPartiallyBound &&
+        indexing.runtimeDescriptorArray;
+    VkPhysicalDeviceDescriptorIndexingFeatures enabled_indexing = {
+        .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES,
+        .shaderSampledImageArrayNonUniformIndexing = *descriptor_indexing,
+        .descriptorBindingSampledImageUpdateAfterBind = *descriptor_indexing,
+        .descriptorBindingStorageBufferUpdateAfterBind = *descriptor_indexing,
+        .descriptorBindingUpdateUnusedWhilePending = *descriptor_indexing,
+        .descriptorBindingPartiallyBound = *descriptor_indexing,
+        .runtimeDescriptorArray = *descriptor_indexing,
+    };
+    timeline.pNext = &enabled_indexing;
+    VkPhysicalDeviceFeatures supported = supported2.features;
+    VkPhysicalDeviceFeatures enabled = {
+        .logicOp = VK_TRUE,
+        .multiDrawIndirect = supported.multiDrawIndirect,
+        .drawIndirectFirstInstance = supported.drawIndirectFirstInstance,
+        .inheritedQueries = supported.inheritedQueries,
+        .pipelineStatisticsQuery = supported.pipelineStatisticsQuery
+    };
+    const char *ext[2];
+    unsigned extc = 0;
+    if (window)
+        ext[extc++] = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+    *draw_indirect_count = vulkan_device_extension(
+        physical, scratch, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    if (*draw_indirect_count)
+        ext[extc++] = VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
+
+    /* a logical device over the whole group, core in 1.1 */
+    VkDeviceGroupDeviceCreateInfo group_info = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_DEVICE_CREATE_INFO,
+        .pNext = &timeline,
+        .physicalDeviceCount = groupc,
+        .pPhysicalDevices = group,
     };
-    unsigned extc = sizeof(ext)/sizeof(*ext);
-
     VkDeviceCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = &queue_create_info,
+        .pNext = groupc > 1 ? (void *)&group_info : (void *)&timeline,
+        .queueCreateInfoCount = qf->uniqc,
+        .pQueueCreateInfos = queue_create_infos,
         .enabledLayerCount = 0,
         .ppEnabledLayerNames = NULL,
         .enabledExtensionCount = extc,
         .ppEnabledExtensionNames = ext,
         .ppEnabledLayerNames = NULL,
-        .pEnabledFeatures = &features,
+        .pEnabledFeatures = &enabled,
     };
 
-    if (vkCreateDevice(physical, &create_info, NULL, device) != VK_SUCCESS)
+    if (vkCreateDevice(physical, &create_info, vk_allocator, device)
+            != VK_SUCCESS)
         die("failed to create logical device");
+    *features = enabled;
 
-    vkGetDeviceQueue(*device, family_index, queue_index, queue);
+    vkGetDeviceQueue(*device, qf->gfx, 0, queue);
+    vkGetDeviceQueue(*device, qf->present, 0, present_queue);
+    vkGetDeviceQueue(*device, qf->compute, 0, compute_queue);
+    vkGetDeviceQueue(*device, qf->xfer, 0, xfer_queue);
+}
 
-    if (!SDL_Vulkan_CreateSurface(window, instance, surface)) {
-        die("failed to create vulkan surface for sdl -- %s", SDL_GetError());
+/* the first of the preferred modes that the surface supports */
+void vulkan_present_mode(VkPhysicalDevice physical, VkSurfaceKHR surface,
+                         struct arena *scratch,
+                         const VkPresentModeKHR *preferred,
+                         uint32_t preferred_count, VkPresentModeKHR *mode) {
+    uint32_t pmodec;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(physical, surface,
+                                              &pmodec, NULL);
+    size_t mark = arena_mark(scratch);
+    VkPresentModeKHR *pmodes = arena_alloc(scratch, pmodec*sizeof(*pmodes));
+    vkGetPhysicalDeviceSurfacePresentModesKHR(physical, surface,
+                                              &pmodec, pmodes);
+    for (uint32_t i = 0; i < preferred_count; i++) {
+        for (uint32_t j = 0; j < pmodec; j++) {
+            if (pmodes[j] == preferred[i]) {
+                *mode = preferred[i];
+                arena_reset(scratch, mark);
+                return;
+            }
+        }
     }
+    die("none of the preferred present modes available");
+}
 
-    VkBool32 surface_supported;
-    vkGetPhysicalDeviceSurfaceSupportKHR(physical, family_index,
-                                         *surface, &surface_supported);
-    if (surface_supported != VK_TRUE)
-        die("device does not support presentation to surface");
+const char *present_mode_name(VkPresentModeKHR mode) {
+    switch (mode) {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+    case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo relaxed";
+    default: return "unknown";
+    }
 }
 
+/* images rendered by one family and presented by another are shared */
 void vulkan_swapchain(VkPhysicalDevice physical, VkDevice device,
-                      VkSurfaceKHR surface,
+                      VkSurfaceKHR surface, struct arena *scratch,
+                      VkSwapchainKHR old_swapchain,
+                      VkPresentModeKHR present_mode,
+                      VkImageUsageFlags usage,
+                      uint32_t familyc, const uint32_t *families,
                       VkFormat *format, VkExtent2D *extent,
                       VkSwapchainKHR *swapchain) {
     VkSurfaceCapabilitiesKHR caps;
     vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical, surface, &caps);
     *extent = caps.currentExtent;
+    if ((caps.supportedUsageFlags & usage) != usage)
+        die("swapchain images do not support usage %x", usage);
 
     uint32_t fmtc;
     vkGetPhysicalDeviceSurfaceFormatsKHR(physical, surface, &fmtc, NULL);
-    VkSurfaceFormatKHR *fmts = malloc(fmtc*sizeof(*fmts));
+    size_t mark = arena_mark(scratch);
+    VkSurfaceFormatKHR *fmts = arena_alloc(scratch, fmtc*sizeof(*fmts));
     vkGetPhysicalDeviceSurfaceFormatsKHR(physical, surface, &fmtc, fmts);
     *format = fmts[0].format;
-    free(fmts);
+    arena_reset(scratch, mark);
 
-    uint32_t pmodec;
-    vkGetPhysicalDeviceSurfacePresentModesKHR(physical, surface,
-                                              &pmodec, NULL);
-    VkPresentModeKHR *pmodes = malloc(pmodec*sizeof(*pmodes));
-    vkGetPhysicalDeviceSurfacePresentModesKHR(physical, surface,
-                                              &pmodec, pmodes);
-    int mailbox_exists = 0;
-    for (int i = 0; i < pmodec; i++) {
-        if (pmodes[i] == VK_PRESENT_MODE_MAILBOX_KHR)
-            mailbox_exists = 1;
-    }
-    free(pmodes);
-    if (mailbox_exists == 0)
-        die("mail box present mode not available for physical device");
+    /* one more than the minimum so acquire does not wait on the
+     * presentation engine, 0 means there is no maximum */
+    uint32_t imgc = caps.minImageCount + 1;
+    if (caps.maxImageCount > 0 && imgc > caps.maxImageCount)
+        imgc = caps.maxImageCount;
 
     VkSwapchainCreateInfoKHR create_info = {
         .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
         .surface = surface,
-        .minImageCount = caps.minImageCount + 1,
+        .minImageCount = imgc,
         .imageFormat = *format,
         .imageColorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
         .imageExtent = *extent,
         .imageArrayLayers = 1,
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-        .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
-        .queueFamilyIndexCount = 0,
-        .pQueueFamilyIndices = NULL,
+        .imageUsage = usage,
+        .imageSharingMode = familyc > 1 ? VK_SHARING_MODE_CONCURRENT
+                                        : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = familyc > 1 ? familyc : 0,
+        .pQueueFamilyIndices = familyc > 1 ? families : NULL,
         .preTransform = caps.currentTransform,
         .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-        .presentMode = VK_PRESENT_MODE_MAILBOX_KHR,
+        .presentMode = present_mode,
         .clipped = VK_TRUE,
-        .oldSwapchain = VK_NULL_HANDLE
+        .oldSwapchain = old_swapchain
     };
 
-    if (vkCreateSwapchainKHR(device, &create_info, NULL, swapchain)
+    if (vkCreateSwapchainKHR(device, &create_info, vk_allocator, swapchain)
             != VK_SUCCESS)
         die("failed to create swapchain");
 }
 
-void vulkan_imageviews(VkDevice device, VkSwapchainKHR swapchain,
-                       VkFormat format,
-                       uint32_t *image_count,
-                       VkImage **images, VkImageView **image_views) {
-    uint32_t imgc;
-    vkGetSwapchainImagesKHR(device, swapchain, &imgc, NULL);
-    VkImage *imgs = malloc(imgc*sizeof(VkImage));
-    VkImageView *ivs = malloc(imgc*sizeof(VkImageView));
-    vkGetSwapchainImagesKHR(device, swapchain, &imgc, imgs);
-
+void vulkan_imageview(VkDevice device, VkImage image, VkFormat format,
+                      VkImageAspectFlags aspect, VkImageView *image_view) {
     VkComponentMapping components = {
         .r = VK_COMPONENT_SWIZZLE_IDENTITY,
         .g = VK_COMPONENT_SWIZZLE_IDENTITY,
@@ -327,112 +924,265 @@ void vulkan_imageviews(VkDevice device, VkSwapchainKHR swapchain,
     };
 
     VkImageSubresourceRange range = {
-        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .aspectMask = aspect,
         .baseMipLevel = 0,
         .levelCount = 1,
         .baseArrayLayer = 0,
         .layerCount = 1
     };
 
+    VkImageViewCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = format,
+        .components = components,
+        .subresourceRange = range,
+    };
+
+    if (vkCreateImageView(device, &create_info, vk_allocator, image_view)
+            != VK_SUCCESS)
+        die("failed to create imageview");
+}
+
+void vulkan_imageviews(VkDevice device, VkSwapchainKHR swapchain,
+                       VkFormat format, struct arena *arena,
+                       uint32_t *image_count,
+                       VkImage **images, VkImageView **image_views) {
+    uint32_t imgc;
+    vkGetSwapchainImagesKHR(device, swapchain, &imgc, NULL);
+    VkImage *imgs = arena_alloc(arena, imgc*sizeof(VkImage));
+    VkImageView *ivs = arena_alloc(arena, imgc*sizeof(VkImageView));
+    vkGetSwapchainImagesKHR(device, swapchain, &imgc, imgs);
+
     for (int i = 0; i < imgc; i++) {
-        VkImageViewCreateInfo create_info = {
-            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-            .image = imgs[i],
-            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        vulkan_imageview(device, imgs[i], format, VK_IMAGE_ASPECT_COLOR_BIT,
+                         &ivs[i]);
+    }
+
+    *image_count = imgc;
+    *images = imgs;
+    *image_views = ivs;
+}
+
+/* Color targets standing in for swapchain images when headless, one per
+ * frame in flight so consecutive frames never write the same image. */
+void vulkan_offscreen(struct mem_allocator *ma, struct arena *arena,
+                      VkFormat format, VkExtent2D extent,
+                      uint32_t image_count,
+                      VkImage **images, struct mem_alloc **image_mems,
+                      VkImageView **image_views) {
+    VkImage *imgs = arena_alloc(arena, image_count*sizeof(*imgs));
+    struct mem_alloc *mems = arena_alloc(arena, image_count*sizeof(*mems));
+    VkImageView *ivs = arena_alloc(arena, image_count*sizeof(*ivs));
+
+    for (int i = 0; i < image_count; i++) {
+        VkImageCreateInfo create_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
             .format = format,
-            .components = components,
-            .subresourceRange = range,
+            .extent = { extent.width, extent.height, 1 },
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                     VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                     VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
         };
-
-        if (vkCreateImageView(device, &create_info, NULL, &ivs[i])
+        if (vkCreateImage(ma->device, &create_info, vk_allocator, &imgs[i])
                 != VK_SUCCESS)
-            die("failed to create imageview %d", i);
+            die("failed to create offscreen image %d", i);
+
+        VkMemoryRequirements mem_reqs;
+        vkGetImageMemoryRequirements(ma->device, imgs[i], &mem_reqs);
+        mem_alloc(ma, mem_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+                  &mems[i]);
+        vkBindImageMemory(ma->device, imgs[i], mems[i].memory, mems[i].offset);
+
+        vulkan_imageview(ma->device, imgs[i], format,
+                         VK_IMAGE_ASPECT_COLOR_BIT, &ivs[i]);
     }
 
-    *image_count = imgc;
     *images = imgs;
+    *image_mems = mems;
     *image_views = ivs;
 }
 
-void vulkan_renderpass(VkDevice device, VkFormat format,
-                       VkRenderPass *renderpass) {
-    VkAttachmentDescription color_attachment = {
-        .format = format,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+/* reverse-z gets most of its precision from a float format */
+void vulkan_depth_format(VkPhysicalDevice physical, VkFormat *format) {
+    const VkFormat candidates[] = {
+        VK_FORMAT_D32_SFLOAT,
+        VK_FORMAT_D32_SFLOAT_S8_UINT,
+        VK_FORMAT_D24_UNORM_S8_UINT,
     };
+    for (int i = 0; i < sizeof(candidates)/sizeof(*candidates); i++) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(physical, candidates[i], &props);
+        if (props.optimalTilingFeatures &
+                VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+            *format = candidates[i];
+            return;
+        }
+    }
+    die("no supported depth format");
+}
 
-    VkAttachmentReference color_attachment_ref = {
-        .attachment = 0,
-        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-    };
-    VkSubpassDescription subpass = {
-        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-        .colorAttachmentCount = 1,
-        .pColorAttachments = &color_attachment_ref,
-    };
+/* the most samples up to wanted both color and depth attachments take */
+void vulkan_samples(VkPhysicalDevice physical, uint32_t wanted,
+                    VkSampleCountFlagBits *samples) {
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physical, &props);
+    VkSampleCountFlags counts = props.limits.framebufferColorSampleCounts &
+                                props.limits.framebufferDepthSampleCounts;
+    uint32_t count = wanted;
+    while (count > 1 && !(counts & count))
+        count >>= 1;
+    *samples = count;
+}
 
-    VkSubpassDependency dependency = {
-        .srcSubpass = VK_SUBPASS_EXTERNAL,
-        .dstSubpass = 0,
-        .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
-        .srcAccessMask = 0,
-        .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-                         VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
-    };
+/* upscaling blits, filtered linearly where the format allows */
+void vulkan_blit_filter(VkPhysicalDevice physical, VkFormat format,
+                        VkFilter *filter) {
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(physical, format, &props);
+    VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                                VK_FORMAT_FEATURE_BLIT_DST_BIT;
+    if ((props.optimalTilingFeatures & blit) != blit)
+        die("format %d cannot be blitted", format);
+    *filter = props.optimalTilingFeatures &
+              VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT
+        ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+}
 
-    VkRenderPassCreateInfo create_info = {
-        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-        .attachmentCount = 1,
-        .pAttachments = &color_attachment,
-        .subpassCount = 1,
-        .pSubpasses = &subpass,
-        .dependencyCount = 1,
-        .pDependencies = &dependency
+static uint32_t read_u32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Load a previously saved cache. The driver is supposed to reject
+ * incompatible data itself, but some do not, so check the header against
+ * the device first and start empty on any mismatch. */
+void vulkan_pipeline_cache(VkDevice device, VkPhysicalDevice physical,
+                           const char *path, VkPipelineCache *cache) {
+    void *data = NULL;
+    size_t length = 0;
+
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        rewind(f);
+        if (size > 0) {
+            data = malloc(size);
+            if (data && fread(data, 1, size, f) == size)
+                length = size;
+        }
+        fclose(f);
+    }
+
+    const size_t header_size = 16 + VK_UUID_SIZE;
+    if (length > 0) {
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceProperties(physical, &props);
+
+        const unsigned char *header = data;
+        if (length < header_size ||
+            read_u32(header) < header_size ||
+            read_u32(header+4) != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+            read_u32(header+8) != props.vendorID ||
+            read_u32(header+12) != props.deviceID ||
+            memcmp(header+16, props.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+            printf("discarding stale pipeline cache %s\n", path);
+            length = 0;
+        } else {
+            printf("loaded pipeline cache %s (%zu bytes)\n", path, length);
+        }
+    }
+
+    VkPipelineCacheCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = length,
+        .pInitialData = length > 0 ? data : NULL
     };
-    if (vkCreateRenderPass(device, &create_info, NULL, renderpass)
+    if (vkCreatePipelineCache(device, &create_info, vk_allocator, cache)
             != VK_SUCCESS)
-        die("failed to create render pass");
+        die("failed to create pipeline cache");
+
+    free(data);
 }
 
-void vulkan_shader_module(VkDevice device, const char *path,
-                          VkShaderModule *module) {
-    FILE *f = fopen(path, "r");
-    fseek(f, 0, SEEK_END);
-    size_t length = ftell(f);
-    rewind(f);
+void vulkan_pipeline_cache_save(VkDevice device, VkPipelineCache cache,
+                                const char *path) {
+    size_t length;
+    if (vkGetPipelineCacheData(device, cache, &length, NULL) != VK_SUCCESS ||
+        length == 0)
+        return;
+    void *data = malloc(length);
+    if (!data ||
+        vkGetPipelineCacheData(device, cache, &length, data) != VK_SUCCESS) {
+        free(data);
+        return;
+    }
 
-    if (length % 4 != 0) die("bytecode at %s unaligned", path);
+    /* write to a temporary and rename so a crash never leaves a torn file */
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        fprintf(stderr, "warning: failed to write pipeline cache %s\n",
+                tmp_path);
+    } else {
+        bool ok = fwrite(data, 1, length, f) == length;
+        ok = fclose(f) == 0 && ok;
+        if (!ok || rename(tmp_path, path) != 0) {
+            fprintf(stderr, "warning: failed to write pipeline cache %s\n",
+                    path);
+            remove(tmp_path);
+        }
+    }
 
-    uint32_t *bytecode = malloc(length);
-    fread((void*)bytecode, 1, length, f);
-    fclose(f);
+    free(data);
+}
 
-    VkShaderModuleCreateInfo create_info = {
-        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-        .codeSize = length,
-        .pCode = bytecode,
+/* set 0 holds the frame's uniforms, set 1 the bindless set if any */
+void vulkan_pipeline_layout(VkDevice device, uint32_t set_layoutc,
+                            const VkDescriptorSetLayout *set_layouts,
+                            VkPipelineLayout *layout) {
+    VkPushConstantRange push_range = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+                      VK_SHADER_STAGE_FRAGMENT_BIT,
+        .offset = 0,
+        .size = sizeof(struct draw_push)
     };
-
-    if (vkCreateShaderModule(device, &create_info, NULL, module) != VK_SUCCESS)
-        die("failed to create shader module for %s", path);
-
-    free(bytecode);
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = set_layoutc,
+        .pSetLayouts = set_layouts,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_range
+    };
+    if (vkCreatePipelineLayout(device, &layout_info, vk_allocator, layout)
+            != VK_SUCCESS)
+        die("failet to create pipeline layout");
 }
 
-void vulkan_pipeline(VkDevice device, VkExtent2D extent,
-                     VkRenderPass renderpass,
-                     VkDescriptorSetLayout descset_layout,
-                     VkPipelineLayout *layout, VkPipeline *pipeline) {
-    VkShaderModule vert, frag;
-    vulkan_shader_module(device, "triangle/shader.vert.spv", &vert);
-    vulkan_shader_module(device, "triangle/shader.frag.spv", &frag);
+/* The graphics variant for key, frag_path is NULL for a depth only one.
+ * Both stages get every feature constant, each uses those it declares.
+ * Safe to call from several threads at once. */
+void vulkan_pipeline(VkDevice device, struct shader_cache *shaders,
+                     VkPipelineCache cache, VkRenderPass renderpass,
+                     const struct variant_key *key,
+                     const char *vert_path, const char *frag_path,
+                     VkPipelineLayout layout, VkPipeline *pipeline) {
+    bool depth_only = key->flags & VARIANT_DEPTH_ONLY;
+    bool depth_equal = key->flags & VARIANT_DEPTH_EQUAL;
+    VkShaderModule vert = shader_module(shaders, vert_path);
+    VkShaderModule frag = depth_only ? VK_NULL_HANDLE
+                                     : shader_module(shaders, frag_path);
+    struct variant_spec spec;
+    variant_specialization(key, &spec);
 
     VkPipelineShaderStageCreateInfo shader_stages[] = {
         {
@@ -440,42 +1190,78 @@ void vulkan_pipeline(VkDevice device, VkExtent2D extent,
             .stage = VK_SHADER_STAGE_VERTEX_BIT,
             .module = vert,
             .pName = "main",
-            .pSpecializationInfo = NULL
+            .pSpecializationInfo = &spec.info
         },
         {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
             .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
             .module = frag,
             .pName = "main",
-            .pSpecializationInfo = NULL
+            .pSpecializationInfo = &spec.info
         }
     };
 
-    VkVertexInputBindingDescription bind_desc = {
-        .binding = 0,
-        .stride = sizeof(struct vertex),
-        .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+    VkVertexInputBindingDescription bind_descs[] = {
+        {
+            .binding = 0,
+            .stride = sizeof(struct mesh_vertex),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+        },
+        {
+            .binding = 1,
+            .stride = sizeof(struct instance),
+            .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
+        }
     };
 
+#define VERTEX_ATTRIBUTE(name, loc, type, count, fmt, glsl, encoding) \
+        { \
+            .binding = 0, \
+            .location = loc, \
+            .format = fmt, \
+            .offset = offsetof(struct mesh_vertex, name) \
+        },
     VkVertexInputAttributeDescription attr_descs[] = {
+        VERTEX_ATTRIBUTES(VERTEX_ATTRIBUTE)
+        /* a mat4 attribute takes one location per column */
         {
-            .binding = 0,
-            .location = 0,
-            .format = VK_FORMAT_R32G32_SFLOAT,
-            .offset = offsetof(struct vertex, pos)
+            .binding = 1,
+            .location = VERTEX_LOCATIONS,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = offsetof(struct instance, model[0])
         },
         {
-            .binding = 0,
-            .location = 1,
+            .binding = 1,
+            .location = VERTEX_LOCATIONS + 1,
             .format = VK_FORMAT_R32G32B32A32_SFLOAT,
-            .offset = offsetof(struct vertex, col)
+            .offset = offsetof(struct instance, model[1])
+        },
+        {
+            .binding = 1,
+            .location = VERTEX_LOCATIONS + 2,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = offsetof(struct instance, model[2])
+        },
+        {
+            .binding = 1,
+            .location = VERTEX_LOCATIONS + 3,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = offsetof(struct instance, model[3])
+        },
+        {
+            .binding = 1,
+            .location = VERTEX_LOCATIONS + 4,
+            .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+            .offset = offsetof(struct instance, col)
         }
     };
+#undef VERTEX_ATTRIBUTE
 
     VkPipelineVertexInputStateCreateInfo vertex_input = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount = 1,
-        .pVertexBindingDescriptions = &bind_desc,
+        .vertexBindingDescriptionCount =
+            sizeof(bind_descs)/sizeof(*bind_descs),
+        .pVertexBindingDescriptions = bind_descs,
         .vertexAttributeDescriptionCount =
             sizeof(attr_descs)/sizeof(*attr_descs),
         .pVertexAttributeDescriptions = attr_descs
@@ -487,24 +1273,14 @@ void vulkan_pipeline(VkDevice device, VkExtent2D extent,
         .primitiveRestartEnable = VK_FALSE
     };
 
-    VkRect2D scissor = {
-        .offset = {0, 0},
-        .extent = extent
-    };
-    VkViewport viewport = {
-        .x = 0,
-        .y = 0,
-        .width = extent.width,
-        .height = extent.height,
-        .minDepth = 0,
-        .maxDepth = 1
-    };
+    /* viewport and scissor are dynamic so the pipeline does not depend on
+     * the swapchain extent */
     VkPipelineViewportStateCreateInfo viewport_state = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
         .viewportCount = 1,
-        .pViewports = &viewport,
+        .pViewports = NULL,
         .scissorCount = 1,
-        .pScissors = &scissor
+        .pScissors = NULL
     };
 
     VkPipelineRasterizationStateCreateInfo rasterizer = {
@@ -512,7 +1288,8 @@ void vulkan_pipeline(VkDevice device, VkExtent2D extent,
         .depthClampEnable = VK_FALSE,
         .rasterizerDiscardEnable = VK_FALSE,
         .polygonMode = VK_POLYGON_MODE_FILL,
-        .cullMode = VK_CULL_MODE_NONE,
+        .cullMode = key->flags & VARIANT_CULL_BACK ? VK_CULL_MODE_BACK_BIT
+                                                   : VK_CULL_MODE_NONE,
         .frontFace = VK_FRONT_FACE_CLOCKWISE,
         .depthBiasEnable = VK_FALSE,
         .depthBiasConstantFactor = 0,
@@ -523,7 +1300,7 @@ void vulkan_pipeline(VkDevice device, VkExtent2D extent,
 
     VkPipelineMultisampleStateCreateInfo multisampling = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+        .rasterizationSamples = key->samples,
         .sampleShadingEnable = VK_FALSE,
         .minSampleShading = 1,
         .pSampleMask = NULL,
@@ -532,7 +1309,7 @@ void vulkan_pipeline(VkDevice device, VkExtent2D extent,
     };
 
     VkPipelineColorBlendAttachmentState blend_attachment = {
-        .blendEnable = VK_TRUE,
+        .blendEnable = key->flags & VARIANT_BLEND ? VK_TRUE : VK_FALSE,
         .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
         .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
         .colorBlendOp = VK_BLEND_OP_ADD,
@@ -552,32 +1329,37 @@ void vulkan_pipeline(VkDevice device, VkExtent2D extent,
         .blendConstants = {0,0,0,0}
     };
 
-    /*
+    VkPipelineColorBlendStateCreateInfo no_blending = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .attachmentCount = 0,
+    };
+
+    /* reverse-z, nearer is greater */
+    VkPipelineDepthStencilStateCreateInfo depth_stencil = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+        .depthTestEnable = VK_TRUE,
+        .depthWriteEnable = depth_equal ? VK_FALSE : VK_TRUE,
+        .depthCompareOp = depth_equal ? VK_COMPARE_OP_EQUAL
+                                      : VK_COMPARE_OP_GREATER_OR_EQUAL,
+        .depthBoundsTestEnable = VK_FALSE,
+        .stencilTestEnable = VK_FALSE,
+        .minDepthBounds = 0,
+        .maxDepthBounds = 1
+    };
+
     VkDynamicState dyn_states[] = {
         VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_LINE_WIDTH
+        VK_DYNAMIC_STATE_SCISSOR
     };
     VkPipelineDynamicStateCreateInfo dyn_state = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-        .dynamicStateCount = 2,
+        .dynamicStateCount = sizeof(dyn_states)/sizeof(*dyn_states),
         .pDynamicStates = dyn_states,
     };
-    */
-
-    VkPipelineLayoutCreateInfo layout_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts = &descset_layout,
-        .pushConstantRangeCount = 0,
-        .pPushConstantRanges = NULL
-    };
-    if (vkCreatePipelineLayout(device, &layout_info, NULL, layout)
-            != VK_SUCCESS)
-        die("failet to create pipeline layout");
 
     VkGraphicsPipelineCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        .stageCount = 2,
+        .stageCount = depth_only ? 1 : 2,
         .pStages = shader_stages,
         .pVertexInputState = &vertex_input,
         .pInputAssemblyState = &input_assembly,
@@ -585,297 +1367,327 @@ void vulkan_pipeline(VkDevice device, VkExtent2D extent,
         .pViewportState = &viewport_state,
         .pRasterizationState = &rasterizer,
         .pMultisampleState = &multisampling,
-        .pDepthStencilState = NULL,
-        .pColorBlendState = &blending,
-        .pDynamicState = NULL,
-        .layout = *layout,
+        .pDepthStencilState = &depth_stencil,
+        .pColorBlendState = depth_only ? &no_blending : &blending,
+        .pDynamicState = &dyn_state,
+        .layout = layout,
         .renderPass = renderpass,
-        .subpass = 0,
+        .subpass = key->subpass,
         .basePipelineHandle = VK_NULL_HANDLE,
         .basePipelineIndex = -1
     };
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &create_info,
-                                  NULL, pipeline) != VK_SUCCESS)
+    if (vkCreateGraphicsPipelines(device, cache, 1, &create_info,
+                                  vk_allocator, pipeline) != VK_SUCCESS)
         die("failed to create pipeline");
-
-    vkDestroyShaderModule(device, vert, NULL);
-    vkDestroyShaderModule(device, frag, NULL);
 }
 
-void vulkan_framebufs(VkDevice device, size_t image_count,
-                         VkImageView *image_views, VkRenderPass renderpass,
-                         VkExtent2D extent,
-                         VkFramebuffer **frame_bufs) {
-    VkFramebuffer *fbs = malloc(image_count*sizeof(*fbs));
-
-    for (int i = 0; i < image_count; i++) {
-        VkFramebufferCreateInfo create_info = {
-            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .renderPass = renderpass,
-            .attachmentCount = 1,
-            .pAttachments = &image_views[i],
-            .width = extent.width,
-            .height = extent.height,
-            .layers = 1
-        };
-        if (vkCreateFramebuffer(device, &create_info, NULL, &fbs[i])
-                != VK_SUCCESS)
-            die("failed to create framebuffer %d", i);
-    }
+void vulkan_cull_pipeline_layout(VkDevice device,
+                                 VkDescriptorSetLayout descset_layout,
+                                 VkPipelineLayout *layout) {
+    VkPipelineLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &descset_layout,
+    };
+    if (vkCreatePipelineLayout(device, &layout_info, vk_allocator, layout)
+            != VK_SUCCESS)
+        die("failed to create cull pipeline layout");
+}
 
-    *frame_bufs = fbs;
+void vulkan_cull_pipeline(VkDevice device, struct shader_cache *shaders,
+                          VkPipelineCache cache, const char *comp_path,
+                          VkPipelineLayout layout, VkPipeline *pipeline) {
+    VkShaderModule comp = shader_module(shaders, comp_path);
+    VkComputePipelineCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = comp,
+            .pName = "main",
+        },
+        .layout = layout,
+        .basePipelineHandle = VK_NULL_HANDLE,
+        .basePipelineIndex = -1
+    };
+    if (vkCreateComputePipelines(device, cache, 1, &create_info,
+                                 vk_allocator, pipeline) != VK_SUCCESS)
+        die("failed to create cull pipeline");
 }
 
-void vulkan_cmdpool(VkDevice device, VkCommandPool *pool) {
+void vulkan_cmdpool(VkDevice device, uint32_t family, VkCommandPool *pool) {
     VkCommandPoolCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .queueFamilyIndex = 0
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = family
     };
 
-    if (vkCreateCommandPool(device, &create_info, NULL, pool) != VK_SUCCESS)
+    if (vkCreateCommandPool(device, &create_info, vk_allocator, pool)
+            != VK_SUCCESS)
         die("failed to create command pool");
 }
 
-void vulkan_buffer_create(VkDevice device, VkPhysicalDevice physical,
-                          VkDeviceSize size, VkBufferUsageFlags usage,
-                          VkMemoryPropertyFlags props,
-                          VkBuffer *buffer, VkDeviceMemory *buffer_mem) {
-    VkBufferCreateInfo create_info = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = size,
-        .usage = usage,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-    };
-    if (vkCreateBuffer(device, &create_info, NULL, buffer) != VK_SUCCESS)
-        die("failed to create vertex buffer");
+/* Transient pools are cheaper to reset wholesale than buffer by buffer,
+ * and each is only ever touched by the one thread recording its slice.
+ * Every pool holds the recorder's buffer for each subpass. */
+void vulkan_recorders(VkDevice device, uint32_t family,
+                      uint32_t frame_count, uint32_t recorder_count,
+                      uint32_t subpass_count,
+                      VkCommandPool pools[][MAX_RECORDERS],
+                      VkCommandBuffer
+                          cmdbufs[][MAX_SUBPASSES][MAX_RECORDERS]) {
+    for (uint32_t f = 0; f < frame_count; f++) {
+        for (uint32_t i = 0; i < recorder_count; i++) {
+            VkCommandPoolCreateInfo create_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                .queueFamilyIndex = family
+            };
+            if (vkCreateCommandPool(device, &create_info, vk_allocator,
+                                    &pools[f][i]) != VK_SUCCESS)
+                die("failed to create command pool for recorder %u", i);
+
+            VkCommandBufferAllocateInfo alloc_info = {
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = pools[f][i],
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1,
+            };
+            for (uint32_t s = 0; s < subpass_count; s++) {
+                if (vkAllocateCommandBuffers(device, &alloc_info,
+                                             &cmdbufs[f][s][i]) != VK_SUCCESS)
+                    die("failed to allocate secondary command buffer");
+            }
+        }
+    }
+}
 
-    VkMemoryRequirements mem_reqs;
-    vkGetBufferMemoryRequirements(device, *buffer, &mem_reqs);
-    VkPhysicalDeviceMemoryProperties mem_props;
-    vkGetPhysicalDeviceMemoryProperties(physical, &mem_props);
+/* a cached mesh is copied from its mapping straight into staging */
+void vulkan_vertexbuf(struct mem_allocator *ma, struct upload_queue *uq,
+                      uint32_t familyc, const uint32_t *families,
+                      const struct mesh *mesh,
+                      VkBuffer *buf, struct mem_alloc *buf_mem) {
+    size_t buf_size = mesh->vertexc*sizeof(struct mesh_vertex);
 
-    uint32_t mem_index = -1;
-    for (uint32_t i = 0; i < mem_props.memoryTypeCount; i++) {
-        if (~mem_reqs.memoryTypeBits & (1 << i))
-            continue;
-        if ((mem_props.memoryTypes[i].propertyFlags & props) != props)
-            continue;
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    mem_buffer_create(ma, buf_size, usage, props, familyc, families,
+                      buf, buf_mem);
 
-        mem_index = i;
-        break;
-    }
-    if (mem_index < 0)
-        die("failed to find compatible memory type");
+    upload_buffer(uq, *buf, 0, mesh->vertices, buf_size);
+}
+
+void vulkan_indexbuf(struct mem_allocator *ma, struct upload_queue *uq,
+                     uint32_t familyc, const uint32_t *families,
+                     const struct mesh *mesh,
+                     VkBuffer *buf, struct mem_alloc *buf_mem) {
+    size_t buf_size = (size_t)mesh->indexc*mesh->index_size;
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                               VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+    VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    mem_buffer_create(ma, buf_size, usage, props, familyc, families,
+                      buf, buf_mem);
+
+    upload_buffer(uq, *buf, 0, mesh->indices, buf_size);
+}
 
-    VkMemoryAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize = mem_reqs.size,
-        .memoryTypeIndex = mem_index
+/* sampled rgba8 image, shared with the upload family so its ownership
+ * never has to be transferred */
+void vulkan_texture(struct mem_allocator *ma, struct upload_queue *uq,
+                    uint32_t familyc, const uint32_t *families,
+                    VkExtent2D extent, const uint32_t *texels,
+                    VkImage *image, struct mem_alloc *image_mem,
+                    VkImageView *image_view) {
+    VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+    VkImageCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent = { extent.width, extent.height, 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                 VK_IMAGE_USAGE_SAMPLED_BIT,
+        .sharingMode = familyc > 1 ? VK_SHARING_MODE_CONCURRENT
+                                   : VK_SHARING_MODE_EXCLUSIVE,
+        .queueFamilyIndexCount = familyc > 1 ? familyc : 0,
+        .pQueueFamilyIndices = families,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
     };
-    if (vkAllocateMemory(device, &alloc_info, NULL, buffer_mem) != VK_SUCCESS)
-        die("failed to allocate memory for vertex buffer");
+    if (vkCreateImage(ma->device, &create_info, vk_allocator, image)
+            != VK_SUCCESS)
+        die("failed to create texture image");
 
-    vkBindBufferMemory(device, *buffer, *buffer_mem, 0);
+    VkMemoryRequirements mem_reqs;
+    vkGetImageMemoryRequirements(ma->device, *image, &mem_reqs);
+    mem_alloc(ma, mem_reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false,
+              image_mem);
+    vkBindImageMemory(ma->device, *image, image_mem->memory,
+                      image_mem->offset);
+
+    vulkan_imageview(ma->device, *image, format, VK_IMAGE_ASPECT_COLOR_BIT,
+                     image_view);
+    upload_image(uq, *image, extent, texels,
+                 (VkDeviceSize)extent.width*extent.height*sizeof(*texels));
 }
 
-void vulkan_buffer_copy(VkDevice device, VkQueue queue,
-                        VkBuffer dst, VkBuffer src, VkDeviceSize size) {
-    VkCommandPoolCreateInfo pool_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
-        .queueFamilyIndex = 0
+void vulkan_sampler(VkDevice device, VkSampler *sampler) {
+    VkSamplerCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_LINEAR,
+        .minFilter = VK_FILTER_LINEAR,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .maxLod = 0,
     };
-    VkCommandPool pool;
-    if (vkCreateCommandPool(device, &pool_info, NULL, &pool) != VK_SUCCESS)
-        die("failed to create transient command pool during copy");
+    if (vkCreateSampler(device, &create_info, vk_allocator, sampler)
+            != VK_SUCCESS)
+        die("failed to create sampler");
+}
 
-    VkCommandBufferAllocateInfo alloc_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandPool = pool,
-        .commandBufferCount = 1
-    };
-
-    VkCommandBuffer cmdbuf;
-    vkAllocateCommandBuffers(device, &alloc_info, &cmdbuf);
-    VkCommandBufferBeginInfo begin_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
-    };
-    vkBeginCommandBuffer(cmdbuf, &begin_info);
-
-    VkBufferCopy copy_region = {
-        .srcOffset = 0,
-        .dstOffset = 0,
-        .size = size
-    };
-    vkCmdCopyBuffer(cmdbuf, src, dst, 1, &copy_region);
-    vkEndCommandBuffer(cmdbuf);
-
-    VkSubmitInfo submit_info = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &cmdbuf
-    };
-    vkQueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE);
-    vkQueueWaitIdle(queue);
-
-    vkFreeCommandBuffers(device, pool, 1, &cmdbuf);
-    vkDestroyCommandPool(device, pool, NULL);
-}
-
-void vulkan_vertexbuf(VkDevice device, VkPhysicalDevice physical,
-                      VkQueue queue,
-                      VkBuffer *buf, VkDeviceMemory *buf_mem) {
-    size_t buf_size = sizeof(VERTICES);
-
-    VkBuffer staging_buf;
-    VkDeviceMemory staging_buf_mem;
-    VkBufferUsageFlags staging_usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    VkMemoryPropertyFlagBits staging_props =
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-    vulkan_buffer_create(device, physical, buf_size,
-                         staging_usage, staging_props,
-                         &staging_buf, &staging_buf_mem);
+/* Written by the host every frame, so like the uniform buffer it is one
+ * mapped buffer with a slot of MAX_INSTANCES per frame in flight. It is
+ * only read by the cull pass, which copies the visible instances on. */
+void vulkan_instancebuf(struct mem_allocator *ma, uint32_t slot_count,
+                        uint32_t familyc, const uint32_t *families,
+                        VkDeviceSize *slot_stride,
+                        VkBuffer *buf, struct mem_alloc *buf_mem) {
+    VkDeviceSize stride = MAX_INSTANCES*sizeof(struct instance);
 
-    void *data;
-    vkMapMemory(device, staging_buf_mem, 0, buf_size, 0, &data);
-    memcpy(data, VERTICES, buf_size);
-    vkUnmapMemory(device, staging_buf_mem);
-
-    VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                               VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-    VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    vulkan_buffer_create(device, physical, buf_size, usage, props,
-                         buf, buf_mem);
-
-    vulkan_buffer_copy(device, queue, *buf, staging_buf, buf_size);
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    mem_buffer_create(ma, slot_count*stride, usage, props, familyc, families,
+                      buf, buf_mem);
 
-    vkDestroyBuffer(device, staging_buf, NULL);
-    vkFreeMemory(device, staging_buf_mem, NULL);
+    *slot_stride = stride;
 }
 
-void vulkan_indexbuf(VkDevice device, VkPhysicalDevice physical,
-                     VkQueue queue,
-                     VkBuffer *buf, VkDeviceMemory *buf_mem) {
-    size_t buf_size = sizeof(INDICES);
+/* Output of the cull pass: the visible instances compacted per batch,
+ * read as the instance vertex stream, and the indirect draw commands. */
+void vulkan_cullbufs(VkPhysicalDevice physical, struct mem_allocator *ma,
+                     uint32_t slot_count,
+                     uint32_t familyc, const uint32_t *families,
+                     VkBuffer *visible_buf, struct mem_alloc *visible_buf_mem,
+                     VkDeviceSize *draw_stride,
+                     VkBuffer *draw_buf, struct mem_alloc *draw_buf_mem) {
+    VkPhysicalDeviceProperties dev_props;
+    vkGetPhysicalDeviceProperties(physical, &dev_props);
+    VkDeviceSize align = dev_props.limits.minStorageBufferOffsetAlignment;
+    VkDeviceSize stride = CULL_DRAWS_OFFSET +
+        CULL_MAX_BATCHES*sizeof(VkDrawIndexedIndirectCommand);
+    if (align > 0)
+        stride = (stride + align - 1) & ~(align - 1);
 
-    VkBuffer staging_buf;
-    VkDeviceMemory staging_buf_mem;
-    VkBufferUsageFlags staging_usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    VkMemoryPropertyFlagBits staging_props =
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
-    vulkan_buffer_create(device, physical, buf_size,
-                         staging_usage, staging_props,
-                         &staging_buf, &staging_buf_mem);
-
-    void *data;
-    vkMapMemory(device, staging_buf_mem, 0, buf_size, 0, &data);
-    memcpy(data, INDICES, buf_size);
-    vkUnmapMemory(device, staging_buf_mem);
-
-    VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                               VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
     VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    vulkan_buffer_create(device, physical, buf_size, usage, props,
-                         buf, buf_mem);
-
-    vulkan_buffer_copy(device, queue, *buf, staging_buf, buf_size);
-
-    vkDestroyBuffer(device, staging_buf, NULL);
-    vkFreeMemory(device, staging_buf_mem, NULL);
+    mem_buffer_create(ma, slot_count*MAX_INSTANCES*sizeof(struct instance),
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                      props, familyc, families, visible_buf, visible_buf_mem);
+    mem_buffer_create(ma, slot_count*stride,
+                      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                      props, familyc, families, draw_buf, draw_buf_mem);
+
+    *draw_stride = stride;
 }
 
-void vulkan_descpool(VkDevice device, size_t image_count,
-                           VkDescriptorPool *pool) {
-    VkDescriptorPoolSize pool_size = {
-        .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        .descriptorCount = image_count
+void vulkan_descpool(VkDevice device, VkDescriptorPool *pool) {
+    VkDescriptorPoolSize pool_sizes[] = {
+        {
+            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+            .descriptorCount = 2
+        },
+        {
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+            .descriptorCount = 3
+        }
     };
 
     VkDescriptorPoolCreateInfo pool_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .poolSizeCount = 1,
-        .pPoolSizes = &pool_size,
-        .maxSets = image_count,
+        .poolSizeCount = sizeof(pool_sizes)/sizeof(*pool_sizes),
+        .pPoolSizes = pool_sizes,
+        .maxSets = 2,
     };
 
-    if (vkCreateDescriptorPool(device, &pool_info, NULL, pool) != VK_SUCCESS)
+    if (vkCreateDescriptorPool(device, &pool_info, vk_allocator, pool)
+            != VK_SUCCESS)
         die("failed to create desc pool");
 }
 
-void vulkan_descsets(VkDevice device, size_t image_count,
+void vulkan_descsets(VkDevice device,
                      VkDescriptorPool pool, VkDescriptorSetLayout layout,
-                     VkBuffer *uniform_bufs,
-                     VkDescriptorSet **descsets) {
-    VkDescriptorSetLayout *layouts = malloc(image_count*sizeof(*layouts));
-    for (int i = 0; i < image_count; i++) {
-        layouts[i] = layout;
-    }
-
+                     VkBuffer uniform_buf,
+                     VkDescriptorSet *descset) {
     VkDescriptorSetAllocateInfo alloc_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
         .descriptorPool = pool,
-        .descriptorSetCount = image_count,
-        .pSetLayouts = layouts
+        .descriptorSetCount = 1,
+        .pSetLayouts = &layout
     };
-    VkDescriptorSet *sets = malloc(image_count*sizeof(*sets));
-    if (vkAllocateDescriptorSets(device, &alloc_info, sets) != VK_SUCCESS)
+    if (vkAllocateDescriptorSets(device, &alloc_info, descset) != VK_SUCCESS)
         die("failed to allocate descriptor sets");
-    free(layouts);
 
-    for (int i = 0; i < image_count; i++) {
-        VkDescriptorBufferInfo buf_info = {
-            .buffer = uniform_bufs[i],
-            .offset = 0,
-            .range = VK_WHOLE_SIZE,
-        };
-        VkWriteDescriptorSet desc_write = {
-            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = sets[i],
-            .dstBinding = 0,
-            .dstArrayElement = 0,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-            .descriptorCount = 1,
-            .pBufferInfo = &buf_info,
-            .pImageInfo = NULL,
-            .pTexelBufferView = NULL,
-        };
-        vkUpdateDescriptorSets(device, 1, &desc_write, 0, NULL);
-    }
-
-    *descsets = sets;
+    /* one slot of the arena, selected by the dynamic offset at bind */
+    VkDescriptorBufferInfo buf_info = {
+        .buffer = uniform_buf,
+        .offset = 0,
+        .range = sizeof(struct uniform_buf_obj),
+    };
+    VkWriteDescriptorSet desc_write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = *descset,
+        .dstBinding = 0,
+        .dstArrayElement = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .descriptorCount = 1,
+        .pBufferInfo = &buf_info,
+        .pImageInfo = NULL,
+        .pTexelBufferView = NULL,
+    };
+    vkUpdateDescriptorSets(device, 1, &desc_write, 0, NULL);
 }
 
-void vulkan_uniformbufs(VkDevice device, VkPhysicalDevice physical,
-                        uint32_t image_count,
-                        VkBuffer **uniform_bufs,
-                        VkDeviceMemory **uniform_bufs_mem) {
-    size_t buf_size = sizeof(struct uniform_buf_obj);
-    VkBuffer *bufs = malloc(image_count*sizeof(*bufs));
-    VkDeviceMemory *bufs_mem = malloc(image_count*sizeof(*bufs_mem));
+/* One host visible buffer holding a ubo slot per frame, mapped for its whole
+ * lifetime by the allocator. Slots are padded to
+ * minUniformBufferOffsetAlignment so each can be selected with a dynamic
+ * offset. */
+void vulkan_uniformbufs(VkPhysicalDevice physical,
+                        struct mem_allocator *ma,
+                        uint32_t slot_count,
+                        uint32_t familyc, const uint32_t *families,
+                        VkDeviceSize *slot_stride,
+                        VkBuffer *uniform_buf,
+                        struct mem_alloc *uniform_buf_mem) {
+    VkPhysicalDeviceProperties dev_props;
+    vkGetPhysicalDeviceProperties(physical, &dev_props);
+    VkDeviceSize align = dev_props.limits.minUniformBufferOffsetAlignment;
+    VkDeviceSize stride = sizeof(struct uniform_buf_obj);
+    if (align > 0)
+        stride = (stride + align - 1) & ~(align - 1);
 
     VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
     VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
                                   VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    mem_buffer_create(ma, slot_count*stride, usage, props, familyc, families,
+                      uniform_buf, uniform_buf_mem);
 
-    for (size_t i = 0; i < image_count; i++) {
-        /* XXX merge to one buffer with offsets? */
-        vulkan_buffer_create(device, physical, buf_size, usage, props,
-                             &bufs[i], &bufs_mem[i]);
-    }
-
-    *uniform_bufs = bufs;
-    *uniform_bufs_mem = bufs_mem;
+    *slot_stride = stride;
 }
 
 void vulkan_descsetlayout(VkDevice device,
                                 VkDescriptorSetLayout *layout) {
     VkDescriptorSetLayoutBinding binding = {
         .binding = 0,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
         .descriptorCount = 1,
         .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
         .pImmutableSamplers = NULL,
@@ -886,168 +1698,721 @@ void vulkan_descsetlayout(VkDevice device,
         .bindingCount = 1,
         .pBindings = &binding
     };
-    if (vkCreateDescriptorSetLayout(device, &layout_info, NULL, layout))
+    if (vkCreateDescriptorSetLayout(device, &layout_info, vk_allocator,
+                                    layout))
         die("failed to create desc set layout");
 }
 
-void vulkan_cmdbufs(VkDevice device, size_t image_count,
-                    VkRenderPass renderpass, VkPipeline pipeline,
-                    VkPipelineLayout pipeline_layout,
-                    VkExtent2D extent,
-                    VkBuffer vertex_buf, VkBuffer index_buf,
-                    VkFramebuffer *frame_bufs, VkCommandPool pool,
-                    VkDescriptorSet *descsets,
-                    VkCommandBuffer **command_bufs) {
-    VkCommandBuffer *cbs = malloc(image_count*sizeof(*cbs));
+/* ubo, host instances, visible instances, draws; all dynamic so a frame
+ * picks its slots at bind */
+void vulkan_cull_descsetlayout(VkDevice device,
+                               VkDescriptorSetLayout *layout) {
+    VkDescriptorSetLayoutBinding bindings[4];
+    for (int i = 0; i < 4; i++) {
+        VkDescriptorSetLayoutBinding binding = {
+            .binding = i,
+            .descriptorType = i == 0
+                ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+                : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .pImmutableSamplers = NULL,
+        };
+        bindings[i] = binding;
+    }
 
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 4,
+        .pBindings = bindings
+    };
+    if (vkCreateDescriptorSetLayout(device, &layout_info, vk_allocator,
+                                    layout))
+        die("failed to create cull desc set layout");
+}
+
+void vulkan_cull_descsets(VkDevice device,
+                          VkDescriptorPool pool, VkDescriptorSetLayout layout,
+                          VkBuffer uniform_buf, VkBuffer instance_buf,
+                          VkBuffer visible_buf, VkBuffer draw_buf,
+                          VkDeviceSize draw_stride,
+                          VkDescriptorSet *descset) {
+    VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &layout
+    };
+    if (vkAllocateDescriptorSets(device, &alloc_info, descset) != VK_SUCCESS)
+        die("failed to allocate cull descriptor sets");
+
+    VkDeviceSize instances_size = MAX_INSTANCES*sizeof(struct instance);
+    VkDescriptorBufferInfo buf_infos[] = {
+        { uniform_buf, 0, sizeof(struct uniform_buf_obj) },
+        { instance_buf, 0, instances_size },
+        { visible_buf, 0, instances_size },
+        { draw_buf, 0, draw_stride },
+    };
+    VkWriteDescriptorSet desc_writes[4];
+    for (int i = 0; i < 4; i++) {
+        VkWriteDescriptorSet desc_write = {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = *descset,
+            .dstBinding = i,
+            .dstArrayElement = 0,
+            .descriptorType = i == 0
+                ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
+                : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+            .descriptorCount = 1,
+            .pBufferInfo = &buf_infos[i],
+        };
+        desc_writes[i] = desc_write;
+    }
+    vkUpdateDescriptorSets(device, 4, desc_writes, 0, NULL);
+}
+
+void vulkan_cmdbufs(VkDevice device, VkCommandPool pool, uint32_t count,
+                    VkCommandBuffer *command_bufs) {
     VkCommandBufferAllocateInfo alloc_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
         .commandPool = pool,
         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = image_count,
+        .commandBufferCount = count,
     };
-    if (vkAllocateCommandBuffers(device, &alloc_info, cbs) != VK_SUCCESS)
+    if (vkAllocateCommandBuffers(device, &alloc_info, command_bufs)
+            != VK_SUCCESS)
         die("failed to allocate command bufs");
+}
 
-    for (size_t i = 0; i < image_count; i++) {
-        VkCommandBufferBeginInfo cb_begin_info = {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-            .flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
-            .pInheritanceInfo = NULL,
-        };
-        if (vkBeginCommandBuffer(cbs[i], &cb_begin_info) != VK_SUCCESS)
-            die("failed to begin recording command buffer %d", i);
+void vulkan_semaphores(VkDevice device, struct arena *arena, size_t count,
+                       VkSemaphore **semaphores) {
+    VkSemaphore *semas = arena_alloc(arena, count*sizeof(VkSemaphore));
 
-        VkClearValue clear_color = {
-            .color = {
-                .float32 = {0, 0, 0, 0}
-            }
-        };
-        VkRenderPassBeginInfo rp_begin_info = {
-            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-            .renderPass = renderpass,
-            .framebuffer = frame_bufs[i],
-            .renderArea = { .offset = {0,0}, .extent = extent },
-            .clearValueCount = 1,
-            .pClearValues = &clear_color
-        };
-        vkCmdBeginRenderPass(cbs[i], &rp_begin_info,
-                             VK_SUBPASS_CONTENTS_INLINE);
+    VkSemaphoreCreateInfo sema_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
+    };
 
-        vkCmdBindPipeline(cbs[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    for (int i = 0; i < count; i++) {
+        if (vkCreateSemaphore(device, &sema_info, vk_allocator, &semas[i])
+                != VK_SUCCESS)
+            die("failed to create semaphore %d", i);
+    }
 
-        VkBuffer vertex_bufs[] = {vertex_buf};
-        VkDeviceSize offsets[] = {0};
-        vkCmdBindVertexBuffers(cbs[i], 0, 1, vertex_bufs, offsets);
+    *semaphores = semas;
+}
 
-        vkCmdBindIndexBuffer(cbs[i], index_buf, 0, VK_INDEX_TYPE_UINT16);
+/* the pipelines in use, the pre-pass only with -z and text with -F */
+uint32_t render_pipelines_active(struct render_handles *rh) {
+    uint32_t mask = PIPELINE_BIT(PIPELINE_SHADE) | PIPELINE_BIT(PIPELINE_CULL);
+    if (rh->opts.prepass)
+        mask |= PIPELINE_BIT(PIPELINE_PREPASS);
+    if (rh->opts.hud_font)
+        mask |= PIPELINE_BIT(PIPELINE_TEXT);
+    return mask;
+}
 
-        vkCmdBindDescriptorSets(cbs[i], VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                pipeline_layout, 0, 1,
-                                &descsets[i], 0, NULL);
+VkPipeline *render_pipeline_slot(struct render_handles *rh,
+                                 enum render_pipeline p) {
+    switch (p) {
+    case PIPELINE_PREPASS: return &rh->prepass_pipeline;
+    case PIPELINE_SHADE: return &rh->pipeline;
+    case PIPELINE_TEXT: return &rh->text_pipeline;
+    default: return &rh->cull_pipeline;
+    }
+}
 
-        vkCmdDrawIndexed(cbs[i],
-                         sizeof(INDICES)/sizeof(*INDICES),
-                         1, 0, 0, 0);
+/* Meshes from files are taken to be closed and opaque, so they are drawn
+ * without blending and with back faces culled. The built in mesh is flat
+ * and translucent, drawn from both sides without lighting. */
+void render_pipeline_key(struct render_handles *rh, enum render_pipeline p,
+                         struct variant_key *key) {
+    bool mesh = rh->opts.mesh != NULL;
+    key->flags = mesh ? VARIANT_CULL_BACK : 0;
+    key->features = mesh ? VARIANT_LIT : 0;
+    key->subpass = 0;
+    key->samples = rh->samples;
+    switch (p) {
+    case PIPELINE_PREPASS:
+        key->flags |= VARIANT_DEPTH_ONLY;
+        break;
+    case PIPELINE_SHADE:
+        if (!mesh)
+            key->flags |= VARIANT_BLEND;
+        if (rh->opts.prepass) {
+            key->flags |= VARIANT_DEPTH_EQUAL;
+            key->subpass = 1;
+        }
+        if (rh->opts.bindless) {
+            key->flags |= VARIANT_BINDLESS;
+            key->features |= VARIANT_TEXTURED;
+        }
+        break;
+    case PIPELINE_TEXT:
+        key->flags = VARIANT_TEXT;
+        key->features = 0;
+        key->subpass = rh->graph.passes[rh->hud_pass].subpass;
+        key->samples = VK_SAMPLE_COUNT_1_BIT;
+        break;
+    default:
+        key->flags = VARIANT_COMPUTE;
+        key->features = 0;
+        key->samples = 0;
+        break;
+    }
+}
 
-        vkCmdEndRenderPass(cbs[i]);
+/* the shader files of a variant, NULL where it has no such stage */
+void render_variant_shaders(const struct variant_key *key,
+                            const char *paths[2]) {
+    paths[0] = paths[1] = NULL;
+    if (key->flags & VARIANT_COMPUTE) {
+        paths[0] = "triangle/cull.comp.spv";
+        return;
+    }
+    if (key->flags & VARIANT_TEXT) {
+        paths[0] = "triangle/text.vert.spv";
+        paths[1] = "triangle/text.frag.spv";
+        return;
+    }
+    paths[0] = "triangle/shader.vert.spv";
+    if (!(key->flags & VARIANT_DEPTH_ONLY))
+        paths[1] = key->flags & VARIANT_BINDLESS
+            ? "triangle/bindless.frag.spv" : "triangle/shader.frag.spv";
+}
 
-        if (vkEndCommandBuffer(cbs[i]) != VK_SUCCESS)
-            die("failed to record to command buffer");
+/* only reads state that is fixed while the render pass is, so variants
+ * are built on the recording threads or the reload thread */
+void render_variant_build(void *arg, const struct variant_key *key,
+                          VkPipeline *pipeline) {
+    struct render_handles *rh = arg;
+    const char *paths[2];
+    render_variant_shaders(key, paths);
+    if (key->flags & VARIANT_COMPUTE)
+        vulkan_cull_pipeline(rh->device, &rh->shaders, rh->pipeline_cache,
+                             paths[0], rh->cull_pipeline_layout, pipeline);
+    else if (key->flags & VARIANT_TEXT)
+        text_pipeline(&rh->text, &rh->shaders, rh->pipeline_cache,
+                      rh->hud_renderpass, key->subpass, paths[0], paths[1],
+                      pipeline);
+    else
+        vulkan_pipeline(rh->device, &rh->shaders, rh->pipeline_cache,
+                        rh->renderpass, key, paths[0], paths[1],
+                        rh->pipeline_layout, pipeline);
+}
+
+bool render_variant_graphics(void *arg, const struct variant_key *key) {
+    return !(key->flags & VARIANT_COMPUTE);
+}
+
+bool render_variant_stale(void *arg, const struct variant_key *key) {
+    struct render_handles *rh = arg;
+    const char *paths[2];
+    render_variant_shaders(key, paths);
+    for (int i = 0; i < 2; i++) {
+        if (paths[i] && shader_stale(&rh->shaders, paths[i]))
+            return true;
     }
+    return false;
+}
 
-    *command_bufs = cbs;
+/* point the pipelines in use at their variants, which are all built */
+void render_pipelines_fetch(struct render_handles *rh) {
+    uint32_t active = render_pipelines_active(rh);
+    for (int p = 0; p < PIPELINE_COUNT; p++) {
+        if (!(active & PIPELINE_BIT(p)))
+            continue;
+        struct variant_key key;
+        render_pipeline_key(rh, p, &key);
+        *render_pipeline_slot(rh, p) = variants_get(&rh->variants, &key);
+    }
 }
 
-void vulkan_synchronization(VkDevice device, size_t image_count,
-                            VkSemaphore **img_available,
-                            VkSemaphore **img_rendered,
-                            VkFence *frm_inflight) {
-    VkSemaphore *imgav = malloc(image_count*sizeof(VkSemaphore));
-    VkSemaphore *imgrn = malloc(image_count*sizeof(VkSemaphore));
+/* build the missing variants of the pipelines in use at once on the
+ * recording threads, drivers compile most of a pipeline in
+ * vkCreate*Pipelines() itself */
+void render_pipelines_build(struct render_handles *rh) {
+    struct variant_key keys[PIPELINE_COUNT];
+    uint32_t count = 0, active = render_pipelines_active(rh);
+    for (int p = 0; p < PIPELINE_COUNT; p++) {
+        if (active & PIPELINE_BIT(p))
+            render_pipeline_key(rh, p, &keys[count++]);
+    }
+    double start = profile_now();
+    uint32_t built = variants_build(&rh->variants, keys, count, &rh->jobs);
+    render_pipelines_fetch(rh);
+    printf("built %u pipeline(s) in %.1f ms\n", built,
+           profile_now() - start);
+}
 
-    VkSemaphoreCreateInfo sema_info = {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
+void *render_reload_thread(void *arg) {
+    struct render_handles *rh = arg;
+    double start = profile_now();
+    rh->reload_count = variants_rebuild(&rh->variants, render_variant_stale,
+                                        rh);
+    rh->reload_time = profile_now() - start;
+
+    pthread_mutex_lock(&rh->reload_lock);
+    rh->reload_done = true;
+    pthread_mutex_unlock(&rh->reload_lock);
+    return NULL;
+}
+
+/* wait for a running reload and swap in what it built, the replaced
+ * pipelines may still be used by frames in flight; the replaced shader
+ * modules are done with once no build is left running */
+void render_reload_finish(struct render_handles *rh) {
+    if (!rh->reloading)
+        return;
+    pthread_join(rh->reload_thread, NULL);
+    rh->reloading = false;
+    shader_cache_collect(&rh->shaders);
+
+    variants_swap(&rh->variants, &rh->retired);
+    render_pipelines_fetch(rh);
+    if (rh->reload_count > 0)
+        printf("reloaded %u pipeline(s) in %.1f ms\n", rh->reload_count,
+               rh->reload_time);
+}
+
+/* Called once per frame in watch mode. Checks the shaders every
+ * RELOAD_PERIOD ms while no reload is running and starts one for the
+ * variants using a changed shader, the frame never waits for it. */
+void render_reload_poll(struct render_handles *rh) {
+    if (rh->reloading) {
+        pthread_mutex_lock(&rh->reload_lock);
+        bool done = rh->reload_done;
+        pthread_mutex_unlock(&rh->reload_lock);
+        if (!done)
+            return;
+        render_reload_finish(rh);
+    }
+
+    double now = profile_now();
+    if (now - rh->reload_polled < RELOAD_PERIOD)
+        return;
+    rh->reload_polled = now;
+    if (shader_cache_poll(&rh->shaders) == 0)
+        return;
+
+    rh->reload_done = false;
+    if (pthread_create(&rh->reload_thread, NULL, render_reload_thread, rh)
+            != 0) {
+        fprintf(stderr, "warning: failed to start shader reload\n");
+        return;
+    }
+    rh->reloading = true;
+}
+
+/* Draw the commands written by the cull pass, with a single call where the
+ * device allows it. Without firstInstance each batch rebinds the instance
+ * stream at its own offset instead. */
+void render_record_draws(struct render_handles *rh, VkCommandBuffer cb,
+                         uint32_t first, uint32_t batchc) {
+    VkDeviceSize count_offset = rh->frm_index*rh->draw_stride;
+    VkDeviceSize draw_offset = count_offset + CULL_DRAWS_OFFSET +
+                               first*sizeof(VkDrawIndexedIndirectCommand);
+    VkDeviceSize visible_offset = rh->frm_index*rh->instance_stride;
+    uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+
+    if (rh->cull_flags & CULL_COMPACT) {
+        rh->draw_indirect_count(cb, rh->draw_buf, draw_offset,
+                                rh->draw_buf, count_offset, batchc, stride);
+    } else if (rh->features.multiDrawIndirect &&
+               rh->cull_flags & CULL_FIRST_INSTANCE) {
+        vkCmdDrawIndexedIndirect(cb, rh->draw_buf, draw_offset,
+                                 batchc, stride);
+    } else {
+        for (uint32_t i = 0; i < batchc; i++) {
+            if (!(rh->cull_flags & CULL_FIRST_INSTANCE)) {
+                VkDeviceSize offset = visible_offset + (first + i)*CULL_BATCH
+                                      * sizeof(struct instance);
+                vkCmdBindVertexBuffers(cb, 1, 1, &rh->visible_buf, &offset);
+            }
+            vkCmdDrawIndexedIndirect(cb, rh->draw_buf, draw_offset + i*stride,
+                                     1, stride);
+        }
+    }
+}
+
+/* state a secondary command buffer does not inherit from the primary */
+void render_record_state(struct render_handles *rh, VkCommandBuffer cb,
+                         VkPipeline pipeline) {
+    vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+    VkViewport viewport = {
+        .x = 0,
+        .y = 0,
+        .width = rh->render_extent.width,
+        .height = rh->render_extent.height,
+        .minDepth = 0,
+        .maxDepth = 1
     };
-    
-    for (int i = 0; i < image_count; i++) {
-        if (vkCreateSemaphore(device, &sema_info, NULL, &imgav[i])
-                != VK_SUCCESS ||
-            vkCreateSemaphore(device, &sema_info, NULL, &imgrn[i])
-                != VK_SUCCESS)
-            die("failed to create semaphores for image %d", i);
+    VkRect2D scissor = {
+        .offset = {0, 0},
+        .extent = rh->render_extent
+    };
+    vkCmdSetViewport(cb, 0, 1, &viewport);
+    vkCmdSetScissor(cb, 0, 1, &scissor);
+
+    VkBuffer vertex_bufs[] = {rh->vertex_buf, rh->visible_buf};
+    VkDeviceSize offsets[] = {0, rh->frm_index*rh->instance_stride};
+    vkCmdBindVertexBuffers(cb, 0, 2, vertex_bufs, offsets);
+
+    vkCmdBindIndexBuffer(cb, rh->index_buf, 0, rh->index_type);
+
+    uint32_t uniform_offset = rh->frm_index*rh->uniform_stride;
+    vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            rh->pipeline_layout, 0, 1,
+                            &rh->descset, 1, &uniform_offset);
+    if (rh->opts.bindless)
+        vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                rh->pipeline_layout, BINDLESS_SET, 1,
+                                &rh->bindless.set, 0, NULL);
+    vkCmdPushConstants(cb, rh->pipeline_layout,
+                       VK_SHADER_STAGE_VERTEX_BIT |
+                       VK_SHADER_STAGE_FRAGMENT_BIT,
+                       0, sizeof(rh->push), &rh->push);
+}
+
+struct record_slices {
+    struct render_handles *rh;
+    uint32_t image; /* swapchain or offscreen image index */
+    VkFramebuffer framebuffer;
+    uint32_t batchc;
+    uint32_t slicec; /* secondaries per subpass, recorded inline if 1 */
+};
+
+/* pipeline drawing the given subpass */
+VkPipeline render_subpass_pipeline(struct render_handles *rh,
+                                   uint32_t subpass) {
+    return subpass + 1 < rh->subpassc ? rh->prepass_pipeline : rh->pipeline;
+}
+
+/* runs on a recorder thread, records an even share of the batches for
+ * every subpass */
+void render_record_slice(void *arg, uint32_t index) {
+    struct record_slices *slices = arg;
+    struct render_handles *rh = slices->rh;
+    uint32_t first = slices->batchc*index / slices->slicec;
+    uint32_t end = slices->batchc*(index + 1) / slices->slicec;
+
+    vkResetCommandPool(rh->device, rh->rec_pools[rh->frm_index][index], 0);
+
+    for (uint32_t s = 0; s < rh->subpassc; s++) {
+        VkCommandBuffer cb = rh->rec_cmdbufs[rh->frm_index][s][index];
+
+        VkCommandBufferInheritanceInfo inheritance = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+            .renderPass = rh->renderpass,
+            .subpass = s,
+            .framebuffer = slices->framebuffer,
+            .occlusionQueryEnable = VK_FALSE,
+            .pipelineStatistics = rh->profile.statistics
+                ? rh->profile.statistic_flags : 0
+        };
+        VkCommandBufferBeginInfo begin_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                     VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+            .pInheritanceInfo = &inheritance,
+        };
+        if (vkBeginCommandBuffer(cb, &begin_info) != VK_SUCCESS)
+            die("failed to begin secondary command buffer %u", index);
+
+        render_record_state(rh, cb, render_subpass_pipeline(rh, s));
+        render_record_draws(rh, cb, first, end - first);
+
+        if (vkEndCommandBuffer(cb) != VK_SUCCESS)
+            die("failed to record secondary command buffer %u", index);
     }
+}
 
-    *img_available = imgav;
-    *img_rendered = imgrn;
+/* The passes of the frame graph, all given rh. The cull pass accumulates
+ * the draw count, which is zeroed first. */
+void render_pass_reset(void *arg, VkCommandBuffer cb, uint32_t subpass) {
+    struct render_handles *rh = arg;
+    profile_cmd_begin(&rh->profile, cb, rh->frm_index, PROFILE_GPU_CULL);
+    vkCmdFillBuffer(cb, rh->draw_buf, rh->frm_index*rh->draw_stride,
+                    CULL_DRAWS_OFFSET, 0);
+}
 
-    VkFenceCreateInfo fence_info = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .flags = VK_FENCE_CREATE_SIGNALED_BIT
+void render_pass_cull(void *arg, VkCommandBuffer cb, uint32_t subpass) {
+    struct render_handles *rh = arg;
+    uint32_t batchc = (rh->instancec + CULL_BATCH - 1) / CULL_BATCH;
+    uint32_t offsets[] = {
+        rh->frm_index*rh->uniform_stride,
+        rh->frm_index*rh->instance_stride,
+        rh->frm_index*rh->instance_stride,
+        rh->frm_index*rh->draw_stride
     };
+    vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_COMPUTE, rh->cull_pipeline);
+    vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            rh->cull_pipeline_layout, 0, 1,
+                            &rh->cull_descset, 4, offsets);
+    vkCmdDispatch(cb, batchc, 1, 1);
+    profile_cmd_end(&rh->profile, cb, rh->frm_index, PROFILE_GPU_CULL);
+}
 
-    for (int i = 0; i < CONCURRENT_FRAMES; i++) {
-        if (vkCreateFence(device, &fence_info, NULL, &frm_inflight[i])
-                != VK_SUCCESS)
-            die("failed to create fence for frame %d", i);
+/* the pre-pass and shading, from the secondaries when there are any */
+void render_pass_draw(void *arg, VkCommandBuffer cb, uint32_t subpass) {
+    struct render_handles *rh = arg;
+    struct record_slices *slices = rh->slices;
+    if (slices->slicec > 1) {
+        vkCmdExecuteCommands(cb, slices->slicec,
+                             rh->rec_cmdbufs[rh->frm_index][subpass]);
+    } else {
+        render_record_state(rh, cb, render_subpass_pipeline(rh, subpass));
+        render_record_draws(rh, cb, 0, slices->batchc);
     }
 }
 
-void render_swapchain_create(struct render_handles *rh) {
-    vulkan_swapchain(rh->physical, rh->device, rh->surface,
-                     &rh->format, &rh->sc_extent, &rh->sc);
-    vulkan_imageviews(rh->device, rh->sc, rh->format,
-                      &rh->sc_imgc, &rh->sc_imgs, &rh->sc_imageviews);
-    vulkan_renderpass(rh->device, rh->format,
-                      &rh->renderpass);
-    vulkan_pipeline(rh->device, rh->sc_extent, rh->renderpass,
-                    rh->descset_layout,
-                    &rh->pipeline_layout, &rh->pipeline);
-    vulkan_framebufs(rh->device, rh->sc_imgc, rh->sc_imageviews,
-                     rh->renderpass, rh->sc_extent,
-                     &rh->sc_framebufs);
-    vulkan_uniformbufs(rh->device, rh->physical, rh->sc_imgc,
-                       &rh->sc_uniform_bufs, &rh->sc_uniform_bufs_mem);
-    vulkan_descpool(rh->device, rh->sc_imgc,
-                    &rh->descpool);
-    vulkan_descsets(rh->device, rh->sc_imgc, rh->descpool,
-                    rh->descset_layout, rh->sc_uniform_bufs,
-                    &rh->sc_descsets);
-    vulkan_cmdbufs(rh->device, rh->sc_imgc, rh->renderpass, rh->pipeline,
-                   rh->pipeline_layout, rh->sc_extent,
-                   rh->vertex_buf, rh->index_buf,
-                   rh->sc_framebufs, rh->cmdpool, rh->sc_descsets,
-                   &rh->sc_cmdbufs);
+/* queries may not begin inside a subpass that only executes
+ * secondaries, so the statistics cover the whole render pass */
+void render_pass_bracket(void *arg, VkCommandBuffer cb, bool begin) {
+    struct render_handles *rh = arg;
+    if (begin) {
+        profile_cmd_begin(&rh->profile, cb, rh->frm_index,
+                          PROFILE_GPU_RENDERPASS);
+        profile_cmd_stats_begin(&rh->profile, cb, rh->frm_index);
+    } else {
+        profile_cmd_stats_end(&rh->profile, cb, rh->frm_index);
+        profile_cmd_end(&rh->profile, cb, rh->frm_index,
+                        PROFILE_GPU_RENDERPASS);
+    }
 }
 
-void render_swapchain_destroy(struct render_handles *rh) {
-    vkDeviceWaitIdle(rh->device);
+/* the devices of the group running the current frame */
+uint32_t render_device_mask(struct render_handles *rh) {
+    if (rh->opts.multi_gpu == MULTI_GPU_AFR)
+        return 1u << (rh->frame % rh->groupc);
+    return (1u << rh->groupc) - 1;
+}
 
-    vkDestroyDescriptorPool(rh->device, rh->descpool, NULL);
+/* split frames give each device a horizontal band of the render pass's
+ * own area, the scene's at render resolution and the overlay's full */
+const void *render_pass_begin(void *arg, VkExtent2D area) {
+    struct render_handles *rh = arg;
+    if (rh->opts.multi_gpu != MULTI_GPU_SFR)
+        return NULL;
+    for (uint32_t i = 0; i < rh->groupc; i++) {
+        uint32_t top = area.height*i / rh->groupc;
+        uint32_t bottom = area.height*(i+1) / rh->groupc;
+        rh->group_areas[i] = (VkRect2D){
+            .offset = {0, top},
+            .extent = {area.width, bottom - top},
+        };
+    }
+    rh->group_rp_info = (VkDeviceGroupRenderPassBeginInfo){
+        .sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_RENDER_PASS_BEGIN_INFO,
+        .deviceMask = render_device_mask(rh),
+        .deviceRenderAreaCount = rh->groupc,
+        .pDeviceRenderAreas = rh->group_areas,
+    };
+    return &rh->group_rp_info;
+}
 
-    for (int i = 0; i < rh->sc_imgc; i++) {
-        vkDestroyBuffer(rh->device, rh->sc_uniform_bufs[i], NULL);
-        vkFreeMemory(rh->device, rh->sc_uniform_bufs_mem[i], NULL);
+/* the frame's area of the scene, blitted up to all of the color image */
+void render_pass_upscale(void *arg, VkCommandBuffer cb, uint32_t subpass) {
+    struct render_handles *rh = arg;
+    uint32_t image = rh->slices->image;
+    VkImageBlit region = {
+        .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .srcOffsets = {
+            {0, 0, 0},
+            {rh->render_extent.width, rh->render_extent.height, 1}
+        },
+        .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .dstOffsets = {
+            {0, 0, 0},
+            {rh->sc_extent.width, rh->sc_extent.height, 1}
+        },
+    };
+    vkCmdBlitImage(cb, graph_image(&rh->graph, rh->scene, image),
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   graph_image(&rh->graph, rh->color, image),
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   1, &region, rh->blit_filter);
+}
+
+/* the overlay written by render_hud_update(), over the whole image */
+void render_pass_hud(void *arg, VkCommandBuffer cb, uint32_t subpass) {
+    struct render_handles *rh = arg;
+    text_record(&rh->text, cb, rh->text_pipeline, rh->sc_extent);
+}
+
+/* The frame: draw commands are reset and culled, on the compute family if
+ * there is one of its own, then depth is laid down and the swapchain image
+ * shaded. Depth lives only within the render pass, so it is transient and
+ * never stored. With multisampling the samples are likewise only resolved,
+ * with dynamic resolution into a scene image upscaled by a final blit.
+ * The overlay goes on last at full resolution, in the same render pass as
+ * shading unless there is an upscale in between. */
+void render_graph_build(struct render_handles *rh) {
+    struct graph *g = &rh->graph;
+    graph_init(g, rh->device, &rh->mem, rh->sc_extent, rh);
+    g->bracket = render_pass_bracket;
+    g->begin = render_pass_begin;
+
+    /* the host orders reuse of a frame slot's buffers and offscreen
+     * images, swapchain images are acquired by color output */
+    struct graph_state none = {0, 0, VK_IMAGE_LAYOUT_UNDEFINED};
+    struct graph_state acquired = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+        VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    VkImageLayout final_layout = rh->opts.headless
+        ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+        : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    uint32_t draws = graph_import_buffer(g, "draws", none);
+    uint32_t visible = graph_import_buffer(g, "visible", none);
+    uint32_t color = graph_import_image(g, "color", rh->format,
+                                        VK_IMAGE_ASPECT_COLOR_BIT,
+                                        rh->sc_imgc, rh->sc_imgs,
+                                        rh->sc_imageviews,
+                                        rh->opts.headless ? none : acquired,
+                                        final_layout);
+    bool dynres = rh->opts.frame_target > 0;
+    bool msaa = rh->samples != VK_SAMPLE_COUNT_1_BIT;
+    uint32_t scene = !dynres ? color
+        : graph_transient_image(g, "scene", rh->format,
+                                VK_IMAGE_ASPECT_COLOR_BIT,
+                                VK_SAMPLE_COUNT_1_BIT);
+    uint32_t drawn = !msaa ? scene
+        : graph_transient_image(g, "samples", rh->format,
+                                VK_IMAGE_ASPECT_COLOR_BIT, rh->samples);
+    uint32_t depth = graph_transient_image(g, "depth", rh->depth_format,
+                                           VK_IMAGE_ASPECT_DEPTH_BIT,
+                                           rh->samples);
+    /* depth is cleared to 0, the far plane with reverse-z */
+    graph_clear(g, drawn, (VkClearValue){
+        .color = { .float32 = {0, 0, 0, 0} }
+    });
+    graph_clear(g, depth, (VkClearValue){
+        .depthStencil = { .depth = 0, .stencil = 0 }
+    });
+
+    enum graph_queue cull_queue = rh->qf.compute != rh->qf.gfx
+        ? GRAPH_QUEUE_COMPUTE : GRAPH_QUEUE_GRAPHICS;
+    uint32_t reset = graph_pass(g, "reset", cull_queue, false,
+                                render_pass_reset);
+    graph_use(g, reset, draws, GRAPH_TRANSFER_WRITE);
+    uint32_t cull = graph_pass(g, "cull", cull_queue, false,
+                               render_pass_cull);
+    graph_use(g, cull, draws, GRAPH_COMPUTE_WRITE);
+    graph_use(g, cull, visible, GRAPH_COMPUTE_WRITE);
+    if (rh->opts.prepass) {
+        uint32_t prepass = graph_pass(g, "prepass", GRAPH_QUEUE_GRAPHICS,
+                                      true, render_pass_draw);
+        graph_use(g, prepass, draws, GRAPH_INDIRECT_READ);
+        graph_use(g, prepass, visible, GRAPH_VERTEX_READ);
+        graph_use(g, prepass, depth, GRAPH_DEPTH_WRITE);
+        graph_secondaries(g, prepass);
+    }
+    uint32_t shade = graph_pass(g, "shade", GRAPH_QUEUE_GRAPHICS, true,
+                                render_pass_draw);
+    graph_use(g, shade, draws, GRAPH_INDIRECT_READ);
+    graph_use(g, shade, visible, GRAPH_VERTEX_READ);
+    graph_use(g, shade, depth, rh->opts.prepass ? GRAPH_DEPTH_READ
+                                                : GRAPH_DEPTH_WRITE);
+    graph_use(g, shade, drawn, GRAPH_COLOR_WRITE);
+    if (msaa)
+        graph_use(g, shade, scene, GRAPH_COLOR_RESOLVE);
+    graph_secondaries(g, shade);
+    /* the render pass timings and statistics are the scene's, not the
+     * overlay's when it has a render pass of its own */
+    graph_bracketed(g, shade);
+    if (dynres) {
+        uint32_t upscale = graph_pass(g, "upscale", GRAPH_QUEUE_GRAPHICS,
+                                      false, render_pass_upscale);
+        graph_use(g, upscale, scene, GRAPH_TRANSFER_READ);
+        graph_use(g, upscale, color, GRAPH_TRANSFER_WRITE);
+        vulkan_blit_filter(rh->physical, rh->format, &rh->blit_filter);
+    }
+    if (rh->opts.hud_font) {
+        rh->hud_pass = graph_pass(g, "hud", GRAPH_QUEUE_GRAPHICS, true,
+                                  render_pass_hud);
+        graph_use(g, rh->hud_pass, color, GRAPH_COLOR_WRITE);
     }
-    free(rh->sc_uniform_bufs);
-    free(rh->sc_uniform_bufs_mem);
+    graph_build(g);
+    if (rh->opts.hud_font)
+        rh->hud_renderpass = graph_renderpass(g, rh->hud_pass);
+    rh->scene = scene;
+    rh->color = color;
+    rh->shade_pass = shade;
+    rh->renderpass = graph_renderpass(g, shade);
+}
 
-    vkFreeCommandBuffers(rh->device, rh->cmdpool, rh->sc_imgc, rh->sc_cmdbufs);
-    for (int i = 0; i < rh->sc_imgc; i++) {
-        vkDestroyFramebuffer(rh->device, rh->sc_framebufs[i], NULL);
+void render_swapchain_create(struct render_handles *rh) {
+    VkFormat old_format = rh->format;
+    if (rh->opts.headless) {
+        rh->format = HEADLESS_FORMAT;
+        rh->sc_extent.width = rh->opts.width;
+        rh->sc_extent.height = rh->opts.height;
+    } else {
+        VkSwapchainKHR old_sc = rh->sc;
+        uint32_t families[] = {rh->qf.gfx, rh->qf.present};
+        VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        if (rh->opts.frame_target > 0)
+            usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        vulkan_swapchain(rh->physical, rh->device, rh->surface,
+                         &rh->scratch, old_sc, rh->present_mode, usage,
+                         families[0] != families[1] ? 2 : 1,
+                         families, &rh->format, &rh->sc_extent, &rh->sc);
+        if (old_sc != VK_NULL_HANDLE)
+            defer_swapchain(&rh->retired, old_sc);
     }
-    free(rh->sc_framebufs);
-    vkDestroyPipeline(rh->device, rh->pipeline, NULL);
-    vkDestroyPipelineLayout(rh->device, rh->pipeline_layout, NULL);
-    vkDestroyRenderPass(rh->device, rh->renderpass, NULL);
-    for (int i = 0; i < rh->sc_imgc; i++) {
-        vkDestroyImageView(rh->device, rh->sc_imageviews[i], NULL);
+
+    if (rh->opts.headless) {
+        rh->sc_imgc = rh->framec;
+        vulkan_offscreen(&rh->mem, &rh->sc_arena, rh->format, rh->sc_extent,
+                         rh->sc_imgc, &rh->sc_imgs, &rh->sc_img_mems,
+                         &rh->sc_imageviews);
+    } else {
+        vulkan_imageviews(rh->device, rh->sc, rh->format, &rh->sc_arena,
+                          &rh->sc_imgc, &rh->sc_imgs, &rh->sc_imageviews);
     }
-    free(rh->sc_imageviews);
-    vkDestroySwapchainKHR(rh->device, rh->sc, NULL);
+    if (!rh->opts.headless)
+        vulkan_semaphores(rh->device, &rh->sc_arena, rh->sc_imgc,
+                          &rh->img_rendered);
+
+    /* the reload thread builds pipelines against the render pass, which
+     * is replaced along with the graph */
+    render_reload_finish(rh);
+    bool first = rh->renderpass == VK_NULL_HANDLE;
+    render_graph_build(rh);
+
+    /* the pipelines stay compatible with the new render pass unless the
+     * surface format changed, which in practice it never does */
+    if (first || rh->format != old_format) {
+        if (!first)
+            variants_retire(&rh->variants, &rh->retired,
+                            render_variant_graphics, NULL);
+        graph_print(&rh->graph);
+        render_pipelines_build(rh);
+    }
+}
 
-    free(rh->sc_imgs);
-    free(rh->sc_cmdbufs);
+/* Everything but the swapchain itself, which is retired by the next
+ * vulkan_swapchain(). Frames still in flight may use all of it, so it is
+ * only destroyed once they have completed. */
+void render_swapchain_destroy(struct render_handles *rh) {
+    struct defer_queue *dq = &rh->retired;
+    graph_destroy(&rh->graph, dq);
+    for (int i = 0; rh->img_rendered && i < rh->sc_imgc; i++) {
+        defer_semaphore(dq, rh->img_rendered[i]);
+    }
+    rh->img_rendered = NULL;
+    for (int i = 0; i < rh->sc_imgc; i++) {
+        defer_image_view(dq, rh->sc_imageviews[i]);
+    }
+    if (rh->sc_img_mems) {
+        for (int i = 0; i < rh->sc_imgc; i++) {
+            defer_image(dq, rh->sc_imgs[i], &rh->sc_img_mems[i]);
+        }
+        rh->sc_img_mems = NULL;
+    }
+    /* the handles are all in the queue, so the arrays can go right away */
+    arena_reset(&rh->sc_arena, 0);
 }
 
 void render_swapchain_recreate(struct render_handles *rh) {
@@ -1055,143 +2420,1025 @@ void render_swapchain_recreate(struct render_handles *rh) {
     render_swapchain_create(rh);
 }
 
+void render_builtin_mesh(struct mesh *m, uint32_t opt) {
+    struct mesh_builder b;
+    mesh_builder_init(&b);
+    for (int i = 0; i < sizeof(VERTICES)/sizeof(*VERTICES); i++) {
+        const struct vertex *v = &VERTICES[i];
+        float pos[3] = {v->pos[0], v->pos[1], 0};
+        float normal[3] = {0, 0, 1};
+        mesh_builder_vertex(&b, pos, normal, v->col);
+    }
+    for (int i = 0; i < sizeof(INDICES)/sizeof(*INDICES); i++) {
+        mesh_builder_index(&b, INDICES[i]);
+    }
+    mesh_build(&b, opt, m);
+    mesh_builder_destroy(&b);
+}
+
+/* a checkerboard standing in for material textures */
+void render_builtin_texture(struct render_handles *rh) {
+    enum { SIDE = 64, CELL = 8 };
+    uint32_t texels[SIDE*SIDE];
+    for (int y = 0; y < SIDE; y++) {
+        for (int x = 0; x < SIDE; x++) {
+            bool odd = (x/CELL + y/CELL) % 2;
+            texels[y*SIDE + x] = odd ? 0xffffffff : 0xff999999;
+        }
+    }
+    VkExtent2D extent = {SIDE, SIDE};
+    vulkan_texture(&rh->mem, &rh->upload, rh->qf.uniqc, rh->qf.uniq,
+                   extent, texels, &rh->texture, &rh->texture_mem,
+                   &rh->texture_view);
+    vulkan_sampler(rh->device, &rh->sampler);
+    rh->push.image = bindless_image(&rh->bindless, rh->texture_view,
+                                      rh->sampler);
+}
+
+/* lay the instances out on a square grid in the xy plane */
+void render_scene_build(struct render_handles *rh) {
+    uint32_t n = rh->opts.instances;
+    entity_store_init(&rh->entities, n);
+
+    uint32_t side = 1;
+    while (side*side < n)
+        side++;
+    float scale = 1.0 / side;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t x = i % side, y = i / side;
+        vec3 pos = {(2*x + 1)*scale - 1, (2*y + 1)*scale - 1, 0};
+        vec4 rot = {0, 0, 0, 1};
+        vec3 scales = {scale, scale, scale};
+        vec4 col = {(float)(x + 1)/side, (float)(y + 1)/side, 1, 1};
+        entity_add(&rh->entities, ENTITY_NONE, pos, rot, scales, col);
+    }
+}
+
 void render_init(struct render_handles *rh) {
-    if (SDL_Init(SDL_INIT_VIDEO) != 0)
-        die("failed to initialize sdl -- %s", SDL_GetError());
-
-    rh->window = SDL_CreateWindow(APP_NAME,
-        SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-        800, 600, SDL_WINDOW_RESIZABLE|SDL_WINDOW_VULKAN);
-    if (!rh->window)
-        die("failed to create sdl window -- %s", SDL_GetError());
-
-    vulkan_instance(rh->window,
-                    &rh->instance);
-    vulkan_physical(rh->instance,
-                    &rh->physical);
-    vulkan_logical(rh->instance, rh->physical, rh->window,
-                   &rh->surface, &rh->device, &rh->queue);
-    vulkan_cmdpool(rh->device,
+    bool indirect_count;
+    if (!rh->opts.headless) {
+        if (SDL_Init(SDL_INIT_VIDEO) != 0)
+            die("failed to initialize sdl -- %s", SDL_GetError());
+
+        rh->window = SDL_CreateWindow(APP_NAME,
+            SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+            rh->opts.width, rh->opts.height,
+            SDL_WINDOW_RESIZABLE|SDL_WINDOW_VULKAN);
+        if (!rh->window)
+            die("failed to create sdl window -- %s", SDL_GetError());
+    }
+
+    host_alloc_init(&rh->host);
+    arena_init(&rh->arena, "persistent", ARENA_PERSISTENT);
+    arena_init(&rh->sc_arena, "swapchain", ARENA_SWAPCHAIN);
+    arena_init(&rh->scratch, "scratch", ARENA_SCRATCH);
+
+    vulkan_instance(rh->window, &rh->scratch, &rh->instance);
+    const char *device = rh->opts.device ? rh->opts.device
+                                         : getenv("TRI_DEVICE");
+    vulkan_physical(rh->instance, rh->window != NULL, device,
+                    rh->opts.multi_gpu != MULTI_GPU_NONE, &rh->scratch,
+                    &rh->physical, &rh->groupc, rh->group);
+    vulkan_logical(rh->instance, rh->physical, rh->groupc, rh->group,
+                   rh->window, &rh->scratch,
+                   &rh->surface, &rh->device, &rh->features,
+                   &indirect_count, &rh->descriptor_indexing,
+                   &rh->qf, &rh->queue, &rh->present_queue,
+                   &rh->compute_queue, &rh->xfer_queue);
+    if (rh->groupc > 1) {
+        /* culling waits would have to be joined across the group as the
+         * frames are, not worth it */
+        rh->qf.compute = rh->qf.gfx;
+        rh->compute_queue = rh->queue;
+        printf("%s over %u devices\n", MULTI_GPU_NAMES[rh->opts.multi_gpu],
+               rh->groupc);
+    }
+
+    const struct present_modes *policy = &PRESENT_POLICIES[rh->opts.present];
+    rh->framec = rh->opts.frames_in_flight ? rh->opts.frames_in_flight
+                                           : policy->frames;
+    if (!rh->opts.headless)
+        vulkan_present_mode(rh->physical, rh->surface, &rh->scratch,
+                            policy->modes, policy->modec,
+                            &rh->present_mode);
+    printf("%s policy: %s, %u frame(s) in flight",
+           policy->name, rh->opts.headless
+               ? "headless" : present_mode_name(rh->present_mode),
+           rh->framec);
+    if (rh->opts.fps_cap > 0)
+        printf(", capped at %u fps", rh->opts.fps_cap);
+    printf("\n");
+
+    if (indirect_count)
+        rh->draw_indirect_count = (PFN_vkCmdDrawIndexedIndirectCountKHR)
+            vkGetDeviceProcAddr(rh->device,
+                                "vkCmdDrawIndexedIndirectCountKHR");
+
+    /* a statistics query active in the primary only counts the work of
+     * secondaries if it can be inherited */
+    rh->recorderc = rh->opts.recorders ? rh->opts.recorders
+                                       : jobs_cpu_count();
+    if (rh->recorderc > MAX_RECORDERS)
+        rh->recorderc = MAX_RECORDERS;
+    if (rh->recorderc > 1 && rh->opts.statistics &&
+        !rh->features.inheritedQueries) {
+        printf("inherited queries not supported, recording on one thread\n");
+        rh->recorderc = 1;
+    }
+    printf("recording with %u thread(s)\n", rh->recorderc);
+
+    /* compacted commands can only be drawn at the right instances if they
+     * carry their own firstInstance, and cannot be split into slices */
+    if (rh->features.drawIndirectFirstInstance) {
+        rh->cull_flags |= CULL_FIRST_INSTANCE;
+        if (rh->draw_indirect_count && rh->recorderc == 1)
+            rh->cull_flags |= CULL_COMPACT;
+    }
+    mem_init(&rh->mem, rh->physical, rh->device, rh->groupc);
+    timeline_init(&rh->timeline, rh->device);
+    defer_init(&rh->retired, rh->device, &rh->mem, &rh->timeline);
+    if (rh->opts.statistics && !rh->features.pipelineStatisticsQuery)
+        printf("pipeline statistics queries not supported by device\n");
+    if (rh->opts.bindless && !rh->descriptor_indexing) {
+        printf("descriptor indexing not supported by device\n");
+        rh->opts.bindless = false;
+    }
+    /* queries of a device group are only written by the devices that ran
+     * the commands, which differs between frames */
+    if (rh->groupc > 1 && rh->opts.statistics)
+        printf("pipeline statistics disabled with multi gpu\n");
+    profile_init(&rh->profile, rh->device, rh->physical, rh->qf.gfx,
+                 rh->qf.compute, rh->framec, rh->groupc == 1,
+                 rh->opts.statistics && rh->features.pipelineStatisticsQuery &&
+                 rh->groupc == 1);
+    /* the scale follows the frame's timestamps */
+    if (rh->opts.frame_target > 0 &&
+        rh->profile.timestamps == VK_NULL_HANDLE) {
+        printf("no gpu timestamps, dynamic resolution disabled\n");
+        rh->opts.frame_target = 0;
+    } else if (rh->opts.frame_target > 0) {
+        printf("dynamic resolution holding %.1f ms, scale %.2f to 1\n",
+               rh->opts.frame_target, DYNRES_MIN_SCALE);
+    }
+    rh->scale = 1;
+    for (uint32_t i = 0; i < CONCURRENT_FRAMES; i++) {
+        rh->slot_scales[i] = 1;
+    }
+    upload_init(&rh->upload, rh->device, &rh->mem,
+                rh->xfer_queue, rh->qf.xfer);
+    vulkan_cmdpool(rh->device, rh->qf.gfx,
                    &rh->cmdpool);
-    vulkan_vertexbuf(rh->device, rh->physical, rh->queue,
-                     &rh->vertex_buf, &rh->vertex_buf_mem);
-    vulkan_indexbuf(rh->device, rh->physical, rh->queue,
-                    &rh->index_buf, &rh->index_buf_mem);
+    double load_start = profile_now();
+    if (rh->opts.mesh)
+        mesh_load(&rh->mesh, rh->opts.mesh, rh->opts.mesh_opt);
+    else
+        render_builtin_mesh(&rh->mesh, rh->opts.mesh_opt);
+    printf("mesh: %u vertices, %u indices of %u bytes, %.1f ms\n",
+           rh->mesh.vertexc, rh->mesh.indexc, rh->mesh.index_size,
+           profile_now() - load_start);
+    printf("mesh: acmr %.3f before, %.3f after reordering, cache of %d\n",
+           rh->mesh.acmr[0], rh->mesh.acmr[1], MESHOPT_CACHE_SIZE);
+    rh->index_type = rh->mesh.index_size == 2 ? VK_INDEX_TYPE_UINT16
+                                              : VK_INDEX_TYPE_UINT32;
+    vulkan_vertexbuf(&rh->mem, &rh->upload, rh->qf.uniqc, rh->qf.uniq,
+                     &rh->mesh, &rh->vertex_buf, &rh->vertex_buf_mem);
+    vulkan_indexbuf(&rh->mem, &rh->upload, rh->qf.uniqc, rh->qf.uniq,
+                    &rh->mesh, &rh->index_buf, &rh->index_buf_mem);
+    mesh_release(&rh->mesh);
+    if (rh->opts.bindless) {
+        bindless_init(&rh->bindless, rh->device);
+        render_builtin_texture(rh);
+    }
+    if (rh->opts.hud_font) {
+        struct font font;
+        font_load_psf2(&font, rh->opts.hud_font);
+        text_init(&rh->text, &rh->mem, &rh->upload, &font, rh->framec,
+                  rh->qf.uniqc, rh->qf.uniq);
+        printf("overlay font: %u glyphs of %ux%u\n", font.glyphc,
+               font.width, font.height);
+        font_release(&font);
+    }
+    rh->upload_value = upload_flush(&rh->upload);
+    if (rh->groupc > 1) {
+        /* a timeline value signaled by one device cannot be waited on by
+         * the others, so wait for the uploads here instead */
+        vkQueueWaitIdle(rh->xfer_queue);
+        rh->upload_value = 0;
+    }
     vulkan_descsetlayout(rh->device,
                          &rh->descset_layout);
+    VkDescriptorSetLayout set_layouts[] = {
+        rh->descset_layout, rh->bindless.layout
+    };
+    vulkan_pipeline_layout(rh->device, rh->opts.bindless ? 2 : 1,
+                           set_layouts, &rh->pipeline_layout);
+    vulkan_depth_format(rh->physical,
+                        &rh->depth_format);
+    vulkan_samples(rh->physical, rh->opts.samples, &rh->samples);
+    if (rh->samples != rh->opts.samples)
+        printf("%u samples not supported, using %u\n", rh->opts.samples,
+               rh->samples);
+    else if (rh->samples > 1)
+        printf("multisampling with %u samples\n", rh->samples);
+    vulkan_cull_descsetlayout(rh->device,
+                              &rh->cull_descset_layout);
+    vulkan_pipeline_cache(rh->device, rh->physical, PIPELINE_CACHE_PATH,
+                          &rh->pipeline_cache);
+    shader_cache_init(&rh->shaders, rh->device);
+    variants_init(&rh->variants, rh->device, render_variant_build, rh);
+    pthread_mutex_init(&rh->reload_lock, NULL);
+    vulkan_cull_pipeline_layout(rh->device, rh->cull_descset_layout,
+                                &rh->cull_pipeline_layout);
+    vulkan_uniformbufs(rh->physical, &rh->mem, rh->framec,
+                       rh->qf.uniqc, rh->qf.uniq, &rh->uniform_stride,
+                       &rh->uniform_buf, &rh->uniform_buf_mem);
+    vulkan_instancebuf(&rh->mem, rh->framec, rh->qf.uniqc, rh->qf.uniq,
+                       &rh->instance_stride,
+                       &rh->instance_buf, &rh->instance_buf_mem);
+    vulkan_cullbufs(rh->physical, &rh->mem, rh->framec,
+                    rh->qf.uniqc, rh->qf.uniq,
+                    &rh->visible_buf, &rh->visible_buf_mem,
+                    &rh->draw_stride, &rh->draw_buf, &rh->draw_buf_mem);
+    vulkan_descpool(rh->device,
+                    &rh->descpool);
+    vulkan_descsets(rh->device, rh->descpool,
+                    rh->descset_layout, rh->uniform_buf,
+                    &rh->descset);
+    vulkan_cull_descsets(rh->device, rh->descpool, rh->cull_descset_layout,
+                         rh->uniform_buf, rh->instance_buf,
+                         rh->visible_buf, rh->draw_buf, rh->draw_stride,
+                         &rh->cull_descset);
+    vulkan_cmdbufs(rh->device, rh->cmdpool, rh->framec,
+                   rh->frm_cmdbufs);
+    if (rh->qf.compute != rh->qf.gfx) {
+        vulkan_cmdpool(rh->device, rh->qf.compute,
+                       &rh->compute_pool);
+        vulkan_cmdbufs(rh->device, rh->compute_pool, rh->framec,
+                       rh->compute_cmdbufs);
+        timeline_init(&rh->compute_timeline, rh->device);
+        printf("culling on async compute family %u\n", rh->qf.compute);
+    }
+    rh->subpassc = rh->opts.prepass ? 2 : 1;
+    if (rh->recorderc > 1)
+        vulkan_recorders(rh->device, rh->qf.gfx,
+                         rh->framec, rh->recorderc, rh->subpassc,
+                         rh->rec_pools, rh->rec_cmdbufs);
+    jobs_init(&rh->jobs, rh->recorderc - 1);
+    render_scene_build(rh);
+    clock_gettime(CLOCK_MONOTONIC, &rh->epoch);
     render_swapchain_create(rh);
-    vulkan_synchronization(rh->device, rh->sc_imgc,
-                           &rh->img_available,
-                           &rh->img_rendered,
-                           rh->frm_inflight);
+    if (!rh->opts.headless)
+        vulkan_semaphores(rh->device, &rh->arena, rh->framec,
+                          &rh->img_available);
+    if (rh->groupc > 1)
+        vulkan_semaphores(rh->device, &rh->arena, rh->framec*rh->groupc,
+                          &rh->group_done);
+
+    mem_stats_print(&rh->mem);
+    rh->host_init = host_alloc_count(&rh->host);
+    rh->app_init = host_app_count(&rh->host);
 }
 
 void render_destroy(struct render_handles *rh) {
+    /* before anything is torn down, so only the frames and the swapchain
+     * recreations between them count */
+    uint64_t host_frames = host_alloc_count(&rh->host) - rh->host_init;
+    uint64_t app_frames = host_app_count(&rh->host) - rh->app_init;
+    struct mem_stats device_mem;
+    mem_stats(&rh->mem, &device_mem);
+    vkDeviceWaitIdle(rh->device);
+    render_reload_finish(rh);
     render_swapchain_destroy(rh);
+    defer_destroy(&rh->retired);
+    profile_flush(&rh->profile);
+    /* the swapchain and surface extensions are not enabled headless */
+    if (!rh->opts.headless)
+        vkDestroySwapchainKHR(rh->device, rh->sc, vk_allocator);
+    variants_destroy(&rh->variants);
+    vkDestroyPipelineLayout(rh->device, rh->pipeline_layout, vk_allocator);
+    vkDestroyPipelineLayout(rh->device, rh->cull_pipeline_layout,
+                            vk_allocator);
+    vulkan_pipeline_cache_save(rh->device, rh->pipeline_cache,
+                               PIPELINE_CACHE_PATH);
+    vkDestroyPipelineCache(rh->device, rh->pipeline_cache, vk_allocator);
+    shader_cache_destroy(&rh->shaders);
+    pthread_mutex_destroy(&rh->reload_lock);
+
+    vkDestroyDescriptorPool(rh->device, rh->descpool, vk_allocator);
+    mem_buffer_destroy(&rh->mem, rh->uniform_buf, &rh->uniform_buf_mem);
+    mem_buffer_destroy(&rh->mem, rh->instance_buf, &rh->instance_buf_mem);
+    mem_buffer_destroy(&rh->mem, rh->visible_buf, &rh->visible_buf_mem);
+    mem_buffer_destroy(&rh->mem, rh->draw_buf, &rh->draw_buf_mem);
+
+    vkDestroyDescriptorSetLayout(rh->device, rh->descset_layout, vk_allocator);
+    vkDestroyDescriptorSetLayout(rh->device, rh->cull_descset_layout,
+                                 vk_allocator);
+    if (rh->opts.bindless) {
+        bindless_destroy(&rh->bindless);
+        vkDestroySampler(rh->device, rh->sampler, vk_allocator);
+        vkDestroyImageView(rh->device, rh->texture_view, vk_allocator);
+        vkDestroyImage(rh->device, rh->texture, vk_allocator);
+        mem_free(&rh->mem, &rh->texture_mem);
+    }
+    if (rh->opts.hud_font)
+        text_destroy(&rh->text, &rh->mem);
 
-    vkDestroyDescriptorSetLayout(rh->device, rh->descset_layout, NULL);
-
-    for (int i = 0; i < CONCURRENT_FRAMES; i++) {
-        vkDestroyFence(rh->device, rh->frm_inflight[i], NULL);
+    timeline_destroy(&rh->timeline);
+    for (int i = 0; rh->img_available && i < rh->framec; i++) {
+        vkDestroySemaphore(rh->device, rh->img_available[i], vk_allocator);
     }
-    for (int i = 0; i < rh->sc_imgc; i++) {
-        vkDestroySemaphore(rh->device, rh->img_available[i], NULL);
-        vkDestroySemaphore(rh->device, rh->img_rendered[i], NULL);
+    for (int i = 0; rh->group_done && i < rh->framec*rh->groupc; i++) {
+        vkDestroySemaphore(rh->device, rh->group_done[i], vk_allocator);
     }
-    vkDestroyBuffer(rh->device, rh->index_buf, NULL);
-    vkFreeMemory(rh->device, rh->index_buf_mem, NULL);
-    vkDestroyBuffer(rh->device, rh->vertex_buf, NULL);
-    vkFreeMemory(rh->device, rh->vertex_buf_mem, NULL);
-    vkDestroyCommandPool(rh->device, rh->cmdpool, NULL);
-    vkDestroyDevice(rh->device, NULL);
-    vkDestroySurfaceKHR(rh->instance, rh->surface, NULL);
-    vkDestroyInstance(rh->instance, NULL);
-    SDL_DestroyWindow(rh->window);
-
-    free(rh->img_available);
-    free(rh->img_rendered);
+    upload_destroy(&rh->upload, &rh->mem);
+    mem_buffer_destroy(&rh->mem, rh->index_buf, &rh->index_buf_mem);
+    mem_buffer_destroy(&rh->mem, rh->vertex_buf, &rh->vertex_buf_mem);
+    vkDestroyCommandPool(rh->device, rh->cmdpool, vk_allocator);
+    if (rh->compute_pool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(rh->device, rh->compute_pool, vk_allocator);
+        timeline_destroy(&rh->compute_timeline);
+    }
+    jobs_destroy(&rh->jobs);
+    entity_store_destroy(&rh->entities);
+    for (int f = 0; rh->recorderc > 1 && f < rh->framec; f++) {
+        for (int i = 0; i < rh->recorderc; i++) {
+            vkDestroyCommandPool(rh->device, rh->rec_pools[f][i],
+                                 vk_allocator);
+        }
+    }
+    mem_destroy(&rh->mem);
+
+    profile_summary(&rh->profile);
+    FILE *bench = NULL;
+    if (rh->opts.bench_out) {
+        bench = fopen(rh->opts.bench_out, "w");
+        if (!bench)
+            fprintf(stderr, "warning: failed to open %s\n",
+                    rh->opts.bench_out);
+    }
+    if (rh->opts.frames > 0)
+        profile_benchmark(&rh->profile, rh->opts.frames/10,
+                          rh->sc_extent.width, rh->sc_extent.height, bench);
+    if (bench) {
+        fprintf(bench, "driver_allocs %llu\n"
+                "app_allocs %llu\n", (unsigned long long)host_frames,
+                (unsigned long long)app_frames);
+        fprintf(bench, "device_used_mib %.2f\n"
+                "device_reserved_mib %.2f\n",
+                device_mem.used/1048576.0, device_mem.reserved/1048576.0);
+        fclose(bench);
+    }
+    if (rh->opts.profile_csv)
+        profile_export_csv(&rh->profile, rh->opts.profile_csv);
+    if (rh->opts.profile_trace)
+        profile_export_trace(&rh->profile, rh->opts.profile_trace);
+    profile_destroy(&rh->profile);
+
+    vkDestroyDevice(rh->device, vk_allocator);
+    if (!rh->opts.headless)
+        vkDestroySurfaceKHR(rh->instance, rh->surface, NULL);
+    vkDestroyInstance(rh->instance, vk_allocator);
+    if (rh->window)
+        SDL_DestroyWindow(rh->window);
+
+    host_alloc_stats_print(&rh->host);
+    printf("  %llu driver and %llu own allocation(s) after init\n",
+           (unsigned long long)host_frames, (unsigned long long)app_frames);
+    arena_stats_print(&rh->arena);
+    arena_stats_print(&rh->sc_arena);
+    arena_stats_print(&rh->scratch);
+    arena_destroy(&rh->arena);
+    arena_destroy(&rh->sc_arena);
+    arena_destroy(&rh->scratch);
+    host_alloc_destroy(&rh->host);
 }
 
-void render_ubo_update(struct render_handles *rh, uint32_t img_index) {
+/* the frame's uniforms and the push constants of its draws */
+void render_ubo_update(struct render_handles *rh) {
+    /* a turn a second, wrapped in double precision so it stays smooth
+     * however long the program runs */
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
-    float angle = 2*3.14*((float) ts.tv_nsec / 1e9);
-    struct uniform_buf_obj ubo = {
-        .model = {{cos(angle),-sin(angle),0,0},
-                  {sin(angle),cos(angle),0,0},
-                  {0,0,1,0},
-                  {0,0,0,1}},
-   };
+    double t = (ts.tv_sec - rh->epoch.tv_sec) +
+               (ts.tv_nsec - rh->epoch.tv_nsec) / 1e9;
+    float angle = 2*3.14159265*fmod(t, 1);
+    /* any mesh is scaled to a unit radius to fit the instance grid */
+    float size = rh->mesh.radius > 0 ? 1 / rh->mesh.radius : 1;
+    mat4 spin = {{size*cosf(angle),-size*sinf(angle),0,0},
+                 {size*sinf(angle),size*cosf(angle),0,0},
+                 {0,0,size,0},
+                 {0,0,0,1}};
+    memcpy(rh->push.model, spin, sizeof(spin));
+    for (int j = 0; j < 3; j++) {
+        rh->push.scale[j] = rh->mesh.scale[j];
+        rh->push.min[j] = rh->mesh.min[j];
+    }
+    rh->push.scale[3] = rh->push.min[3] = 0;
+    rh->push.object = 0;
+
+    struct uniform_buf_obj ubo;
     vec3 eye = {2,2,2};
     vec3 center = {0,0,0};
     vec3 up = {0,0,1};
     look_at(ubo.view, eye, center, up);
-    perspective(ubo.proj, FOV,
-                (float)rh->sc_extent.width/rh->sc_extent.height,
-                0, 10);
-    void *data;
-    vkMapMemory(rh->device, rh->sc_uniform_bufs_mem[img_index],
-                0, sizeof(ubo), 0, &data);
-    memcpy(data, &ubo, sizeof(ubo));
-    vkUnmapMemory(rh->device, rh->sc_uniform_bufs_mem[img_index]);
+    perspective_reverse_z(ubo.proj, FOV,
+                          (float)rh->sc_extent.width/rh->sc_extent.height,
+                          NEAR);
+
+    mat4 view_proj;
+    mat4_mul(view_proj, ubo.proj, ubo.view);
+    frustum_planes(ubo.planes, view_proj);
+    ubo.instancec = rh->instancec;
+    ubo.index_count = rh->mesh.indexc;
+    ubo.radius = 1;
+    ubo.cull_flags = rh->cull_flags;
+
+    char *slot = (char*)rh->uniform_buf_mem.mapped +
+                 rh->frm_index*rh->uniform_stride;
+    memcpy(slot, &ubo, sizeof(ubo));
 }
 
-void render_draw(struct render_handles *rh) {
-    vkWaitForFences(rh->device, 1, &rh->frm_inflight[rh->frm_index],
-                    VK_TRUE, 1e9);
-
-    uint32_t img_index;
-    VkResult res = vkAcquireNextImageKHR(rh->device, rh->sc, UINT64_MAX,
-                                         rh->img_available[rh->frm_index],
-                                         VK_NULL_HANDLE, &img_index);
-    if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR) {
-        render_swapchain_recreate(rh);
+/* Instance data for the current frame, count instances are drawn. The
+ * returned slot is only valid until the next call. */
+struct instance *render_instances(struct render_handles *rh, uint32_t count) {
+    if (count > MAX_INSTANCES)
+        die("%u instances exceed the maximum of %d", count, MAX_INSTANCES);
+    rh->instancec = count;
+    return (struct instance*)((char*)rh->instance_buf_mem.mapped +
+                              rh->frm_index*rh->instance_stride);
+}
+
+/* world matrices straight into the frame's slot of the instance buffer */
+void render_instances_update(struct render_handles *rh) {
+    struct instance *insts = render_instances(rh, rh->entities.count);
+    entity_store_update(&rh->entities, &rh->jobs, insts);
+}
+
+/* Dynamic resolution, the scale of the next frame from the GPU time of
+ * the last one timed, which is the current slot's previous frame. Time is
+ * taken to grow with the pixels drawn, so with the square of the scale,
+ * and only part of the step is taken so one slow frame does not make the
+ * image jump. Without a target every frame is drawn at sc_extent. */
+void render_scale_update(struct render_handles *rh) {
+    const struct profile_record *rec = profile_latest(&rh->profile);
+    if (rh->opts.frame_target > 0 && rec && rec->gpu_valid &&
+        rec->frame + rh->framec == rh->frame &&
+        rec->gpu[PROFILE_GPU_FRAME] > 0) {
+        float drawn = rh->slot_scales[rh->frm_index];
+        float wanted = drawn*sqrtf(rh->opts.frame_target /
+                                   rec->gpu[PROFILE_GPU_FRAME]);
+        rh->scale += (wanted - rh->scale)*DYNRES_GAIN;
+        if (rh->scale < DYNRES_MIN_SCALE)
+            rh->scale = DYNRES_MIN_SCALE;
+        if (rh->scale > 1)
+            rh->scale = 1;
+    }
+    rh->slot_scales[rh->frm_index] = rh->scale;
+
+    VkExtent2D *e = &rh->render_extent;
+    e->width = rh->sc_extent.width*rh->scale + 0.5;
+    e->height = rh->sc_extent.height*rh->scale + 0.5;
+    if (e->width == 0)
+        e->width = 1;
+    if (e->height == 0)
+        e->height = 1;
+    graph_area(&rh->graph, rh->shade_pass, *e);
+}
+
+/* The overlay, from the latest frame whose GPU times are read back. The
+ * frame interval is smoothed so the figures stay readable. */
+void render_hud_update(struct render_handles *rh) {
+    struct text *t = &rh->text;
+    text_begin(t, rh->frm_index);
+    double now = profile_now();
+    if (rh->hud_last > 0)
+        rh->hud_interval += (now - rh->hud_last - rh->hud_interval)
+                            * HUD_SMOOTHING;
+    rh->hud_last = now;
+
+    uint32_t scale = 1 + rh->sc_extent.height / HUD_DOUBLE_HEIGHT;
+    uint32_t white = 0xffffffff, grey = 0xffb0b0b0;
+    int32_t x = t->width*scale, y = t->height*scale;
+    if (rh->hud_interval > 0)
+        y = text_printf(t, x, y, scale, white, "%.1f fps, %.2f ms",
+                        1e3 / rh->hud_interval, rh->hud_interval);
+    const struct profile_record *rec = profile_latest(&rh->profile);
+    if (rec) {
+        y = text_printf(t, x, y, scale, grey,
+                        "cpu: wait %.2f record %.2f submit %.2f ms",
+                        rec->cpu[PROFILE_CPU_WAIT],
+                        rec->cpu[PROFILE_CPU_RECORD],
+                        rec->cpu[PROFILE_CPU_SUBMIT]);
+        if (rec->gpu_valid)
+            y = text_printf(t, x, y, scale, grey,
+                            "gpu: frame %.2f cull %.2f render pass %.2f ms",
+                            rec->gpu[PROFILE_GPU_FRAME],
+                            rec->gpu[PROFILE_GPU_CULL],
+                            rec->gpu[PROFILE_GPU_RENDERPASS]);
+        if (rec->latency_valid)
+            y = text_printf(t, x, y, scale, grey, "latency %.2f ms",
+                            rec->latency);
+    }
+    text_printf(t, x, y, scale, grey, "%ux%u (%.0f%%), %u sample(s), "
+                "%u instance(s)", rh->render_extent.width,
+                rh->render_extent.height, 100*rh->scale, rh->samples,
+                rh->instancec);
+}
+
+void render_record(struct render_handles *rh, uint32_t img_index) {
+    VkCommandBuffer cb = rh->frm_cmdbufs[rh->frm_index];
+
+    VkDeviceGroupCommandBufferBeginInfo group_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_COMMAND_BUFFER_BEGIN_INFO,
+        .deviceMask = render_device_mask(rh),
+    };
+    VkCommandBufferBeginInfo cb_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .pNext = rh->groupc > 1 ? &group_begin_info : NULL,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        .pInheritanceInfo = NULL,
+    };
+    uint32_t batchc = (rh->instancec + CULL_BATCH - 1) / CULL_BATCH;
+    uint32_t slicec = rh->recorderc < batchc ? rh->recorderc : batchc;
+    struct record_slices slices = {
+        .rh = rh,
+        .image = img_index,
+        .framebuffer = graph_framebuffer(&rh->graph, rh->shade_pass,
+                                         img_index),
+        .batchc = batchc,
+        .slicec = slicec
+    };
+    rh->slices = &slices;
+    VkSubpassContents contents = slicec > 1
+        ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+        : VK_SUBPASS_CONTENTS_INLINE;
+
+    bool async = rh->qf.compute != rh->qf.gfx;
+    if (async) {
+        VkCommandBuffer ccb = rh->compute_cmdbufs[rh->frm_index];
+        vkResetCommandBuffer(ccb, 0);
+        if (vkBeginCommandBuffer(ccb, &cb_begin_info) != VK_SUCCESS)
+            die("failed to begin recording compute command buffer for "
+                "frame %d", rh->frm_index);
+        profile_cmd_reset(&rh->profile, ccb, rh->frm_index,
+                          PROFILE_GPU_BIT(PROFILE_GPU_CULL));
+        graph_record(&rh->graph, ccb, GRAPH_QUEUE_COMPUTE, img_index,
+                     contents);
+        if (vkEndCommandBuffer(ccb) != VK_SUCCESS)
+            die("failed to record compute command buffer");
+    }
+
+    vkResetCommandBuffer(cb, 0);
+    if (vkBeginCommandBuffer(cb, &cb_begin_info) != VK_SUCCESS)
+        die("failed to begin recording command buffer for frame %d",
+            rh->frm_index);
+    uint32_t scopes = PROFILE_GPU_ALL;
+    if (async)
+        scopes &= ~PROFILE_GPU_BIT(PROFILE_GPU_CULL);
+    profile_cmd_reset(&rh->profile, cb, rh->frm_index, scopes);
+    profile_cmd_begin(&rh->profile, cb, rh->frm_index, PROFILE_GPU_FRAME);
+
+    if (slicec > 1)
+        jobs_run(&rh->jobs, slicec, render_record_slice, &slices);
+    graph_record(&rh->graph, cb, GRAPH_QUEUE_GRAPHICS, img_index, contents);
+    rh->slices = NULL;
+
+    profile_cmd_end(&rh->profile, cb, rh->frm_index, PROFILE_GPU_FRAME);
+    if (vkEndCommandBuffer(cb) != VK_SUCCESS)
+        die("failed to record to command buffer");
+}
+
+/* Sleep until the next frame is due under the frame cap. Pacing after the
+ * frame wait keeps the input sampled as late as possible. A frame that is
+ * already late starts right away and the schedule restarts from it rather
+ * than rushing frames to catch up. */
+void render_pace(struct render_handles *rh) {
+    if (rh->opts.fps_cap == 0)
+        return;
+
+    double period = 1e3 / rh->opts.fps_cap;
+    double now = profile_now();
+    if (now >= rh->pace_next) {
+        rh->pace_next = now + period;
         return;
     }
-    render_ubo_update(rh, img_index);
 
-    vkResetFences(rh->device, 1, &rh->frm_inflight[rh->frm_index]);
+    double wait = rh->pace_next - now;
+    struct timespec ts = {
+        .tv_sec = wait / 1e3,
+        .tv_nsec = fmod(wait, 1e3) * 1e6
+    };
+    nanosleep(&ts, NULL);
+    rh->pace_next += period;
+}
 
-    VkPipelineStageFlags wait_stages[] =
-        {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+/* Submit the frame to the devices of its mask and join them on the first,
+ * which alone signals the frame's timeline value. A timeline semaphore
+ * signaled by several devices would see its values out of order, so the
+ * others signal binary semaphores the first waits on in a second batch. */
+void render_submit_group(struct render_handles *rh) {
+    uint32_t mask = render_device_mask(rh);
+    VkSemaphore *group_done = &rh->group_done[rh->frm_index*rh->groupc];
+    VkSemaphore done[MAX_GROUP_DEVICES];
+    uint32_t signal_indices[MAX_GROUP_DEVICES];
+    uint32_t wait_indices[MAX_GROUP_DEVICES];
+    VkPipelineStageFlags wait_stages[MAX_GROUP_DEVICES];
+    uint32_t donec = 0;
+    for (uint32_t i = 1; i < rh->groupc; i++) {
+        if (!(mask & (1u << i)))
+            continue;
+        done[donec] = group_done[i];
+        signal_indices[donec] = i;
+        wait_indices[donec] = 0;
+        wait_stages[donec++] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    }
+    VkDeviceGroupSubmitInfo work_group_info = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBufferDeviceMasks = &mask,
+        .signalSemaphoreCount = donec,
+        .pSignalSemaphoreDeviceIndices = signal_indices,
+    };
+
+    rh->frm_values[rh->frm_index] = timeline_next(&rh->timeline);
+    uint32_t first = 0;
+    uint64_t wait_values[MAX_GROUP_DEVICES] = {0};
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = donec,
+        .pWaitSemaphoreValues = wait_values,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &rh->frm_values[rh->frm_index]
+    };
+    VkDeviceGroupSubmitInfo join_group_info = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO,
+        .pNext = &timeline_info,
+        .waitSemaphoreCount = donec,
+        .pWaitSemaphoreDeviceIndices = wait_indices,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphoreDeviceIndices = &first,
+    };
+    VkSubmitInfo submit_infos[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = &work_group_info,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &rh->frm_cmdbufs[rh->frm_index],
+            .signalSemaphoreCount = donec,
+            .pSignalSemaphores = done,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = &join_group_info,
+            .waitSemaphoreCount = donec,
+            .pWaitSemaphores = done,
+            .pWaitDstStageMask = wait_stages,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &rh->timeline.semaphore,
+        },
+    };
+    if (vkQueueSubmit(rh->queue, 2, submit_infos, VK_NULL_HANDLE)
+            != VK_SUCCESS)
+        die("failed to submit draw command buffer to device group");
+}
+
+void render_draw(struct render_handles *rh) {
+    struct profile *prof = &rh->profile;
+    profile_frame_begin(prof, rh->frame);
+
+    profile_cpu_begin(prof, PROFILE_CPU_WAIT);
+    timeline_wait(&rh->timeline, rh->frm_values[rh->frm_index]);
+    profile_cpu_end(prof, PROFILE_CPU_WAIT);
+    profile_collect(prof, rh->frm_index);
+    defer_collect(&rh->retired);
+    if (rh->opts.watch)
+        render_reload_poll(rh);
+
+    profile_cpu_begin(prof, PROFILE_CPU_PACE);
+    render_pace(rh);
+    profile_cpu_end(prof, PROFILE_CPU_PACE);
+
+    /* offscreen images belong to a frame slot, their reuse is ordered by
+     * the wait above. A suboptimal swapchain has still signaled the
+     * semaphore, so the frame is finished before recreating it. */
+    uint32_t img_index = rh->frm_index;
+    bool recreate = false;
+    if (!rh->opts.headless) {
+        profile_cpu_begin(prof, PROFILE_CPU_ACQUIRE);
+        VkResult res = vkAcquireNextImageKHR(rh->device, rh->sc, UINT64_MAX,
+                                             rh->img_available[rh->frm_index],
+                                             VK_NULL_HANDLE, &img_index);
+        profile_cpu_end(prof, PROFILE_CPU_ACQUIRE);
+        if (res == VK_ERROR_OUT_OF_DATE_KHR) {
+            render_swapchain_recreate(rh);
+            return;
+        }
+        if (res == VK_SUBOPTIMAL_KHR)
+            recreate = true;
+        else if (res != VK_SUCCESS)
+            die("failed to acquire swapchain image (%d)", res);
+    }
+
+    profile_cpu_begin(prof, PROFILE_CPU_UBO);
+    profile_input(prof);
+    render_instances_update(rh);
+    render_ubo_update(rh);
+    render_scale_update(rh);
+    if (rh->opts.hud_font)
+        render_hud_update(rh);
+    profile_cpu_end(prof, PROFILE_CPU_UBO);
+
+    profile_cpu_begin(prof, PROFILE_CPU_RECORD);
+    render_record(rh, img_index);
+    profile_cpu_end(prof, PROFILE_CPU_RECORD);
+
+    profile_cpu_begin(prof, PROFILE_CPU_SUBMIT);
+    if (rh->groupc > 1) {
+        render_submit_group(rh);
+        profile_cpu_end(prof, PROFILE_CPU_SUBMIT);
+        profile_frame_end(prof, rh->frm_index);
+        rh->frm_index = (rh->frm_index + 1) % rh->framec;
+        rh->frame++;
+        return;
+    }
+    /* binary semaphores ignore their value */
+    VkSemaphore wait_semas[3];
+    uint64_t wait_values[3];
+    VkPipelineStageFlags wait_stages[3];
+    uint32_t waitc = 0;
+    if (rh->qf.compute != rh->qf.gfx) {
+        uint64_t value = timeline_next(&rh->compute_timeline);
+        VkTimelineSemaphoreSubmitInfo cull_timeline_info = {
+            .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+            .signalSemaphoreValueCount = 1,
+            .pSignalSemaphoreValues = &value
+        };
+        VkSubmitInfo cull_submit_info = {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = &cull_timeline_info,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &rh->compute_cmdbufs[rh->frm_index],
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &rh->compute_timeline.semaphore,
+        };
+        if (vkQueueSubmit(rh->compute_queue, 1, &cull_submit_info,
+                          VK_NULL_HANDLE) != VK_SUCCESS)
+            die("failed to submit cull command buffer");
+
+        wait_semas[waitc] = rh->compute_timeline.semaphore;
+        wait_values[waitc] = value;
+        wait_stages[waitc++] = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                               VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    }
+    if (!rh->opts.headless) {
+        wait_semas[waitc] = rh->img_available[rh->frm_index];
+        wait_values[waitc] = 0;
+        wait_stages[waitc++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    }
+    if (rh->upload_value) {
+        wait_semas[waitc] = rh->upload.timeline.semaphore;
+        wait_values[waitc] = rh->upload_value;
+        wait_stages[waitc++] = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                               VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
+    rh->frm_values[rh->frm_index] = timeline_next(&rh->timeline);
+    VkSemaphore signal_semas[2] = { rh->timeline.semaphore };
+    uint64_t signal_values[2] = { rh->frm_values[rh->frm_index] };
+    uint32_t signalc = 1;
+    /* there is nothing to present, nor semaphores for it, when headless */
+    if (!rh->opts.headless) {
+        signal_semas[signalc] = rh->img_rendered[img_index];
+        signal_values[signalc++] = 0;
+    }
+
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .waitSemaphoreValueCount = waitc,
+        .pWaitSemaphoreValues = wait_values,
+        .signalSemaphoreValueCount = signalc,
+        .pSignalSemaphoreValues = signal_values
+    };
     VkSubmitInfo submit_info = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &rh->img_available[rh->frm_index],
+        .pNext = &timeline_info,
+        .waitSemaphoreCount = waitc,
+        .pWaitSemaphores = wait_semas,
         .pWaitDstStageMask = wait_stages,
         .commandBufferCount = 1,
-        .pCommandBuffers = &rh->sc_cmdbufs[img_index],
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &rh->img_rendered[rh->frm_index],
+        .pCommandBuffers = &rh->frm_cmdbufs[rh->frm_index],
+        .signalSemaphoreCount = signalc,
+        .pSignalSemaphores = signal_semas,
     };
 
-    if (vkQueueSubmit(rh->queue, 1, &submit_info,
-                      rh->frm_inflight[rh->frm_index]) != VK_SUCCESS)
+    if (vkQueueSubmit(rh->queue, 1, &submit_info, VK_NULL_HANDLE)
+            != VK_SUCCESS)
         die("failed to submit draw command buffer");
+    rh->upload_value = 0;
+    profile_cpu_end(prof, PROFILE_CPU_SUBMIT);
+
+    if (!rh->opts.headless) {
+        VkPresentInfoKHR present_info = {
+            .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &rh->img_rendered[img_index],
+            .swapchainCount = 1,
+            .pSwapchains = &rh->sc,
+            .pImageIndices = &img_index,
+            .pResults = NULL,
+        };
 
-    VkPresentInfoKHR present_info = {
-        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &rh->img_rendered[rh->frm_index],
-        .swapchainCount = 1,
-        .pSwapchains = &rh->sc,
-        .pImageIndices = &img_index,
-        .pResults = NULL,
-    };
+        profile_cpu_begin(prof, PROFILE_CPU_PRESENT);
+        VkResult res = vkQueuePresentKHR(rh->present_queue, &present_info);
+        profile_cpu_end(prof, PROFILE_CPU_PRESENT);
+        if (res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR)
+            recreate = true;
+        else if (res != VK_SUCCESS)
+            die("failed to present swapchain image (%d)", res);
+    }
 
-    vkQueuePresentKHR(rh->queue, &present_info);
+    profile_frame_end(prof, rh->frm_index);
+    rh->frm_index = (rh->frm_index + 1) % rh->framec;
+    rh->frame++;
 
-    rh->frm_index = (rh->frm_index + 1) % CONCURRENT_FRAMES;
+    if (recreate)
+        render_swapchain_recreate(rh);
 }
 
-int main(void) {
+void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [-Hbswz] [-n frames] [-r WxH] [-i instances] "
+            "[-j threads] [-a samples] [-d ms] [-m latency|power] "
+            "[-f frames] [-c fps] [-o mesh.obj] [-O level] [-g device] "
+            "[-G afr|sfr] [-F font.psf] [-p profile.csv] [-t trace.json] "
+            "[-B bench.txt]\n"
+            "  -H  render offscreen without a window, implies -n %d\n"
+            "  -n  exit after a number of frames and report frame times\n"
+            "  -r  window or offscreen resolution, default 800x600\n"
+            "  -i  number of mesh instances to draw, 1 to %d\n"
+            "  -j  threads recording command buffers, default one per cpu\n"
+            "  -s  collect pipeline statistics\n"
+            "  -z  lay down depth in a pre-pass before shading\n"
+            "  -a  multisample with up to 2 to 64 samples as the gpu "
+            "allows\n"
+            "  -d  scale the resolution down to half to hold a gpu frame "
+            "time in ms\n"
+            "  -b  texture through bindless descriptors\n"
+            "  -w  rebuild pipelines in the background when their shaders "
+            "change\n"
+            "  -m  present policy, latency (default) or power\n"
+            "  -f  frames in flight, 1 to %d, default by policy\n"
+            "  -c  cap the frame rate\n"
+            "  -o  draw a mesh from an obj file, cached next to it\n"
+            "  -O  mesh reordering, 0 none, 1 vertex cache and fetch "
+            "(default),\n"
+            "      2 overdraw as well\n"
+            "  -g  gpu by index or part of its name, default $TRI_DEVICE or "
+            "the best\n"
+            "  -G  spread frames over the gpu's device group, alternating "
+            "or split,\n"
+            "      needs -H\n"
+            "  -F  overlay the frame timings in a psf2 console font\n"
+            "  -p  write per-frame timings as csv on exit\n"
+            "  -t  write a chrome trace of the frame timings on exit\n"
+            "  -B  write the benchmark of -n as metric value lines on exit\n",
+            argv0, HEADLESS_FRAMES, MAX_INSTANCES, CONCURRENT_FRAMES);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
     struct render_handles rh = {0};
+    rh.opts.width = 800;
+    rh.opts.height = 600;
+    rh.opts.instances = 1;
+    rh.opts.samples = 1;
+    rh.opts.mesh_opt = MESH_OPT_DEFAULT;
+
+    const char *optstring = "Hn:r:i:j:szbwa:d:m:f:c:o:O:g:G:F:p:t:B:";
+    int c;
+    while ((c = getopt(argc, argv, optstring)) != -1) {
+        switch (c) {
+        case 'H':
+            rh.opts.headless = true;
+            break;
+        case 'n':
+            rh.opts.frames = strtoul(optarg, NULL, 10);
+            if (rh.opts.frames == 0)
+                usage(argv[0]);
+            break;
+        case 'r':
+            if (sscanf(optarg, "%ux%u", &rh.opts.width, &rh.opts.height) != 2
+                || rh.opts.width == 0 || rh.opts.height == 0)
+                usage(argv[0]);
+            break;
+        case 'i':
+            rh.opts.instances = strtoul(optarg, NULL, 10);
+            if (rh.opts.instances == 0 || rh.opts.instances > MAX_INSTANCES)
+                usage(argv[0]);
+            break;
+        case 'j':
+            rh.opts.recorders = strtoul(optarg, NULL, 10);
+            if (rh.opts.recorders == 0)
+                usage(argv[0]);
+            break;
+        case 's':
+            rh.opts.statistics = true;
+            break;
+        case 'z':
+            rh.opts.prepass = true;
+            break;
+        case 'b':
+            rh.opts.bindless = true;
+            break;
+        case 'w':
+            rh.opts.watch = true;
+            break;
+        case 'a':
+            rh.opts.samples = strtoul(optarg, NULL, 10);
+            if (rh.opts.samples == 0 || rh.opts.samples > 64 ||
+                (rh.opts.samples & (rh.opts.samples - 1)))
+                usage(argv[0]);
+            break;
+        case 'd': {
+            char *end;
+            rh.opts.frame_target = strtod(optarg, &end);
+            if (*end != '\0' || !(rh.opts.frame_target > 0))
+                usage(argv[0]);
+            break;
+        }
+        case 'm':
+            for (c = 0; c < PRESENT_POLICY_COUNT; c++) {
+                if (strcmp(optarg, PRESENT_POLICIES[c].name) == 0)
+                    break;
+            }
+            if (c == PRESENT_POLICY_COUNT)
+                usage(argv[0]);
+            rh.opts.present = c;
+            break;
+        case 'f':
+            rh.opts.frames_in_flight = strtoul(optarg, NULL, 10);
+            if (rh.opts.frames_in_flight == 0 ||
+                rh.opts.frames_in_flight > CONCURRENT_FRAMES)
+                usage(argv[0]);
+            break;
+        case 'c':
+            rh.opts.fps_cap = strtoul(optarg, NULL, 10);
+            if (rh.opts.fps_cap == 0)
+                usage(argv[0]);
+            break;
+        case 'o':
+            rh.opts.mesh = optarg;
+            break;
+        case 'O': {
+            char *end;
+            unsigned long level = strtoul(optarg, &end, 10);
+            if (*end != '\0' || level >= MESH_OPT_LEVELC)
+                usage(argv[0]);
+            rh.opts.mesh_opt = MESH_OPT_LEVELS[level];
+            break;
+        }
+        case 'g':
+            rh.opts.device = optarg;
+            break;
+        case 'G':
+            for (c = MULTI_GPU_AFR; c < MULTI_GPU_COUNT; c++) {
+                if (strcmp(optarg, MULTI_GPU_NAMES[c]) == 0)
+                    break;
+            }
+            if (c == MULTI_GPU_COUNT)
+                usage(argv[0]);
+            rh.opts.multi_gpu = c;
+            break;
+        case 'F':
+            rh.opts.hud_font = optarg;
+            break;
+        case 'p':
+            rh.opts.profile_csv = optarg;
+            break;
+        case 't':
+            rh.opts.profile_trace = optarg;
+            break;
+        case 'B':
+            rh.opts.bench_out = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (optind < argc)
+        usage(argv[0]);
+    /* presenting from a group needs device group swapchains */
+    if (rh.opts.multi_gpu != MULTI_GPU_NONE && !rh.opts.headless)
+        usage(argv[0]);
+    if (rh.opts.headless && rh.opts.frames == 0)
+        rh.opts.frames = HEADLESS_FRAMES;
+
     render_init(&rh);
 
     SDL_Event event;
     bool quit = false;
     while (!quit) {
-        while (SDL_PollEvent(&event) != 0) {
+        while (!rh.opts.headless && SDL_PollEvent(&event) != 0) {
             switch (event.type) {
             case SDL_QUIT:
                 quit = true;
@@ -1200,6 +3447,8 @@ int main(void) {
         }
 
         render_draw(&rh);
+        if (rh.opts.frames > 0 && rh.frame >= rh.opts.frames)
+            quit = true;
     }
 
     render_destroy(&rh);
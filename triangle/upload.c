@@ -0,0 +1,223 @@
+#include "upload.h"
+
+#include <string.h>
+
+#include "alloc.h"
+#include "util.h"
+
+#define UPLOAD_ALIGN 16
+
+void upload_init(struct upload_queue *uq, VkDevice device,
+                 struct mem_allocator *ma,
+                 VkQueue queue, uint32_t family) {
+    uq->device = device;
+    uq->queue = queue;
+    uq->family = family;
+
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                 VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = family
+    };
+    if (vkCreateCommandPool(device, &pool_info, vk_allocator, &uq->pool)
+            != VK_SUCCESS)
+        die("failed to create upload command pool");
+
+    VkCommandBuffer cmdbufs[UPLOAD_BATCHES];
+    VkCommandBufferAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandPool = uq->pool,
+        .commandBufferCount = UPLOAD_BATCHES
+    };
+    if (vkAllocateCommandBuffers(device, &alloc_info, cmdbufs) != VK_SUCCESS)
+        die("failed to allocate upload command buffers");
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    VkMemoryPropertyFlags props = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    mem_buffer_create(ma, UPLOAD_STAGING_SIZE, usage, props, 0, NULL,
+                      &uq->staging, &uq->staging_mem);
+    uq->batch_size = UPLOAD_STAGING_SIZE / UPLOAD_BATCHES;
+
+    timeline_init(&uq->timeline, device);
+    for (int i = 0; i < UPLOAD_BATCHES; i++) {
+        struct upload_batch *b = &uq->batches[i];
+        b->cmdbuf = cmdbufs[i];
+        b->value = 0;
+        b->base = i*uq->batch_size;
+        b->head = b->base;
+        b->copyc = 0;
+        b->recording = false;
+    }
+    uq->current = 0;
+}
+
+void upload_destroy(struct upload_queue *uq, struct mem_allocator *ma) {
+    upload_wait(uq);
+
+    for (int i = 0; i < UPLOAD_BATCHES; i++) {
+        struct upload_batch *b = &uq->batches[i];
+        if (b->recording)
+            vkEndCommandBuffer(b->cmdbuf);
+        vkFreeCommandBuffers(uq->device, uq->pool, 1, &b->cmdbuf);
+    }
+    timeline_destroy(&uq->timeline);
+    vkDestroyCommandPool(uq->device, uq->pool, vk_allocator);
+    mem_buffer_destroy(ma, uq->staging, &uq->staging_mem);
+}
+
+static void upload_batch_retire(struct upload_queue *uq,
+                                struct upload_batch *b) {
+    if (b->value == 0)
+        return;
+
+    timeline_wait(&uq->timeline, b->value);
+    b->value = 0;
+}
+
+static void upload_batch_begin(struct upload_queue *uq,
+                               struct upload_batch *b) {
+    upload_batch_retire(uq, b);
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+    };
+    vkResetCommandBuffer(b->cmdbuf, 0);
+    if (vkBeginCommandBuffer(b->cmdbuf, &begin_info) != VK_SUCCESS)
+        die("failed to begin upload command buffer");
+
+    b->head = b->base;
+    b->copyc = 0;
+    b->recording = true;
+}
+
+/* staging space in a recording batch, its offset is left in b->head */
+static struct upload_batch *upload_stage(struct upload_queue *uq,
+                                         VkDeviceSize size) {
+    if (size > uq->batch_size)
+        die("upload of %llu bytes exceeds staging batch size",
+            (unsigned long long)size);
+
+    struct upload_batch *b = &uq->batches[uq->current];
+    if (b->recording && b->head + size > b->base + uq->batch_size) {
+        upload_flush(uq);
+        b = &uq->batches[uq->current];
+    }
+    if (!b->recording)
+        upload_batch_begin(uq, b);
+    b->copyc++;
+    return b;
+}
+
+static void *upload_advance(struct upload_queue *uq, struct upload_batch *b,
+                            VkDeviceSize size) {
+    void *data = (char*)uq->staging_mem.mapped + b->head;
+    b->head = (b->head + size + UPLOAD_ALIGN - 1) & ~(VkDeviceSize)
+              (UPLOAD_ALIGN - 1);
+    return data;
+}
+
+void *upload_reserve(struct upload_queue *uq,
+                     VkBuffer dst, VkDeviceSize dst_offset,
+                     VkDeviceSize size) {
+    struct upload_batch *b = upload_stage(uq, size);
+    VkBufferCopy region = {
+        .srcOffset = b->head,
+        .dstOffset = dst_offset,
+        .size = size
+    };
+    vkCmdCopyBuffer(b->cmdbuf, uq->staging, dst, 1, &region);
+    return upload_advance(uq, b, size);
+}
+
+void upload_image(struct upload_queue *uq, VkImage dst, VkExtent2D extent,
+                  const void *data, VkDeviceSize size) {
+    struct upload_batch *b = upload_stage(uq, size);
+
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = 0,
+        .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = dst,
+        .subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+    };
+    vkCmdPipelineBarrier(b->cmdbuf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, NULL, 0, NULL, 1, &barrier);
+
+    VkBufferImageCopy region = {
+        .bufferOffset = b->head,
+        .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+        .imageExtent = {extent.width, extent.height, 1},
+    };
+    vkCmdCopyBufferToImage(b->cmdbuf, uq->staging, dst,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    /* made visible to the graphics queue by its wait on the timeline */
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(b->cmdbuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                         0, NULL, 0, NULL, 1, &barrier);
+
+    memcpy(upload_advance(uq, b, size), data, size);
+}
+
+void upload_buffer(struct upload_queue *uq,
+                   VkBuffer dst, VkDeviceSize dst_offset,
+                   const void *data, VkDeviceSize size) {
+    const char *src = data;
+    while (size > 0) {
+        VkDeviceSize chunk = size < uq->batch_size ? size : uq->batch_size;
+        memcpy(upload_reserve(uq, dst, dst_offset, chunk), src, chunk);
+        src += chunk;
+        dst_offset += chunk;
+        size -= chunk;
+    }
+}
+
+uint64_t upload_flush(struct upload_queue *uq) {
+    struct upload_batch *b = &uq->batches[uq->current];
+    if (!b->recording)
+        return 0;
+
+    if (vkEndCommandBuffer(b->cmdbuf) != VK_SUCCESS)
+        die("failed to record upload command buffer");
+    b->recording = false;
+
+    b->value = timeline_next(&uq->timeline);
+    VkTimelineSemaphoreSubmitInfo timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &b->value
+    };
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timeline_info,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &b->cmdbuf,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &uq->timeline.semaphore,
+    };
+    if (vkQueueSubmit(uq->queue, 1, &submit_info, VK_NULL_HANDLE)
+            != VK_SUCCESS)
+        die("failed to submit upload batch of %u copies", b->copyc);
+
+    uq->current = (uq->current + 1) % UPLOAD_BATCHES;
+    return b->value;
+}
+
+void upload_wait(struct upload_queue *uq) {
+    for (int i = 0; i < UPLOAD_BATCHES; i++) {
+        upload_batch_retire(uq, &uq->batches[i]);
+    }
+}
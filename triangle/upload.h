@@ -0,0 +1,74 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <stdbool.h>
+
+#include <vulkan/vulkan.h>
+
+#include "mem.h"
+#include "timeline.h"
+
+/* Batched buffer and image uploads. Copies are staged in a persistently
+ * mapped buffer and recorded into one command buffer per batch, which is
+ * submitted with upload_flush(). Two batches alternate so the next one can
+ * be filled while the previous one is still executing; completion is
+ * tracked on the upload queue's own timeline and the host only blocks when
+ * both are in flight.
+ * The graphics queue waits on that timeline rather than the uploads
+ * signaling the frame timeline, as two queues signaling one timeline could
+ * complete out of order and move its value backwards. */
+
+#define UPLOAD_BATCHES 2
+#define UPLOAD_STAGING_SIZE (16*1024*1024)
+
+struct upload_batch {
+    VkCommandBuffer cmdbuf;
+    uint64_t value; /* signaled on completion, 0 once retired */
+    VkDeviceSize base; /* start of this batch's staging region */
+    VkDeviceSize head;
+    uint32_t copyc;
+    bool recording;
+};
+
+struct upload_queue {
+    VkDevice device;
+    VkQueue queue;
+    uint32_t family;
+    VkCommandPool pool;
+    struct timeline timeline;
+
+    VkBuffer staging;
+    struct mem_alloc staging_mem;
+    VkDeviceSize batch_size;
+
+    struct upload_batch batches[UPLOAD_BATCHES];
+    uint32_t current;
+};
+
+void upload_init(struct upload_queue *uq, VkDevice device,
+                 struct mem_allocator *ma,
+                 VkQueue queue, uint32_t family);
+void upload_destroy(struct upload_queue *uq, struct mem_allocator *ma);
+
+/* reserve staging memory for size bytes that will be copied to dst at
+ * dst_offset when the batch executes, the caller fills in the data */
+void *upload_reserve(struct upload_queue *uq,
+                     VkBuffer dst, VkDeviceSize dst_offset,
+                     VkDeviceSize size);
+void upload_buffer(struct upload_queue *uq,
+                   VkBuffer dst, VkDeviceSize dst_offset,
+                   const void *data, VkDeviceSize size);
+
+/* Copy tightly packed texels into the only level and layer of a color
+ * image, which is left in SHADER_READ_ONLY_OPTIMAL. The image must be
+ * shared by the upload family and its users, as its ownership is never
+ * transferred; it fits in one batch. */
+void upload_image(struct upload_queue *uq, VkImage dst, VkExtent2D extent,
+                  const void *data, VkDeviceSize size);
+
+/* submit the current batch, returns the value of uq->timeline that is
+ * signaled on its completion or 0 if there was nothing to submit */
+uint64_t upload_flush(struct upload_queue *uq);
+void upload_wait(struct upload_queue *uq);
+
+#endif
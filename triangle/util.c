@@ -0,0 +1,17 @@
+#include "util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+void die(const char *fmt, ...) {
+    va_list ap;
+
+    fprintf(stderr, "error: ");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+
+    exit(1);
+}
@@ -0,0 +1,210 @@
+#include "variants.h"
+
+#include <string.h>
+
+#include "alloc.h"
+
+void variants_init(struct variants *v, VkDevice device,
+                   variant_build_fn build, void *arg) {
+    v->device = device;
+    v->build = build;
+    v->arg = arg;
+    v->slots = NULL;
+    v->count = v->cap = 0;
+    pthread_mutex_init(&v->lock, NULL);
+}
+
+void variants_destroy(struct variants *v) {
+    for (uint32_t i = 0; i < v->cap; i++) {
+        vkDestroyPipeline(v->device, v->slots[i].pipeline, vk_allocator);
+        vkDestroyPipeline(v->device, v->slots[i].pending, vk_allocator);
+    }
+    host_free(v->slots);
+    pthread_mutex_destroy(&v->lock);
+}
+
+void variant_specialization(const struct variant_key *key,
+                            struct variant_spec *spec) {
+    for (uint32_t i = 0; i < VARIANT_FEATURES; i++) {
+        spec->values[i] = (key->features & 1u << i) ? VK_TRUE : VK_FALSE;
+        spec->entries[i].constantID = i;
+        spec->entries[i].offset = i*sizeof(VkBool32);
+        spec->entries[i].size = sizeof(VkBool32);
+    }
+    spec->info.mapEntryCount = VARIANT_FEATURES;
+    spec->info.pMapEntries = spec->entries;
+    spec->info.dataSize = sizeof(spec->values);
+    spec->info.pData = spec->values;
+}
+
+static uint32_t key_hash(const struct variant_key *key) {
+    uint32_t words[] = {key->flags, key->features, key->subpass,
+                        key->samples};
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 4; i++) {
+        hash ^= words[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool key_equal(const struct variant_key *a,
+                      const struct variant_key *b) {
+    return a->flags == b->flags && a->features == b->features &&
+           a->subpass == b->subpass && a->samples == b->samples;
+}
+
+/* the slot holding key, or the empty one it would go in */
+static struct variant *variants_slot(struct variant *slots, uint32_t cap,
+                                     const struct variant_key *key) {
+    uint32_t i = key_hash(key) & (cap - 1);
+    while (slots[i].pipeline != VK_NULL_HANDLE &&
+           !key_equal(&slots[i].key, key)) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &slots[i];
+}
+
+static struct variant *variants_find(struct variants *v,
+                                     const struct variant_key *key) {
+    if (v->cap == 0)
+        return NULL;
+    struct variant *slot = variants_slot(v->slots, v->cap, key);
+    return slot->pipeline != VK_NULL_HANDLE ? slot : NULL;
+}
+
+/* rehash into cap slots, dropping the empty and retired ones */
+static void variants_rehash(struct variants *v, uint32_t cap) {
+    struct variant *slots = host_realloc(NULL, cap*sizeof(*slots));
+    memset(slots, 0, cap*sizeof(*slots));
+    for (uint32_t i = 0; i < v->cap; i++) {
+        if (v->slots[i].pipeline != VK_NULL_HANDLE)
+            *variants_slot(slots, cap, &v->slots[i].key) = v->slots[i];
+    }
+    host_free(v->slots);
+    v->slots = slots;
+    v->cap = cap;
+}
+
+/* kept at most 3/4 full so probes stay short */
+static void variants_insert(struct variants *v,
+                            const struct variant_key *key,
+                            VkPipeline pipeline) {
+    if ((v->count + 1)*4 > v->cap*3)
+        variants_rehash(v, v->cap ? v->cap*2 : 16);
+    struct variant *slot = variants_slot(v->slots, v->cap, key);
+    slot->key = *key;
+    slot->pipeline = pipeline;
+    slot->pending = VK_NULL_HANDLE;
+    v->count++;
+}
+
+/* built without the lock so variants build in parallel, a variant built
+ * twice by racing threads is only kept once */
+VkPipeline variants_get(struct variants *v, const struct variant_key *key) {
+    pthread_mutex_lock(&v->lock);
+    struct variant *found = variants_find(v, key);
+    VkPipeline pipeline = found ? found->pipeline : VK_NULL_HANDLE;
+    pthread_mutex_unlock(&v->lock);
+    if (pipeline != VK_NULL_HANDLE)
+        return pipeline;
+
+    VkPipeline built;
+    v->build(v->arg, key, &built);
+
+    pthread_mutex_lock(&v->lock);
+    found = variants_find(v, key);
+    if (found) {
+        vkDestroyPipeline(v->device, built, vk_allocator);
+        pipeline = found->pipeline;
+    } else {
+        variants_insert(v, key, built);
+        pipeline = built;
+    }
+    pthread_mutex_unlock(&v->lock);
+    return pipeline;
+}
+
+struct variant_builds {
+    struct variants *v;
+    const struct variant_key *keys;
+};
+
+static void variants_build_job(void *arg, uint32_t index) {
+    struct variant_builds *builds = arg;
+    variants_get(builds->v, &builds->keys[index]);
+}
+
+uint32_t variants_build(struct variants *v, const struct variant_key *keys,
+                        uint32_t count, struct jobs *j) {
+    uint32_t missing = 0;
+    pthread_mutex_lock(&v->lock);
+    for (uint32_t i = 0; i < count; i++) {
+        missing += variants_find(v, &keys[i]) == NULL;
+    }
+    pthread_mutex_unlock(&v->lock);
+
+    struct variant_builds builds = {v, keys};
+    jobs_run(j, count, variants_build_job, &builds);
+    return missing;
+}
+
+void variants_retire(struct variants *v, struct defer_queue *dq,
+                     variant_match_fn match, void *arg) {
+    pthread_mutex_lock(&v->lock);
+    for (uint32_t i = 0; i < v->cap; i++) {
+        struct variant *slot = &v->slots[i];
+        if (slot->pipeline == VK_NULL_HANDLE || !match(arg, &slot->key))
+            continue;
+        defer_pipeline(dq, slot->pipeline);
+        if (slot->pending != VK_NULL_HANDLE)
+            vkDestroyPipeline(v->device, slot->pending, vk_allocator);
+        slot->pipeline = slot->pending = VK_NULL_HANDLE;
+        v->count--;
+    }
+    /* emptied slots would break the probe sequences running through them */
+    if (v->cap > 0)
+        variants_rehash(v, v->cap);
+    pthread_mutex_unlock(&v->lock);
+}
+
+uint32_t variants_rebuild(struct variants *v, variant_match_fn match,
+                          void *arg) {
+    /* matched up front, building may change what matches */
+    pthread_mutex_lock(&v->lock);
+    struct variant_key *keys = host_realloc(NULL,
+                                            v->count*sizeof(*keys));
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < v->cap; i++) {
+        if (v->slots[i].pipeline != VK_NULL_HANDLE &&
+            match(arg, &v->slots[i].key))
+            keys[count++] = v->slots[i].key;
+    }
+    pthread_mutex_unlock(&v->lock);
+
+    for (uint32_t i = 0; i < count; i++) {
+        VkPipeline built;
+        v->build(v->arg, &keys[i], &built);
+        pthread_mutex_lock(&v->lock);
+        variants_find(v, &keys[i])->pending = built;
+        pthread_mutex_unlock(&v->lock);
+    }
+    host_free(keys);
+    return count;
+}
+
+uint32_t variants_swap(struct variants *v, struct defer_queue *dq) {
+    uint32_t count = 0;
+    pthread_mutex_lock(&v->lock);
+    for (uint32_t i = 0; i < v->cap; i++) {
+        struct variant *slot = &v->slots[i];
+        if (slot->pending == VK_NULL_HANDLE)
+            continue;
+        defer_pipeline(dq, slot->pipeline);
+        slot->pipeline = slot->pending;
+        slot->pending = VK_NULL_HANDLE;
+        count++;
+    }
+    pthread_mutex_unlock(&v->lock);
+    return count;
+}
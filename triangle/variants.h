@@ -0,0 +1,99 @@
+#ifndef VARIANTS_H
+#define VARIANTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+
+#include "defer.h"
+#include "jobs.h"
+
+/* Pipelines keyed by the fixed function state and shader features they
+ * are built with, in an open addressing hash map. Features are
+ * specialization constants rather than uniforms, so the driver folds
+ * away whatever a variant does not use. Variants are built ahead of time
+ * with variants_build() from the list of keys the renderer will draw
+ * with, or on first use by variants_get(); the frame loop only ever finds
+ * them built. The vertex layout is not part of the key as it is fixed at
+ * compile time, see vertex.h. */
+
+enum variant_flag {
+    VARIANT_COMPUTE = 1 << 0, /* the cull pipeline, nothing else applies */
+    VARIANT_BLEND = 1 << 1, /* alpha blending, else opaque */
+    VARIANT_CULL_BACK = 1 << 2, /* else both faces are drawn */
+    VARIANT_DEPTH_ONLY = 1 << 3, /* no fragment stage and no color */
+    VARIANT_DEPTH_EQUAL = 1 << 4, /* shading after a depth pre-pass */
+    VARIANT_BINDLESS = 1 << 5, /* fragment shader reading the bindless set */
+    VARIANT_TEXT = 1 << 6, /* the text overlay, nothing else applies */
+};
+
+/* specialization constants, constant_id is the index of the bit */
+enum variant_feature {
+    VARIANT_LIT = 1 << 0, /* diffuse lighting from the vertex normal */
+    VARIANT_TEXTURED = 1 << 1, /* bindless texture, needs VARIANT_BINDLESS */
+};
+#define VARIANT_FEATURES 2
+
+struct variant_key {
+    uint32_t flags; /* enum variant_flag */
+    uint32_t features; /* enum variant_feature */
+    uint32_t subpass;
+    uint32_t samples; /* VkSampleCountFlagBits, 0 for compute */
+};
+
+/* the constants of a key's features, pointed to by info */
+struct variant_spec {
+    VkBool32 values[VARIANT_FEATURES];
+    VkSpecializationMapEntry entries[VARIANT_FEATURES];
+    VkSpecializationInfo info;
+};
+
+/* creates the pipeline for a key, called from several threads at once */
+typedef void (*variant_build_fn)(void *arg, const struct variant_key *key,
+                                 VkPipeline *pipeline);
+typedef bool (*variant_match_fn)(void *arg, const struct variant_key *key);
+
+struct variant {
+    struct variant_key key;
+    VkPipeline pipeline; /* VK_NULL_HANDLE in an empty slot */
+    VkPipeline pending; /* rebuilt and waiting for variants_swap() */
+};
+
+struct variants {
+    VkDevice device;
+    variant_build_fn build;
+    void *arg;
+    pthread_mutex_t lock;
+    struct variant *slots;
+    uint32_t count, cap; /* cap is 0 or a power of two */
+};
+
+void variants_init(struct variants *v, VkDevice device,
+                   variant_build_fn build, void *arg);
+/* destroys every variant, the device must be idle */
+void variants_destroy(struct variants *v);
+
+void variant_specialization(const struct variant_key *key,
+                            struct variant_spec *spec);
+
+/* the variant for key, built first if missing */
+VkPipeline variants_get(struct variants *v, const struct variant_key *key);
+/* build the missing ones of keys in parallel, returns how many were */
+uint32_t variants_build(struct variants *v, const struct variant_key *keys,
+                        uint32_t count, struct jobs *j);
+/* remove the variants matching, they may still be in use by the frames in
+ * flight */
+void variants_retire(struct variants *v, struct defer_queue *dq,
+                     variant_match_fn match, void *arg);
+
+/* Build replacements for the variants matching on the calling thread,
+ * returns how many. Only variants_get() may run meanwhile. */
+uint32_t variants_rebuild(struct variants *v, variant_match_fn match,
+                          void *arg);
+/* put rebuilt variants in place, the replaced ones are retired */
+uint32_t variants_swap(struct variants *v, struct defer_queue *dq);
+
+#endif
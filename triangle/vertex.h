@@ -0,0 +1,33 @@
+#ifndef VERTEX_H
+#define VERTEX_H
+
+/* The vertex layout, included by both C and GLSL. Every attribute is
+ *
+ *     A(name, location, C type, components, vertex format, GLSL type,
+ *       encoding)
+ *
+ * from which mesh.h declares struct mesh_vertex, mesh.c encodes vertices,
+ * vulkan_pipeline() describes the attributes and the vertex shader
+ * declares its inputs. Positions are unorm over the bounding box and
+ * normals octahedral in [-1, 1], whatever the storage. Build everything
+ * with -DVERTEX_FLOAT for full precision vertices; half floats are not
+ * offered as unorm16 is more precise over the box at the same size. */
+
+#ifndef VERTEX_FLOAT
+#define VERTEX_LAYOUT 1
+#define VERTEX_ATTRIBUTES(A) \
+    A(pos, 0, uint16_t, 4, VK_FORMAT_R16G16B16A16_UNORM, vec3, unorm16) \
+    A(normal, 1, int16_t, 2, VK_FORMAT_R16G16_SNORM, vec2, snorm16) \
+    A(col, 2, uint8_t, 4, VK_FORMAT_R8G8B8A8_UNORM, vec4, unorm8)
+#else
+#define VERTEX_LAYOUT 2
+#define VERTEX_ATTRIBUTES(A) \
+    A(pos, 0, float, 3, VK_FORMAT_R32G32B32_SFLOAT, vec3, float32) \
+    A(normal, 1, float, 2, VK_FORMAT_R32G32_SFLOAT, vec2, float32) \
+    A(col, 2, float, 4, VK_FORMAT_R32G32B32A32_SFLOAT, vec4, float32)
+#endif
+
+/* first location after the vertex attributes */
+#define VERTEX_LOCATIONS 3
+
+#endif